@@ -16,8 +16,11 @@
  * https://www.bundesnetzagentur.de/SharedDocs/Downloads/DE/Sachgebiete/Telekommunikation/Unternehmen_Institutionen/Frequenzen/Allgemeinzuteilungen/FunkanlagenGeringerReichweite/2018_05_SRD_pdf.pdf?__blob=publicationFile&v=7
  *
  */
-#include <RadioLib.h>
-#include <TinyGPS++.h>
+#include <GpsFeed.h>
+#include <HudText.h>
+#include <LoRaLink.h>
+#include <OledUi.h>
+#include <PmuSampler.h>
 
 #include "LoRaBoards.h"
 #include "SSD1306.h"
@@ -25,7 +28,32 @@
 #define ARRAY_SIZE(x) sizeof(x) / sizeof(x[0])
 
 SSD1306 display(0x3c, 21, 22);
-TinyGPSPlus gps;
+// NMEA parsed in the background, loop() only takes the latest fix
+GpsFeed gps_feed;
+uint32_t shown_fix = 0;
+
+// battery state, read from the PMU in the background
+PmuSampler pmu_sampler;
+
+// display labels, redrawn only when their text changes
+OledUi ui(display);
+uint8_t ui_title = ui.label(30, 0, ArialMT_Plain_16, TEXT_ALIGN_CENTER);
+uint8_t ui_battery = ui.label(120, 0, ArialMT_Plain_10, TEXT_ALIGN_RIGHT);
+uint8_t ui_next[] = {
+    ui.label(0, 18, ArialMT_Plain_10, TEXT_ALIGN_LEFT),
+    ui.label(0, 28, ArialMT_Plain_10, TEXT_ALIGN_LEFT),
+    ui.label(0, 38, ArialMT_Plain_10, TEXT_ALIGN_LEFT),
+};
+uint8_t ui_off = ui.label(60, 30, ArialMT_Plain_16, TEXT_ALIGN_CENTER);
+uint8_t ui_status = ui.label(0, 50, ArialMT_Plain_10, TEXT_ALIGN_LEFT);
+uint8_t ui_gps = ui.label(120, 50, ArialMT_Plain_10, TEXT_ALIGN_RIGHT);
+
+// label and log line texts, formatted without heap allocations
+HudText<OLED_UI_TEXT_SIZE> label_text;
+HudText<80> log_text;
+
+// "NO GPS" once the last fix is older
+#define GPS_FIX_TIMEOUT 2000  // ms
 
 #include "Button2.h"
 Button2 prgBtn;
@@ -38,58 +66,46 @@ Button2 prgBtn;
 #define CONFIG_RADIO_SYNC 0x42
 
 // Adjust the duty cycle depending on message size and rotation number!
-#define LORA_DUTY_CYCLE_INTERVAL 10000  // 10s
+// message pacing, the airtime budget of the sub-band applies on top
+#define LORA_TX_INTERVAL 10000  // 10 s between fragments
+
+const LoRaConfig lora_config = {
+    CONFIG_RADIO_FREQ, CONFIG_RADIO_BW,           CONFIG_RADIO_SF,
+    CONFIG_RADIO_CR,   CONFIG_RADIO_SYNC,         CONFIG_RADIO_OUTPUT_POWER,
+    false,             LORA_TX_INTERVAL,
+};
 #define MESSAGE_ROTATION_NUM 4
 
-SX1276 radio =
-    new Module(RADIO_CS_PIN, RADIO_DIO0_PIN, RADIO_RST_PIN, RADIO_BUSY_PIN);
+LoRaLink<SX1276, LoRaPins<RADIO_CS_PIN, RADIO_DIO0_PIN, RADIO_RST_PIN,
+                          RADIO_DIO1_PIN>>
+    lora(0xC2);  // address of this device
 
-// save transmission state between loops
-static int transmissionState = RADIOLIB_ERR_NONE;
-// flag to indicate that a packet was sent
-static volatile bool lora_tx_available = false;
 static uint32_t counter = 0;
 // static String payload;
 
 byte broadcastAddress = 0xFF;
-byte localAddress = 0xC2;  // address of this device
 
 bool transmit_loop = false;
-RadioLibTime_t lora_transmission_end_time = 0;
 
 char full_message[] =
     "Find me in the meeting room on the window to get the next peer address.";
-String messages[MESSAGE_ROTATION_NUM];
+// every MESSAGE_ROTATION_NUM-th char of full_message, from offset n
+#define MESSAGE_SIZE (sizeof(full_message) / MESSAGE_ROTATION_NUM + 2)
+HudText<MESSAGE_SIZE> messages[MESSAGE_ROTATION_NUM];
 int messageCounter = 0;  // flip with % MESSAGE_ROTATION_NUM
 
 ///
 ///
-bool lora_transmit_available();
-bool lora_dutyCycle_available();
-bool lora_send_packet(String payload, byte recipientAddress);
-bool lora_send_packet(byte payload[], size_t size, byte recipientAddress);
 
 void click_callback(Button2& b);
 
-// callback when transmission is completed
-ICACHE_RAM_ATTR void callback_lora_tx_finished(void) {
-  // we sent a packet, set the flag
-  Serial.print("Transmission ");
-  lora_tx_available = true;
-
-  lora_transmission_end_time = millis();
-
-  if (transmissionState == RADIOLIB_ERR_NONE) {
-    // packet was successfully sent
-    Serial.println(F("finished!"));
-  } else {
-    Serial.print(F("failed, code "));
-    Serial.println(transmissionState);
-  }
-}
+// wakes loop() on button presses
+ICACHE_RAM_ATTR void button_interrupt() { lora.wakeFromISR(); }
 
 void setup() {
   setupBoards();
+  pmu_sampler.begin(PMU, PMU_IRQ);
+  gps_feed.begin(SerialGPS);
   delay(1500);
 
   // Initialising the UI will init the display too.
@@ -97,100 +113,17 @@ void setup() {
 
   display.flipScreenVertically();
   display.setFont(ArialMT_Plain_10);
+  ui.set(ui_title, "CHAL 2");
+  // draws in its own task from here on
+  ui.begin();
 
-  // initialize radio with default settings
-  Serial.print(F("Radio Initializing ... "));
-  int state = radio.begin();
-
-  printResult(state == RADIOLIB_ERR_NONE);
-  if (state == RADIOLIB_ERR_NONE) {
-    Serial.println(F("success!"));
-  } else {
-    Serial.print(F("failed, code "));
-    Serial.println(state);
-    while (true);
-  }
-
-  /*
-   *   Sets carrier frequency.
-   *   SX1278/SX1276 : Allowed values range from 137.0 MHz to 525.0 MHz.
-   *   SX1268/SX1262 : Allowed values are in range from 150.0 to 960.0 MHz.
-   * * * */
-  if (radio.setFrequency(CONFIG_RADIO_FREQ) == RADIOLIB_ERR_INVALID_FREQUENCY) {
-    Serial.println(F("Selected frequency is invalid for this module!"));
-    while (true);
-  }
-
-  /*
-   *   Sets LoRa link bandwidth.
-   *   SX1278/SX1276 : Allowed values are 10.4, 15.6, 20.8, 31.25, 41.7, 62.5,
-   * 125, 250 and 500 kHz. Only available in %LoRa mode. SX1268/SX1262 : Allowed
-   * values are 7.8, 10.4, 15.6, 20.8, 31.25, 41.7, 62.5, 125.0, 250.0 and 500.0
-   * kHz.
-   * * * */
-  if (radio.setBandwidth(CONFIG_RADIO_BW) == RADIOLIB_ERR_INVALID_BANDWIDTH) {
-    Serial.println(F("Selected bandwidth is invalid for this module!"));
-    while (true);
-  }
-
-  /*
-   * Sets LoRa link spreading factor.
-   * SX1278/SX1276 :  Allowed values range from 6 to 12. Only available in LoRa
-   * mode. SX1262        :  Allowed values range from 5 to 12.
-   * * * */
-  if (radio.setSpreadingFactor(CONFIG_RADIO_SF) ==
-      RADIOLIB_ERR_INVALID_SPREADING_FACTOR) {
-    Serial.println(F("Selected spreading factor is invalid for this module!"));
-    while (true);
-  }
-
-  /*
-   * Sets LoRa coding rate denominator.
-   * SX1278/SX1276/SX1268/SX1262 : Allowed values range from 5 to 8. Only
-   * available in LoRa mode.
-   * * * */
-  if (radio.setCodingRate(CONFIG_RADIO_CR) ==
-      RADIOLIB_ERR_INVALID_CODING_RATE) {
-    Serial.println(F("Selected coding rate is invalid for this module!"));
-    while (true);
-  }
-
-  /*
-   * Sets LoRa sync word.
-   * SX1278/SX1276/SX1268/SX1262/SX1280 : Sets LoRa sync word. Only available in
-   * LoRa mode.
-   * * */
-  if (radio.setSyncWord(CONFIG_RADIO_SYNC) != RADIOLIB_ERR_NONE) {
-    Serial.println(F("Unable to set sync word!"));
-    while (true);
-  }
-
-  /*
-   * Sets transmission output power.
-   * SX1278/SX1276 :  Allowed values range from +2 to +17 dBm (PA_BOOST pin).
-   * High power +20 dBm operation is also supported. Defaults to PA_BOOST.
-   * SX1262        :  Allowed values are in range from -9 to 22 dBm. This method
-   * is virtual to allow override from the SX1261 class.
-   * * * */
-  if (radio.setOutputPower(CONFIG_RADIO_OUTPUT_POWER) ==
-      RADIOLIB_ERR_INVALID_OUTPUT_POWER) {
-    Serial.println(F("Selected output power is invalid for this module!"));
-    while (true);
-  }
-
-  // Enables or disables CRC check of received packets.
-  if (radio.setCRC(false) == RADIOLIB_ERR_INVALID_CRC_CONFIGURATION) {
-    Serial.println(F("Selected CRC is invalid for this module!"));
-    while (true);
-  }
-
-  // set the function that will be called
-  // when packet transmission is finished
-  radio.setPacketSentAction(callback_lora_tx_finished);
-  lora_tx_available = true;
+  // transmit only, the radio is not put into receive mode
+  lora.begin(lora_config, false);
+  printResult(true);
 
   prgBtn.begin(BUTTON_PIN);
   prgBtn.setTapHandler(click_callback);
+  attachInterrupt(BUTTON_PIN, button_interrupt, CHANGE);
 
   delay(1000);
   Serial.println("setup finished -----------------------");
@@ -199,16 +132,14 @@ void setup() {
   for (int n = 0; n < MESSAGE_ROTATION_NUM; n++) {
     int fwd = n % MESSAGE_ROTATION_NUM;
 
-    String msg = "";
+    messages[n].clear();
 
     // -1 due to \0 message delimiter
     for (int i = 0; i < sizeof(full_message) - 1 - fwd;
          i = i + MESSAGE_ROTATION_NUM) {
       char atPos = full_message[i + fwd];
-      msg += atPos;
+      messages[n].append(atPos);
     }
-
-    messages[n] = msg;
   }
 
   Serial.println("starting up........");
@@ -218,164 +149,76 @@ void setup() {
 void loop() {
   prgBtn.loop();
 
-  display.clear();
-
-  display.setTextAlignment(TEXT_ALIGN_CENTER);
-  display.setFont(ArialMT_Plain_16);
-  display.drawString(30, 0, "CHAL 2");
-  display.setTextAlignment(TEXT_ALIGN_LEFT);
-  display.setFont(ArialMT_Plain_10);
-
-  if (PMU->isBatteryConnect()) {
-    display.setTextAlignment(TEXT_ALIGN_RIGHT);
-    if (PMU->isCharging()) {
-      display.drawString(120, 0,
-                         "Crg " + String(PMU->getBatteryPercent()) + "%");
-    } else {
-      display.drawString(120, 0,
-                         "Bat " + String(PMU->getBatteryPercent()) + "%");
-    }
-    display.setTextAlignment(TEXT_ALIGN_LEFT);
-  }
-
-  if (transmit_loop) {
-    display.drawString(0, 18, "Next: contact C3 @");
-    display.drawString(0, 28, "869.85 Mhz, BW=125 kHz,");
-    display.drawString(0, 38, "SF=10, CR=4/5, SW=0x14");
+  PmuSnapshot battery = pmu_sampler.snapshot();
+  if (battery.batteryConnected) {
+    ui.set(ui_battery, label_text.format(battery.charging ? "Crg " : "Bat ",
+                                         battery.batteryPercent, "%"));
   } else {
-    display.setTextAlignment(TEXT_ALIGN_CENTER);
-    display.setFont(ArialMT_Plain_16);
-    display.drawString(60, 30, "-- O F F --");
-    display.setTextAlignment(TEXT_ALIGN_LEFT);
-    display.setFont(ArialMT_Plain_10);
+    ui.set(ui_battery, "");
   }
+
+  // an empty text hides a label
+  ui.set(ui_next[0], transmit_loop ? "Next: contact C3 @" : "");
+  ui.set(ui_next[1], transmit_loop ? "869.85 Mhz, BW=125 kHz," : "");
+  ui.set(ui_next[2], transmit_loop ? "SF=10, CR=4/5, SW=0x14" : "");
+  ui.set(ui_off, transmit_loop ? "" : "-- O F F --");
   // LORA DISPLAY
-  RadioLibTime_t waitTime = LORA_DUTY_CYCLE_INTERVAL;
-  if (lora_transmission_end_time == 0) {
-    waitTime = 0;
-  } else {
-    waitTime =
-        (lora_transmission_end_time + LORA_DUTY_CYCLE_INTERVAL) - millis();
-  }
+  RadioLibTime_t waitTime = lora.dutyCycleWait();
 
   if (transmit_loop) {
-    if (lora_transmit_available()) {
-      display.drawString(0, 50, "LORA TX");
+    if (lora.transmitAvailable()) {
+      ui.set(ui_status, "LORA TX");
       // send lora msg
-      lora_send_packet(messages[messageCounter % MESSAGE_ROTATION_NUM],
-                       broadcastAddress);
+      // v1 frame, with the '\0' termination
+      const HudText<MESSAGE_SIZE>& msg =
+          messages[messageCounter % MESSAGE_ROTATION_NUM];
+      lora.sendPacket((const byte*)msg.c_str(), msg.length() + 1,
+                      broadcastAddress);
       // increase counter
       messageCounter = (messageCounter + 1) % MESSAGE_ROTATION_NUM;
     } else {
-      display.drawString(0, 50, "LORA DC " + String(waitTime / 1000) + "s");
+      ui.set(ui_status, label_text.format("LORA DC ", waitTime / 1000, "s"));
     }
   } else {
-    lora_dutyCycle_available();  // required for reset
-    display.drawString(0, 50, "OFF " + String(waitTime / 1000) + "s");
+    lora.dutyCycleAvailable();  // required for reset
+    ui.set(ui_status, label_text.format("OFF ", waitTime / 1000, "s"));
   }
 
   // GPS DISPLAY
-  if (gps.location.isUpdated()) {
-    display.setTextAlignment(TEXT_ALIGN_RIGHT);
-    display.drawString(120, 50, "GPS [" + String(gps.satellites.value()) + "]");
+  GpsFix fix = gps_feed.fix();
+  if (fix.updates != shown_fix) {
+    shown_fix = fix.updates;
+    ui.set(ui_gps, label_text.format("GPS [", fix.satellites, "]"));
 
     // serial
     Serial.print("Latitude  : ");
-    Serial.println(gps.location.lat(), 5);
+    Serial.println(fix.lat, 5);
     Serial.print("Longitude : ");
-    Serial.println(gps.location.lng(), 4);
+    Serial.println(fix.lng, 4);
     Serial.print("Satellites: ");
-    Serial.println(gps.satellites.value());
+    Serial.println(fix.satellites);
     Serial.print("Altitude  : ");
-    Serial.print(gps.altitude.feet() / 3.2808);
+    Serial.print(fix.altitude);
     Serial.println("M");
     Serial.print("Time      : ");
-    Serial.print(gps.time.hour());
+    Serial.print(fix.hour);
     Serial.print(":");
-    Serial.print(gps.time.minute());
+    Serial.print(fix.minute);
     Serial.print(":");
-    Serial.println(gps.time.second());
+    Serial.println(fix.second);
     Serial.println("**********************");
-  } else {
-    display.setTextAlignment(TEXT_ALIGN_RIGHT);
-    display.drawString(120, 50, "NO GPS");
-  }
-
-  // end, display buffer
-  display.display();
-  delay(10);
-}
-
-bool lora_transmit_available() {
-  if (lora_tx_available && lora_dutyCycle_available())
-    return true;
-  else {
-    return false;
-  }
-}
-
-bool lora_dutyCycle_available() {
-  if (lora_transmission_end_time + LORA_DUTY_CYCLE_INTERVAL < millis()) {
-    lora_transmission_end_time = 0;
-    return true;
-  } else {
-    return false;
-  }
-}
-
-bool lora_send_packet(String payload, byte recipientAddress) {
-  // String to byte array
-  // cf.
-  // https://arduino.stackexchange.com/questions/21846/how-to-convert-string-to-byte-array
-
-  /*
-   * DO NOT USE sizeof(payload), as it will possibly return not the right length
-   * of the String! +1 because of '\0' termination of string
-   */
-  int payloadSize = payload.length() + 1;
-  byte bytePayload[payloadSize];
-  payload.getBytes(bytePayload, sizeof(bytePayload));
-
-  // Comment on size of payload cf. https://stackoverflow.com/a/37539
-  return lora_send_packet(bytePayload, sizeof(bytePayload) / sizeof(byte),
-                          recipientAddress);
-}
-
-bool lora_send_packet(byte payload[], size_t size, byte recipientAddress) {
-  // check if the previous transmission finished
-  if (!lora_transmit_available()) {
-    Serial.println(F("Last transmission not finished"));
-    return false;
-  }
-
-  if (size >= 254) {
-    Serial.println(F("Payload exceeds 254 Bytes"));
-    return false;
+  } else if (!fix.valid || fix.age() > GPS_FIX_TIMEOUT) {
+    ui.set(ui_gps, "NO GPS");
   }
 
-  /**
-   * cf.
-   * https://stackoverflow.com/questions/71316261/arduino-how-to-concatenate-byte-arrays-to-get-a-final-array
-   */
-  // concatenate header + payload
-  byte header[] = {broadcastAddress, localAddress};
-  byte message[sizeof(header) + size];
-
-  memcpy(message, header, sizeof(header));
-  memcpy(message + sizeof(header), payload, size);
-
-  // reset flag
-  lora_tx_available = false;
-
-  // transmit
-  Serial.println("Transmit duration estimated: [" + String(sizeof(message)) +
-                 "Byte] " + String(radio.getTimeOnAir(sizeof(message)) / 1000) +
-                 "ms");
-  transmissionState = radio.startTransmit(message, sizeof(message));
-  return true;
+  // draw the changed labels, at most OLED_UI_MAX_FPS times a second
+  ui.render();
+  // sleep until the next radio event, at most 10ms
+  lora.waitEvent(10);
 }
 
 void click_callback(Button2& b) {
   transmit_loop = !transmit_loop;
-  Serial.println("Triggering LoRa transmit loop to " + String(transmit_loop));
+  Serial.println(
+      log_text.format("Triggering LoRa transmit loop to ", transmit_loop));
 }
\ No newline at end of file
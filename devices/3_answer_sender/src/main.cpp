@@ -16,12 +16,13 @@
  *
  */
 #define HELTEC_NO_RADIOLIB
-#include <RadioLib.h>
+#include <HudText.h>
+#include <LoRaLink.h>
+#include <OledUi.h>
 #include <SPI.h>
+#include <codebook.h>
 #include <heltec_unofficial.h>
 
-#include <map>
-
 #define CONFIG_RADIO_FREQ 869.85     // MHz
 #define CONFIG_RADIO_OUTPUT_POWER 5  // 17 std, 2-20
 #define CONFIG_RADIO_BW 125.0        // kHz
@@ -29,258 +30,168 @@
 #define CONFIG_RADIO_CR 5
 #define CONFIG_RADIO_SYNC 0x14  // 0x14
 
-#define LORA_DUTY_CYCLE_INTERVAL 1000  // s
-
-// save transmission state between loops
-static int lora_tx_state = RADIOLIB_ERR_NONE;
-static int lora_rx_state = RADIOLIB_ERR_NONE;
-
-// flag to indicate that a packet was received
-static volatile bool lora_tx_available = false;
-
-/*
- * 0 -> receive mode
- * 1 -> message available
- * 2 -> transmitting
- * 3 -> transmission complete
- */
-static volatile uint8_t lora_state = 0;
-
-byte broadcastAddress = 0xFF;
-byte localAddress = 0xC3;
-byte receiverAddress = 0x00;
-RadioLibTime_t answer_backoff = 0;
-RadioLibTime_t lora_transmission_end_time = 0;
-
-SX1262 radio = new Module(SS, DIO1, RST_LoRa, BUSY_LoRa);
-
-std::map<byte, String> groupkeys{
-    {0x11, "zbgj5F"}, {0x22, "A7Fwx4"}, {0x33, "GiZ58h"}, {0x44, "Qqk8Uq"},
-    {0x55, "rx9rGN"}, {0x66, "Loe7hJ"}, {0x88, "9VT6qw"}, {0x99, "tsa5PB"},
-    {0xaa, "Dj8wWQ"}, {0xbb, "5Ad6d5"}, {0xcc, "o8bZPE"}, {0xdd, "ST2qps"},
-    {0xee, "oP6URu"}, {0xf0, "7wHYvR"},
+const LoRaConfig lora_config = {
+    CONFIG_RADIO_FREQ, CONFIG_RADIO_BW,           CONFIG_RADIO_SF,
+    CONFIG_RADIO_CR,   CONFIG_RADIO_SYNC,         CONFIG_RADIO_OUTPUT_POWER,
+    false,             0,  // airtime budget only
 };
 
-//
-//
-//
-bool lora_transmit_available();
-bool lora_dutyCycle_available();
-bool lora_send_packet(String payload, byte recipientAddress);
-bool lora_send_packet(byte payload[], size_t size, byte recipientAddress);
-
-// called when a complete packet is received by the module
-// IMPORTANT: this function MUST be 'void' type and MUST NOT have any arguments!
-ICACHE_RAM_ATTR void callback_lora_action(void) {
-  if (lora_state == 0) {
-    // we got a packet, set the flag
-    Serial.println("CB - Reception complete");
-    lora_state = 1;
-  } else if (lora_state == 1) {
-    // we got a packet, set the flag
-    Serial.println("Error, should not happen?");
-    while (true);
-  } else if (lora_state == 2) {
-    // we sent a packet, set the flag
-    Serial.println("CB - Transmission complete");
-    lora_tx_available = true;
-
-    lora_transmission_end_time = millis();
-
-    if (lora_tx_state == RADIOLIB_ERR_NONE) {
-      // packet was successfully sent
-      Serial.println(F("transmission finished!"));
-    } else {
-      Serial.print(F("failed, code "));
-      Serial.println(lora_tx_state);
-    }
-
-    lora_state = 3;
-  } else if (lora_state == 3) {
-    // callback while transmission complete?
-    Serial.println("Error, should not happen?");
-    while (true);
-  }
-}
+// delay before answering a request
+#define ANSWER_BACKOFF 1000  // ms
+// tries to queue an answer before it is dropped
+#define ANSWER_MAX_TRIES 3
+// ms between the answer statistics on Serial
+#define ANSWER_STATS_INTERVAL 60000
 
-void setup() {
-  heltec_setup();
-  while (!Serial);
+byte broadcastAddress = 0xFF;
 
-  Serial.println("Challenge 3 Sender");
+LoRaLink<SX1262, LoRaPins<SS, DIO1, RST_LoRa, BUSY_LoRa>> lora(0xC3);
 
-  // initialize SX1262 with default settings
-  Serial.print(F("[SX1262] Initializing ... "));
+// drops repeated v2 requests
+LoRaSeqWindow seen_frames;
 
-  int state = radio.begin();
+// RSSI/SNR of every sender
+LoRaSenderTable sender_stats;
 
-  Serial.println(state);
-  if (state == RADIOLIB_ERR_NONE) {
-    Serial.println(F("success!"));
-  } else {
-    Serial.print(F("failed, code "));
-    Serial.println(state);
-    while (true);
-  }
+// display labels, redrawn only when their text changes
+OledUi ui(display);
+uint8_t ui_title = ui.label(60, 0, ArialMT_Plain_16, TEXT_ALIGN_CENTER);
+uint8_t ui_status = ui.label(0, 50, ArialMT_Plain_10, TEXT_ALIGN_LEFT);
 
-  /*
-   *   Sets carrier frequency.
-   *   SX1278/SX1276 : Allowed values range from 137.0 MHz to 525.0 MHz.
-   *   SX1268/SX1262 : Allowed values are in range from 150.0 to 960.0 MHz.
-   * * * */
-  if (radio.setFrequency(CONFIG_RADIO_FREQ) == RADIOLIB_ERR_INVALID_FREQUENCY) {
-    Serial.println(F("Selected frequency is invalid for this module!"));
-    while (true);
-  }
+// label and log line texts, formatted without heap allocations
+HudText<OLED_UI_TEXT_SIZE> label_text;
+HudText<160> log_text;
 
-  /*
-   *   Sets LoRa link bandwidth.
-   *   SX1278/SX1276 : Allowed values are 10.4, 15.6, 20.8, 31.25, 41.7, 62.5,
-   * 125, 250 and 500 kHz. Only available in %LoRa mode. SX1268/SX1262 : Allowed
-   * values are 7.8, 10.4, 15.6, 20.8, 31.25, 41.7, 62.5, 125.0, 250.0 and 500.0
-   * kHz.
-   * * * */
-  if (radio.setBandwidth(CONFIG_RADIO_BW) == RADIOLIB_ERR_INVALID_BANDWIDTH) {
-    Serial.println(F("Selected bandwidth is invalid for this module!"));
-    while (true);
-  }
+/*
+ * Pending answers, one entry per requesting device. Requests are answered in
+ * the order of their arrival, a device asking again before its answer is sent
+ * keeps its place in the queue.
+ */
+struct PendingAnswer {
+  bool pending;
+  uint8_t version;     // answer in the frame format of the request
+  uint8_t tries;       // failed attempts to queue the answer
+  RadioLibTime_t due;  // ms, end of the answer backoff
+};
+PendingAnswer pending_answers[256] = {};
 
-  /*
-   * Sets LoRa link spreading factor.
-   * SX1278/SX1276 :  Allowed values range from 6 to 12. Only available in LoRa
-   * mode. SX1262        :  Allowed values range from 5 to 12.
-   * * * */
-  if (radio.setSpreadingFactor(CONFIG_RADIO_SF) ==
-      RADIOLIB_ERR_INVALID_SPREADING_FACTOR) {
-    Serial.println(F("Selected spreading factor is invalid for this module!"));
-    while (true);
-  }
+// requesting devices in order of their first request, each at most once
+byte answer_fifo[256];
+uint8_t answer_fifo_head = 0;
+uint16_t answer_fifo_count = 0;
 
-  /*
-   * Sets LoRa coding rate denominator.
-   * SX1278/SX1276/SX1268/SX1262 : Allowed values range from 5 to 8. Only
-   * available in LoRa mode.
-   * * * */
-  if (radio.setCodingRate(CONFIG_RADIO_CR) ==
-      RADIOLIB_ERR_INVALID_CODING_RATE) {
-    Serial.println(F("Selected coding rate is invalid for this module!"));
-    while (true);
-  }
+// encoded answers, the key sentence of each group is formatted only once
+#define ANSWER_KEY 0
+#define ANSWER_GET_LOST 1
+LoRaFrameCache<16, 128> answer_cache;
 
-  /*
-   * Sets LoRa sync word.
-   * SX1278/SX1276/SX1268/SX1262/SX1280 : Sets LoRa sync word. Only available in
-   * LoRa mode.
-   * * */
-  if (radio.setSyncWord(CONFIG_RADIO_SYNC) != RADIOLIB_ERR_NONE) {
-    Serial.println(F("Unable to set sync word!"));
-    while (true);
-  }
+uint32_t answers_served = 0;
+uint32_t answers_dropped = 0;
+uint32_t requests_merged = 0;
+uint32_t served_this_minute = 0;
+RadioLibTime_t minute_start = 0;
 
-  /*
-   * Sets transmission output power.
-   * SX1278/SX1276 :  Allowed values range from +2 to +17 dBm (PA_BOOST pin).
-   * High power +20 dBm operation is also supported. Defaults to PA_BOOST.
-   * SX1262        :  Allowed values are in range from -9 to 22 dBm. This method
-   * is virtual to allow override from the SX1261 class.
-   * * * */
-  if (radio.setOutputPower(CONFIG_RADIO_OUTPUT_POWER) ==
-      RADIOLIB_ERR_INVALID_OUTPUT_POWER) {
-    Serial.println(F("Selected output power is invalid for this module!"));
-    while (true);
-  }
+void schedule_answer(byte sender, uint8_t version);
+void send_next_answer();
+void answer_failed(byte receiverAddress);
+void print_answer_stats();
 
-  // Enables or disables CRC check of received packets.
-  if (radio.setCRC(false) == RADIOLIB_ERR_INVALID_CRC_CONFIGURATION) {
-    Serial.println(F("Selected CRC is invalid for this module!"));
-    while (true);
-  }
+void setup() {
+  heltec_setup();
+  while (!Serial);
 
-  // set the function that will be called
-  radio.setDio1Action(callback_lora_action);
+  Serial.println("Challenge 3 Sender");
 
-  // start listening for LoRa packets
-  Serial.print(F("[SX1262] Starting to listen ... "));
-  lora_rx_state = radio.startReceive();
-  if (lora_rx_state == RADIOLIB_ERR_NONE) {
-    Serial.println(F("success!"));
-  } else {
-    Serial.print(F("failed, code "));
-    Serial.println(lora_rx_state);
-    while (true);
-  }
-  lora_state = 0;
-  lora_tx_available = true;
+  lora.begin(lora_config);
+  // the participants send on this channel too, check it before each frame
+  lora.setListenBeforeTalk(true);
 
   // Initialising the UI will init the display too.
   display.init();
   display.setFont(ArialMT_Plain_10);
+  ui.set(ui_title, "CHALLENGE 3");
+  // draws in its own task from here on
+  ui.begin();
 }
 
 void loop() {
-  // clear the display
-  display.clear();
-  display.setFont(ArialMT_Plain_16);
-  display.setTextAlignment(TEXT_ALIGN_CENTER);
-  display.drawString(60, 0, "CHALLENGE 3");
-  display.setFont(ArialMT_Plain_10);
-  display.setTextAlignment(TEXT_ALIGN_LEFT);
-
-  // put back into receiving/listen mode
-  if (lora_state == 3) {
-    Serial.println("LoRa RCV mode");
-    lora_state = 0;
-    radio.startReceive();
+  // the link listens again on its own after the last queued frame
+  if (lora.txDone()) {
+    LoRaTxStats stats = lora.txStats();
+    Serial.println(log_text.format("TX queue: ", stats.sent, " sent, ",
+                                   stats.dropped, " dropped, max depth ",
+                                   stats.maxDepth, ", last gap ",
+                                   stats.lastGap, "us"));
+    LoRaRxStats rxStats = lora.rxStats();
+    Serial.println(log_text.format(
+        "RX filter: ", rxStats.rejected, " of ",
+        rxStats.rejected + rxStats.received, " frames rejected, saved ",
+        rxStats.spiBytesSaved, " SPI bytes, ", rxStats.cpuSaved, "us"));
+    Serial.println(log_text.format("RX ring: ", rxStats.overruns,
+                                   " overruns, max depth ", rxStats.maxDepth));
+    LoRaEventStats events = lora.eventStats();
+    Serial.println(log_text.format("IRQ events: ", events.events,
+                                   " handled, ", events.dropped, " dropped"));
+    Serial.print("ISR duration: ");
+    events.isrDuration.print(Serial);
+    Serial.print("ISR to handler: ");
+    events.latency.print(Serial);
+    LoRaBlindStats blind = lora.blindStats();
+    Serial.println(log_text.format(
+        "Radio blind: ", blind.thisHour, "ms this hour, ", blind.lastHour,
+        "ms last hour, ", blind.rxGaps, " RX gaps ", blind.rxTime, "ms, ",
+        blind.txGaps, " TX gaps ", blind.txTime, "ms, max gap ", blind.maxGap,
+        "us"));
+    LoRaLbtStats lbt = lora.lbtStats();
+    Serial.println(log_text.format(
+        "LBT: ", lbt.busy, " of ", lbt.checks, " checks busy, ", lbt.forced,
+        " forced, ", lbt.backoff, "ms backoff, ",
+        lbt.cadTime / (lbt.checks > 0 ? lbt.checks : 1), "us/check"));
   }
 
-  // check if RX flag 1 is set -> message available
-  if (lora_state == 1) {
-    // read received data as byte array
-    size_t length = radio.getPacketLength();
-    Serial.println("Received " + String(length) + " bytes");
-
-    byte payloadArray[length];
-    int lora_rx_state = radio.readData(payloadArray, length);
-
-    if (lora_rx_state == RADIOLIB_ERR_NONE) {
-      if (receiverAddress == 0x00) {
-        byte receiver = payloadArray[0];
-        byte sender = payloadArray[1];
-
-        byte messageArray[length - 2];
-        memcpy(messageArray, payloadArray + 2, length - 2);
-
-        String message = String((char *)messageArray);
-
-        Serial.println("Receiver: " + String(receiver, HEX));
-        Serial.println("Sender: " + String(sender, HEX));
-        Serial.println("Message string: " + String(message));
-
-        String rssi = String(radio.getRSSI()) + "dBm";
-        String snr = String(radio.getSNR()) + "dB";
-
-        // packet was successfully received
-        Serial.println(F("Radio Received packet!"));
-
-        // print RSSI (Received Signal Strength Indicator)
-        Serial.print(F("Radio RSSI:\t\t"));
-        Serial.println(rssi);
+  // take the next frame from the RX ring, the radio is already listening
+  // again and frames for other devices were dropped after their header
+  const LoRaRxFrame* received = lora.receive();
+  if (received != nullptr) {
+    size_t length = received->length;
+    Serial.println(log_text.format("Received ", length, " bytes"));
+
+    const byte* payloadArray = received->data;
+    int lora_rx_state = received->state;
+    LoRaFrame frame;
+
+    // link quality of the sender, dumped with 's' on the serial console
+    if (length >= LORA_HEADER_SIZE) {
+      sender_stats.record(payloadArray[1], received->rssi, received->snr,
+                          lora_rx_state);
+    }
 
-        // print SNR (Signal-to-Noise Ratio)
-        Serial.print(F("Radio SNR:\t\t"));
-        Serial.println(snr);
+    if (lora_rx_state == RADIOLIB_ERR_NONE &&
+        !lora_parse_frame(payloadArray, length, frame)) {
+      Serial.println(F("Frame too short --- Dropped Packet!"));
+    } else if (lora_rx_state == RADIOLIB_ERR_NONE && frame.version == 2 &&
+               !seen_frames.accept(frame.sender, frame.seq)) {
+      Serial.println(F("Duplicate frame --- Dropped Packet!"));
+      sender_stats.drop(frame.sender);
+    } else if (lora_rx_state == RADIOLIB_ERR_NONE) {
+      byte receiver = frame.recipient;
+      byte sender = frame.sender;
+
+      Serial.println(log_text.format("Receiver: ", hud_hex(receiver)));
+      Serial.println(log_text.format("Sender: ", hud_hex(sender)));
+      if (frame.version == 2) {
+        Serial.println(log_text.format("Frame v2, type ", frame.type,
+                                       ", seq ", frame.seq));
+      }
+      Serial.print("Message string: ");
+      Serial.write(frame.payload, frame.length);
+      Serial.println();
 
-        if (receiver != localAddress) {
-          Serial.println("Message not for me! --- Dropped Packet!");
-        } else {
-          Serial.println("Message is for me!");
-          Serial.println("Send key to " + String(sender, HEX));
-          // set next receiver to send the answer to
-          receiverAddress = sender;
-          answer_backoff = millis() + 1000;
-        }
+      if (receiver != lora.localAddress) {
+        Serial.println("Message not for me! --- Dropped Packet!");
       } else {
-        Serial.println(F("Dropped Packet!"));
+        Serial.println("Message is for me!");
+        schedule_answer(sender, frame.version);
       }
 
     } else if (lora_rx_state == RADIOLIB_ERR_CRC_MISMATCH) {
@@ -292,121 +203,173 @@ void loop() {
       Serial.println(lora_rx_state);
     }
 
-    // put module back to listen mode
-    lora_state = 0;
-    radio.startReceive();
+    // free the slot for the next reception
+    lora.release();
+  }
+
+  // 's' on the serial console dumps the link statistics of all senders and
+  // the frame cache with the heap
+  if (Serial.available() > 0 && Serial.read() == 's') {
+    sender_stats.print(Serial);
+    Serial.print("Answer cache: ");
+    answer_cache.cacheStats().print(Serial);
   }
 
-  // transmit available?
-  if (receiverAddress != 0x00 && answer_backoff < millis()) {
-    if (lora_transmit_available()) {
-      Serial.println("LoRa sending answer");
-      display.drawString(
-          0, 50, "LORA sending answer to 0x" + String(receiverAddress, HEX));
+  // send answers that waited for the duty cycle
+  lora.poll();
 
-      String message = "";
+  // hand the next answer to the link
+  send_next_answer();
 
-      if (groupkeys.find(receiverAddress) == groupkeys.end()) {
-        message = "get lost!";
-      } else {
-        String key = groupkeys.at(receiverAddress);
-        message = "868.3,125,8,5,0x12. Call 0x31 with your key '" + key +
-                  "'. But he's kind of a flipping character.";
-      }
+  if (millis() - minute_start >= ANSWER_STATS_INTERVAL) {
+    print_answer_stats();
+  }
 
-      // define answer message
-      if (lora_send_packet(message, receiverAddress)) {
-        // reset receiver
-        receiverAddress = 0x00;
-        answer_backoff = 0;
-      }
-    } else {
-      RadioLibTime_t waitTime =
-          (lora_transmission_end_time + LORA_DUTY_CYCLE_INTERVAL) - millis();
-      display.drawString(0, 50,
-                         "LORA DC " + String(waitTime / 1000) +
-                             "s, answering 0x" + String(receiverAddress, HEX));
-    }
+  if (answer_fifo_count > 0) {
+    RadioLibTime_t waitTime = lora.dutyCycleWait();
+    ui.set(ui_status, label_text.format(
+                          "LORA DC ", waitTime / 1000, "s, ",
+                          answer_fifo_count, " pending, next 0x",
+                          hud_hex(answer_fifo[answer_fifo_head])));
+  } else if (lora.queueDepth() > 0) {
+    RadioLibTime_t waitTime = lora.dutyCycleWait();
+    ui.set(ui_status, label_text.format("LORA DC ", waitTime / 1000, "s, ",
+                                        lora.queueDepth(), " queued"));
   } else {
-    lora_dutyCycle_available();  // required for reset
-    display.drawString(0, 50, "LoRa await request");
+    lora.dutyCycleAvailable();  // required for reset
+    ui.set(ui_status, "LoRa await request");
   }
 
-  // write the buffer to the display
-  display.display();
-  delay(10);
+  // draw the changed labels, at most OLED_UI_MAX_FPS times a second
+  ui.render();
+  // sleep until the next radio event, at most 10ms
+  lora.waitEvent(10);
 }
 
-//
-//
-//
-//
-bool lora_transmit_available() {
-  if (lora_tx_available && lora_dutyCycle_available())
-    return true;
-  else {
-    return false;
+/**
+ * Queues an answer to the sender. A repeated request while the answer is still
+ * pending is merged into the existing entry.
+ */
+void schedule_answer(byte sender, uint8_t version) {
+  PendingAnswer& entry = pending_answers[sender];
+  if (entry.pending) {
+    // answer in the format of the latest request
+    entry.version = version;
+    requests_merged++;
+    Serial.println(log_text.format("Answer to ", hud_hex(sender),
+                                   " already pending, ", answer_fifo_count,
+                                   " pending"));
+    return;
   }
+
+  entry.pending = true;
+  entry.version = version;
+  entry.tries = 0;
+  entry.due = millis() + ANSWER_BACKOFF;
+  answer_fifo[(uint8_t)(answer_fifo_head + answer_fifo_count)] = sender;
+  answer_fifo_count++;
+  Serial.println(log_text.format("Send key to ", hud_hex(sender), ", ",
+                                 answer_fifo_count, " pending"));
 }
 
-bool lora_dutyCycle_available() {
-  if (lora_transmission_end_time + LORA_DUTY_CYCLE_INTERVAL < millis()) {
-    lora_transmission_end_time = 0;
-    return true;
-  } else {
-    return false;
+/**
+ * Sends the oldest pending answer once its backoff is over. Only one answer
+ * waits in the link queue behind the frame on air, the others stay pending,
+ * so repeated requests are still merged until shortly before the answer.
+ */
+void send_next_answer() {
+  if (answer_fifo_count == 0 || lora.queueDepth() > 0) {
+    return;
+  }
+  byte receiverAddress = answer_fifo[answer_fifo_head];
+  PendingAnswer& entry = pending_answers[receiverAddress];
+  // all entries have the same backoff, the oldest one is due first
+  if (entry.due > millis()) {
+    return;
   }
-}
 
-bool lora_send_packet(String payload, byte recipientAddress) {
-  // String to byte array
-  // cf.
-  // https://arduino.stackexchange.com/questions/21846/how-to-convert-string-to-byte-array
-
-  /*
-   * DO NOT USE sizeof(payload), as it will possibly return not the right length
-   * of the String! +1 because of '\0' termination of string
-   */
-  int payloadSize = payload.length() + 1;
-  byte bytePayload[payloadSize];
-  payload.getBytes(bytePayload, sizeof(bytePayload));
-
-  // Comment on size of payload cf. https://stackoverflow.com/a/37539
-  return lora_send_packet(bytePayload, sizeof(bytePayload) / sizeof(byte),
-                          recipientAddress);
-}
+  Serial.println(
+      log_text.format("LoRa sending answer to 0x", hud_hex(receiverAddress)));
+
+  uint32_t start = micros();
+  const CodebookEntry* group = codebook_find(receiverAddress);
+  bool known = group != nullptr;
+  uint8_t id = known ? ANSWER_KEY : ANSWER_GET_LOST;
+  LoRaCachedFrame* cached =
+      answer_cache.find(receiverAddress, id, 0, entry.version);
+  bool hit = cached != nullptr;
+
+  if (!hit) {
+    // the answer is formatted only once per group, into the log buffer
+    const char* message = "get lost!";
+    if (known) {
+      message = log_text.format(
+          "868.3,125,8,5,0x12. Call 0x31 with your key '", group->key,
+          "'. But he's kind of a flipping character.");
+    }
 
-bool lora_send_packet(byte payload[], size_t size, byte recipientAddress) {
-  // check if the previous transmission finished
-  if (!lora_transmit_available()) {
-    Serial.println(F("Last transmission not finished"));
-    return false;
+    // define answer message, v1 frames include the '\0' termination
+    lora.setFrameVersion(entry.version);
+    cached = answer_cache.slotFor(receiverAddress, id, 0);
+    if (cached == nullptr ||
+        !lora.encodeFrame(*cached, (const byte*)message,
+                          strlen(message) + (entry.version == 2 ? 0 : 1),
+                          receiverAddress, LORA_MSG_ANSWER)) {
+      answer_failed(receiverAddress);
+      return;
+    }
   }
 
-  if (size >= 254) {
-    Serial.println(F("Payload exceeds 254 Bytes"));
-    return false;
+  if (!lora.sendCached(*cached)) {
+    answer_failed(receiverAddress);
+    return;
   }
+  answer_cache.record(hit, micros() - start);
 
-  /**
-   * cf.
-   * https://stackoverflow.com/questions/71316261/arduino-how-to-concatenate-byte-arrays-to-get-a-final-array
-   */
-  // concatenate header + payload
-  byte header[] = {recipientAddress, localAddress};
-  byte message[sizeof(header) + size];
-
-  memcpy(message, header, sizeof(header));
-  memcpy(message + sizeof(header), payload, size);
-
-  // set flag
-  lora_tx_available = false;
-  lora_state = 2;
-
-  // transmit
-  Serial.println("Transmit duration estimated: [" + String(sizeof(message)) +
-                 "Byte] " + String(radio.getTimeOnAir(sizeof(message)) / 1000) +
-                 "ms");
-  lora_tx_state = radio.startTransmit(message, sizeof(message));
-  return true;
-}
\ No newline at end of file
+  entry.pending = false;
+  answer_fifo_head++;
+  answer_fifo_count--;
+
+  answers_served++;
+  served_this_minute++;
+}
+
+/**
+ * Takes an answer that could not be queued off the head of the FIFO, so it
+ * does not hold up the other devices. It goes to the back with a new
+ * backoff, after ANSWER_MAX_TRIES it is dropped.
+ */
+void answer_failed(byte receiverAddress) {
+  PendingAnswer& entry = pending_answers[receiverAddress];
+  answer_fifo_head++;
+  if (++entry.tries < ANSWER_MAX_TRIES) {
+    entry.due = millis() + ANSWER_BACKOFF;
+    answer_fifo[(uint8_t)(answer_fifo_head + answer_fifo_count - 1)] =
+        receiverAddress;
+    Serial.println(log_text.format("Answer to 0x", hud_hex(receiverAddress),
+                                   " not queued, try ", entry.tries, " of ",
+                                   ANSWER_MAX_TRIES, ", moved to the back"));
+    return;
+  }
+  entry.pending = false;
+  answer_fifo_count--;
+  answers_dropped++;
+  Serial.println(log_text.format("Answer to 0x", hud_hex(receiverAddress),
+                                 " not queued, dropped after ",
+                                 ANSWER_MAX_TRIES, " tries"));
+}
+
+/**
+ * Prints the answers of the last ANSWER_STATS_INTERVAL and the frame cache,
+ * called from loop() on a timer, so the count covers the whole interval.
+ */
+void print_answer_stats() {
+  Serial.println(log_text.format("Answers: ", served_this_minute,
+                                 " in the last minute, ", answers_served,
+                                 " served, ", answers_dropped, " dropped, ",
+                                 requests_merged, " merged"));
+  Serial.print("Answer cache: ");
+  answer_cache.cacheStats().print(Serial);
+  served_this_minute = 0;
+  minute_start = millis();
+}
@@ -21,6 +21,8 @@
   #include "driver/temp_sensor.h"
 #endif
 
+#include <atomic>
+
 // 'PRG' Button
 #define BUTTON    GPIO_NUM_0
 // LED pin & PWM parameters
@@ -36,6 +38,17 @@
 
 #define DIO1      GPIO_NUM_14
 
+// Battery voltage and chip temperature are measured on each call. Define
+// HELTEC_SENSOR_SERVICE to sample them in the background instead, see
+// heltec_sensors_begin(). Off by default, so a sketch runs no task and no
+// continuous ADC it did not ask for.
+#ifndef HELTEC_SENSOR_PERIOD
+  #define HELTEC_SENSOR_PERIOD 10000  // ms
+#endif
+#define HELTEC_VBAT_SAMPLES 64        // ADC conversions averaged per sample
+#define HELTEC_VBAT_SAMPLE_FREQ 20000 // Hz
+#define HELTEC_VBAT_SETTLE 5          // ms, VBAT_CTRL low before sampling
+
 #ifdef HELTEC_WIRELESS_STICK_LITE
   #define HELTEC_NO_DISPLAY
 #endif
@@ -82,6 +95,28 @@ const uint8_t scaled_voltage[100] = {
   94, 90, 81, 80, 76, 73, 66, 52, 32, 7,
 };
 
+// Battery percentage by voltage in the same 1/256'th steps, filled from
+// scaled_voltage by heltec_battery_table_init().
+uint8_t battery_percent_table[256];
+bool battery_percent_table_ready = false;
+
+// Ranges of the temperature sensor, from the coldest. The sensor stays in a
+// range as long as the readings are inside it.
+const int temp_range_start[5] = { -40, -30, -10,  20,  50 };
+const int temp_range_end[5]   = {  20,  50,  80, 100, 125 };
+// If temperature for given n below this value,
+// then this is the best measurement we have.
+const int temp_cutoffs[5] = { -30, -10, 80, 100, 2500 };
+int temp_range = -1;
+#if ESP_ARDUINO_VERSION_MAJOR >= 3
+  temperature_sensor_handle_t temp_handle = NULL;
+#endif
+
+// Last filtered sample of the sensor service: battery mV in the low half,
+// temperature in 1/10 degrees celsius in the high half. 0 == no sample yet.
+std::atomic<uint32_t> heltec_sensor_sample{0};
+TaskHandle_t heltec_sensor_task = NULL;
+
 #ifndef HELTEC_NO_RADIO_INSTANCE
   #ifndef ARDUINO_heltec_wifi_32_lora_V3
     // Assume MISO and MOSI being wrong when not using Heltec's board definition
@@ -186,12 +221,16 @@ void heltec_ve(bool state) {
  * @brief Measures the battery voltage.
  *
  * This function measures the battery voltage by controlling the VBAT_CTRL pin
- * and reading the analog value from the VBAT_ADC pin. The measured voltage is
- * then converted to a float value and returned.
+ * and reading the analog value from the VBAT_ADC pin. With the sensor service
+ * (HELTEC_SENSOR_SERVICE), it returns the last filtered sample instead, so it
+ * never waits for the ADC.
  *
- * @return The battery voltage in volts.
+ * @return The battery voltage in volts, 0 before the first sample.
  */
 float heltec_vbat() {
+  if (heltec_sensor_task != NULL) {
+    return (heltec_sensor_sample.load() & 0xffff) / 1000.0;
+  }
   pinMode(VBAT_CTRL, OUTPUT);
   digitalWrite(VBAT_CTRL, LOW);
   delay(5);
@@ -252,14 +291,32 @@ void heltec_deep_sleep(int seconds = 0) {
   esp_deep_sleep_start();
 }
 
+/**
+ * @brief Fills the percentage lookup of heltec_battery_percent() from the
+ * scaled_voltage curve.
+ */
+void heltec_battery_table_init() {
+  for (int step = 0; step < 256; step++) {
+    uint8_t percent = 0;
+    for (int n = 0; n < sizeof(scaled_voltage); n++) {
+      if (step >= scaled_voltage[n]) {
+        percent = 100 - n;
+        break;
+      }
+    }
+    battery_percent_table[step] = percent;
+  }
+  battery_percent_table_ready = true;
+}
+
 /**
  * @brief Calculates the battery percentage based on the measured battery
  * voltage.
  *
  * This function calculates the battery percentage based on the measured battery
  * voltage. If the battery voltage is not provided as a parameter, it will be
- * measured using the heltec_vbat() function. The battery percentage is then
- * returned as an integer value.
+ * measured using the heltec_vbat() function. The voltage is scaled to the
+ * 1/256'th steps of scaled_voltage in integer math and looked up in a table.
  *
  * @param vbat The battery voltage in volts (default = -1).
  * @return The battery percentage (0-100).
@@ -268,13 +325,16 @@ int heltec_battery_percent(float vbat = -1) {
   if (vbat == -1) {
     vbat = heltec_vbat();
   }
-  for (int n = 0; n < sizeof(scaled_voltage); n++) {
-    float step = (max_voltage - min_voltage) / 256;
-    if (vbat > min_voltage + (step * scaled_voltage[n])) {
-      return 100 - n;
-    }
+  if (!battery_percent_table_ready) {
+    heltec_battery_table_init();
+  }
+  const int32_t min_mv = min_voltage * 1000 + 0.5;
+  const int32_t max_mv = max_voltage * 1000 + 0.5;
+  int32_t step = ((int32_t)(vbat * 1000) - min_mv) * 256 / (max_mv - min_mv);
+  if (step < 0) {
+    return 0;
   }
-  return 0;
+  return battery_percent_table[step > 255 ? 255 : step];
 }
 
 /**
@@ -298,36 +358,21 @@ bool heltec_wakeup_was_timer() {
 }
 
 /**
- * @brief Measures esp32 chip temperature
- * 
- * @return float with temperature in degrees celsius.
-*/
-float heltec_temperature() {
-  float result = 0;
-
-  // If temperature for given n below this value,
-  // then this is the best measurement we have.
-  int cutoffs[5] = { -30, -10, 80, 100, 2500 };
-  
+ * @brief Switches the temperature sensor to range n, if it is not already.
+ */
+void heltec_temperature_range(int n) {
+  if (n == temp_range) {
+    return;
+  }
   #if ESP_ARDUINO_VERSION_MAJOR >= 3
-
-    int range_start[] = { -40, -30, -10,  20,  50 };
-    int range_end[]   = {  20,  50,  80, 100, 125 };
-    temperature_sensor_handle_t temp_handle = NULL;
-    for (int n = 0; n < 5; n++) {
-      temperature_sensor_config_t temp_sensor_config = TEMPERATURE_SENSOR_CONFIG_DEFAULT(range_start[n], range_end[n]);
-      ESP_ERROR_CHECK(temperature_sensor_install(&temp_sensor_config, &temp_handle));
-      ESP_ERROR_CHECK(temperature_sensor_enable(temp_handle));
-      ESP_ERROR_CHECK(temperature_sensor_get_celsius(temp_handle, &result));
+    if (temp_handle != NULL) {
       ESP_ERROR_CHECK(temperature_sensor_disable(temp_handle));
       ESP_ERROR_CHECK(temperature_sensor_uninstall(temp_handle));
-      if (result <= cutoffs[n]) break;
     }
-
+    temperature_sensor_config_t temp_sensor_config = TEMPERATURE_SENSOR_CONFIG_DEFAULT(temp_range_start[n], temp_range_end[n]);
+    ESP_ERROR_CHECK(temperature_sensor_install(&temp_sensor_config, &temp_handle));
+    ESP_ERROR_CHECK(temperature_sensor_enable(temp_handle));
   #else
-
-    // We start with the coldest range, because those temps get spoiled 
-    // the quickest by heat of processor waking up. 
     temp_sensor_dac_offset_t offsets[5] = {
       TSENS_DAC_L4,   // (-40°C ~  20°C, err <3°C)
       TSENS_DAC_L3,   // (-30°C ~  50°C, err <2°C)
@@ -335,21 +380,136 @@ float heltec_temperature() {
       TSENS_DAC_L1,   // ( 20°C ~ 100°C, err <2°C)
       TSENS_DAC_L0    // ( 50°C ~ 125°C, err <3°C)
     };
-    for (int n = 0; n < 5; n++) {
-      temp_sensor_config_t temp_sensor = TSENS_CONFIG_DEFAULT();
-      temp_sensor.dac_offset = offsets[n];
-      temp_sensor_set_config(temp_sensor);
-      temp_sensor_start();
-      temp_sensor_read_celsius(&result);
+    if (temp_range >= 0) {
       temp_sensor_stop();
-      if (result <= cutoffs[n]) break;
     }
-
+    temp_sensor_config_t temp_sensor = TSENS_CONFIG_DEFAULT();
+    temp_sensor.dac_offset = offsets[n];
+    temp_sensor_set_config(temp_sensor);
+    temp_sensor_start();
   #endif
+  temp_range = n;
+}
 
+/**
+ * @brief Reads the chip temperature. The sensor stays enabled and is only
+ * reconfigured when a reading leaves its current range.
+ *
+ * @return float with temperature in degrees celsius.
+ */
+float heltec_temperature_read() {
+  float result = 0;
+  // start in the most accurate range (-10°C ~ 80°C)
+  heltec_temperature_range(temp_range < 0 ? 2 : temp_range);
+  for (int tries = 0; tries < 5; tries++) {
+    #if ESP_ARDUINO_VERSION_MAJOR >= 3
+      ESP_ERROR_CHECK(temperature_sensor_get_celsius(temp_handle, &result));
+    #else
+      temp_sensor_read_celsius(&result);
+    #endif
+    if (result >= temp_range_start[temp_range] &&
+        result <= temp_range_end[temp_range]) {
+      break;
+    }
+    int best = 0;
+    while (best < 4 && result > temp_cutoffs[best]) best++;
+    heltec_temperature_range(best);
+  }
   return result;
 }
 
+/**
+ * @brief Measures esp32 chip temperature
+ *
+ * Returns the last filtered sample of the sensor service, if it runs.
+ *
+ * @return float with temperature in degrees celsius.
+*/
+float heltec_temperature() {
+  if (heltec_sensor_task != NULL) {
+    return (int16_t)(heltec_sensor_sample.load() >> 16) / 10.0;
+  }
+  return heltec_temperature_read();
+}
+
+#if ESP_ARDUINO_VERSION_MAJOR >= 3
+  void ARDUINO_ISR_ATTR heltec_adc_done() {
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(heltec_sensor_task, &woken);
+    portYIELD_FROM_ISR(woken);
+  }
+#endif
+
+/**
+ * @brief Samples the battery voltage, averaged over HELTEC_VBAT_SAMPLES ADC
+ * conversions. Core 3.x runs them in ADC continuous (DMA) mode.
+ *
+ * @return The battery voltage in mV.
+ */
+uint16_t heltec_vbat_sample() {
+  pinMode(VBAT_CTRL, OUTPUT);
+  digitalWrite(VBAT_CTRL, LOW);
+  vTaskDelay(pdMS_TO_TICKS(HELTEC_VBAT_SETTLE));
+  uint32_t raw = 0;
+  #if ESP_ARDUINO_VERSION_MAJOR >= 3
+    adc_continuous_data_t* result = NULL;
+    ulTaskNotifyTake(pdTRUE, 0);
+    analogContinuousStart();
+    // one frame of HELTEC_VBAT_SAMPLES conversions
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(100));
+    if (analogContinuousRead(&result, 0)) {
+      raw = result[0].avg_read_raw;
+    }
+    analogContinuousStop();
+  #else
+    for (int n = 0; n < HELTEC_VBAT_SAMPLES; n++) {
+      raw += analogRead(VBAT_ADC);
+    }
+    raw /= HELTEC_VBAT_SAMPLES;
+  #endif
+  // pulled up, no need to drive it
+  pinMode(VBAT_CTRL, INPUT);
+  // same scale as heltec_vbat(): raw / 238.7 V
+  return raw * 10000 / 2387;
+}
+
+void heltec_sensor_loop(void* param) {
+  while (true) {
+    int32_t mv = heltec_vbat_sample();
+    int32_t decidegrees = heltec_temperature_read() * 10;
+    // first order low pass, 1/4 of each new sample
+    uint32_t last = heltec_sensor_sample.load();
+    if (last != 0) {
+      int32_t last_mv = last & 0xffff;
+      int32_t last_decidegrees = (int16_t)(last >> 16);
+      mv = last_mv + (mv - last_mv) / 4;
+      decidegrees = last_decidegrees + (decidegrees - last_decidegrees) / 4;
+    }
+    heltec_sensor_sample = (uint32_t)(mv & 0xffff) |
+                           ((uint32_t)(uint16_t)decidegrees << 16);
+    vTaskDelay(pdMS_TO_TICKS(HELTEC_SENSOR_PERIOD));
+  }
+}
+
+/**
+ * @brief Starts sampling battery voltage and chip temperature every
+ * HELTEC_SENSOR_PERIOD in a task on the other core. Called by heltec_setup()
+ * if HELTEC_SENSOR_SERVICE is defined.
+ */
+void heltec_sensors_begin() {
+  if (heltec_sensor_task != NULL) {
+    return;
+  }
+  heltec_battery_table_init();
+  #if ESP_ARDUINO_VERSION_MAJOR >= 3
+    uint8_t pins[] = { VBAT_ADC };
+    analogContinuous(pins, 1, HELTEC_VBAT_SAMPLES, HELTEC_VBAT_SAMPLE_FREQ,
+                     heltec_adc_done);
+  #endif
+  xTaskCreatePinnedToCore(heltec_sensor_loop, "heltec_sensors", 3072, NULL, 1,
+                          &heltec_sensor_task, 1 - xPortGetCoreID());
+}
+
 void heltec_display_power(bool on) {
   #ifndef HELTEC_NO_DISPLAY_INSTANCE
     if (on) {
@@ -391,6 +551,9 @@ void heltec_setup() {
     display.setContrast(255);
     display.flipScreenVertically();
   #endif
+  #ifdef HELTEC_SENSOR_SERVICE
+    heltec_sensors_begin();
+  #endif
 }
 
 #endif
\ No newline at end of file
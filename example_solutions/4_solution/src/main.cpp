@@ -15,11 +15,12 @@
  *
  */
 #define HELTEC_NO_RADIOLIB
-#include <RadioLib.h>
+#include <LoRaLink.h>
+#include <OledUi.h>
 #include <SPI.h>
+#include <codebook.h>
 #include <heltec_unofficial.h>
 
-#include <map>
 #include <vector>
 
 #include "Button2.h"
@@ -32,38 +33,25 @@ Button2 prgBtn;
 #define CONFIG_RADIO_CR 5
 #define CONFIG_RADIO_SYNC 0x12
 
-#define LORA_DUTY_CYCLE_INTERVAL 1000  // s
-
-// save transmission state between loops
-static int lora_tx_state = RADIOLIB_ERR_NONE;
-static int lora_rx_state = RADIOLIB_ERR_NONE;
-// flag to indicate that transmit is available
-static volatile bool lora_tx_available = false;
-
-/*
- * 0 -> receive mode
- * 1 -> message available
- * 2 -> transmitting
- * 3 -> transmission complete
- */
-static volatile uint8_t lora_state = 0;
+const LoRaConfig lora_config = {
+    CONFIG_RADIO_FREQ, CONFIG_RADIO_BW,           CONFIG_RADIO_SF,
+    CONFIG_RADIO_CR,   CONFIG_RADIO_SYNC,         CONFIG_RADIO_OUTPUT_POWER,
+    false,             0,  // airtime budget only
+};
 
 byte broadcastAddress = 0xFF;
-byte localAddress = 0x11;
 byte receiverAddress = 0x31;
 
+LoRaLink<SX1262, LoRaPins<SS, DIO1, RST_LoRa, BUSY_LoRa>> lora(0x11);
+
+// drops repeated v2 hops
+LoRaSeqWindow seen_frames;
+
 std::vector<char> first_code = std::vector<char>();
 std::vector<char> second_code = std::vector<char>();
 std::vector<char> third_code = std::vector<char>();
 
-std::map<byte, String> groupkeys{
-    {0x11, "zbgj5F"}, {0x22, "A7Fwx4"}, {0x33, "GiZ58h"}, {0x44, "Qqk8Uq"},
-    {0x55, "rx9rGN"}, {0x66, "Loe7hJ"}, {0x88, "9VT6qw"}, {0x99, "tsa5PB"},
-    {0xAA, "Dj8wWQ"}, {0xBB, "5Ad6d5"}, {0xCC, "o8bZPE"}, {0xDD, "ST2qps"},
-    {0xEE, "oP6URu"}, {0xFF, "7wHYvR"},
-};
-
-String myKey = groupkeys.at(localAddress);
+String myKey = codebook_find(lora.localAddress)->key;
 
 struct parameterset {
   parameterset(float freq, float bw, int sf)
@@ -81,53 +69,20 @@ parameterset next_parameterset = standard_ps;
 int message_reception_num = 0;
 
 bool transmit_request = false;
-RadioLibTime_t lora_transmission_end_time = 0;
 
-SX1262 radio = new Module(SS, DIO1, RST_LoRa, BUSY_LoRa);
+// display labels, redrawn only when their text changes
+OledUi ui(display);
+uint8_t ui_title = ui.label(0, 0, ArialMT_Plain_10, TEXT_ALIGN_LEFT);
+uint8_t ui_status = ui.label(0, 50, ArialMT_Plain_10, TEXT_ALIGN_LEFT);
 
 ///
 ///
-bool lora_transmit_available();
-bool lora_dutyCycle_available();
-bool lora_send_packet(String payload, byte recipientAddress);
-bool lora_send_packet(byte payload[], size_t size, byte recipientAddress);
 void lora_switch_parameters(parameterset ps);
 
 void click_callback(Button2& b);
 
-// called when a complete packet is received by the module
-// IMPORTANT: this function MUST be 'void' type and MUST NOT have any arguments!
-ICACHE_RAM_ATTR void callback_lora_action(void) {
-  if (lora_state == 0) {
-    // we got a packet, set the flag
-    Serial.println("CB - Reception complete");
-    lora_state = 1;
-  } else if (lora_state == 1) {
-    // we got a packet, set the flag
-    Serial.println("Error, should not happen?");
-    while (true);
-  } else if (lora_state == 2) {
-    // we sent a packet, set the flag
-    Serial.println("CB - Transmission complete");
-    lora_tx_available = true;
-
-    lora_transmission_end_time = millis();
-
-    if (lora_tx_state == RADIOLIB_ERR_NONE) {
-      // packet was successfully sent
-      Serial.println(F("transmission finished!"));
-    } else {
-      Serial.print(F("failed, code "));
-      Serial.println(lora_tx_state);
-    }
-
-    lora_state = 3;
-  } else if (lora_state == 3) {
-    // callback while transmission complete?
-    Serial.println("Error, should not happen?");
-    while (true);
-  }
-}
+// wakes loop() on button presses
+ICACHE_RAM_ATTR void button_interrupt() { lora.wakeFromISR(); }
 
 void setup() {
   heltec_setup();
@@ -135,159 +90,65 @@ void setup() {
 
   Serial.println("LoRa Sender");
 
-  // initialize SX1262 with default settings
-  Serial.print(F("[SX1262] Initializing ... "));
-
-  int state = radio.begin();
-
-  Serial.println(state);
-  if (state == RADIOLIB_ERR_NONE) {
-    Serial.println(F("success!"));
-  } else {
-    Serial.print(F("failed, code "));
-    Serial.println(state);
-    while (true);
-  }
-
-  /*
-   *   Sets carrier frequency.
-   *   SX1278/SX1276 : Allowed values range from 137.0 MHz to 525.0 MHz.
-   *   SX1268/SX1262 : Allowed values are in range from 150.0 to 960.0 MHz.
-   * * * */
-  if (radio.setFrequency(CONFIG_RADIO_FREQ) == RADIOLIB_ERR_INVALID_FREQUENCY) {
-    Serial.println(F("Selected frequency is invalid for this module!"));
-    while (true);
-  }
-
-  /*
-   *   Sets LoRa link bandwidth.
-   *   SX1278/SX1276 : Allowed values are 10.4, 15.6, 20.8, 31.25, 41.7, 62.5,
-   * 125, 250 and 500 kHz. Only available in %LoRa mode. SX1268/SX1262 : Allowed
-   * values are 7.8, 10.4, 15.6, 20.8, 31.25, 41.7, 62.5, 125.0, 250.0 and 500.0
-   * kHz.
-   * * * */
-  if (radio.setBandwidth(CONFIG_RADIO_BW) == RADIOLIB_ERR_INVALID_BANDWIDTH) {
-    Serial.println(F("Selected bandwidth is invalid for this module!"));
-    while (true);
-  }
-
-  /*
-   * Sets LoRa link spreading factor.
-   * SX1278/SX1276 :  Allowed values range from 6 to 12. Only available in LoRa
-   * mode. SX1262        :  Allowed values range from 5 to 12.
-   * * * */
-  if (radio.setSpreadingFactor(CONFIG_RADIO_SF) ==
-      RADIOLIB_ERR_INVALID_SPREADING_FACTOR) {
-    Serial.println(F("Selected spreading factor is invalid for this module!"));
-    while (true);
-  }
-
-  /*
-   * Sets LoRa coding rate denominator.
-   * SX1278/SX1276/SX1268/SX1262 : Allowed values range from 5 to 8. Only
-   * available in LoRa mode.
-   * * * */
-  if (radio.setCodingRate(CONFIG_RADIO_CR) ==
-      RADIOLIB_ERR_INVALID_CODING_RATE) {
-    Serial.println(F("Selected coding rate is invalid for this module!"));
-    while (true);
-  }
-
-  /*
-   * Sets LoRa sync word.
-   * SX1278/SX1276/SX1268/SX1262/SX1280 : Sets LoRa sync word. Only available in
-   * LoRa mode.
-   * * */
-  if (radio.setSyncWord(CONFIG_RADIO_SYNC) != RADIOLIB_ERR_NONE) {
-    Serial.println(F("Unable to set sync word!"));
-    while (true);
-  }
-
-  /*
-   * Sets transmission output power.
-   * SX1278/SX1276 :  Allowed values range from +2 to +17 dBm (PA_BOOST pin).
-   * High power +20 dBm operation is also supported. Defaults to PA_BOOST.
-   * SX1262        :  Allowed values are in range from -9 to 22 dBm. This method
-   * is virtual to allow override from the SX1261 class.
-   * * * */
-  if (radio.setOutputPower(CONFIG_RADIO_OUTPUT_POWER) ==
-      RADIOLIB_ERR_INVALID_OUTPUT_POWER) {
-    Serial.println(F("Selected output power is invalid for this module!"));
-    while (true);
-  }
-
-  // Enables or disables CRC check of received packets.
-  if (radio.setCRC(false) == RADIOLIB_ERR_INVALID_CRC_CONFIGURATION) {
-    Serial.println(F("Selected CRC is invalid for this module!"));
-    while (true);
-  }
-
-  // set the function that will be called
-  radio.setDio1Action(callback_lora_action);
-
-  // start listening for LoRa packets
-  Serial.print(F("[SX1262] Starting to listen ... "));
-  lora_rx_state = radio.startReceive();
-  if (lora_rx_state == RADIOLIB_ERR_NONE) {
-    Serial.println(F("success!"));
-  } else {
-    Serial.print(F("failed, code "));
-    Serial.println(lora_rx_state);
-    while (true);
-  }
-  lora_state = 0;
-  lora_tx_available = true;
+  lora.begin(lora_config);
+  // the level devices answer v2 requests with v2 frames
+  lora.setFrameVersion(2);
 
   prgBtn.begin(BUTTON);
   prgBtn.setTapHandler(click_callback);
+  attachInterrupt(BUTTON, button_interrupt, CHANGE);
 
   // Initialising the UI will init the display too.
   display.init();
   display.setFont(ArialMT_Plain_10);
+  ui.set(ui_title, "Challenge 3 - test");
+  // draws in its own task from here on
+  ui.begin();
 }
 
 void loop() {
   prgBtn.loop();
-  // clear the display
-  display.clear();
-  display.setFont(ArialMT_Plain_10);
-  display.setTextAlignment(TEXT_ALIGN_LEFT);
-  display.drawString(0, 0, "Challenge 3 - test");
 
-  // put back into receiving/listen mode
-  if (lora_state == 3) {
-    // switch to next lora setting
+  // the link listens again on its own after a transmission
+  if (lora.txDone()) {
     Serial.println("||| LoRa RCV mode");
-    lora_state = 0;
-    radio.startReceive();
   }
 
-  // check if RX flag is set -> message available
-  if (lora_state == 1) {
-    // read received data as byte array
-    size_t length = radio.getPacketLength();
+  // take the next frame from the RX ring, the radio is already listening
+  // again and frames for other devices were dropped after their header
+  const LoRaRxFrame* received = lora.receive();
+  if (received != nullptr) {
+    size_t length = received->length;
     Serial.println("-------");
     Serial.println("Received " + String(length) + " bytes");
 
-    byte payloadArray[length];
-    int lora_rx_state = radio.readData(payloadArray, length);
+    const byte* payloadArray = received->data;
+    int lora_rx_state = received->state;
+    LoRaFrame frame;
 
-    if (lora_rx_state == RADIOLIB_ERR_NONE) {
-      byte receiver = payloadArray[0];
-      byte sender = payloadArray[1];
+    if (lora_rx_state == RADIOLIB_ERR_NONE &&
+        !lora_parse_frame(payloadArray, length, frame)) {
+      Serial.println(F("Frame too short --- Dropped Packet!"));
+    } else if (lora_rx_state == RADIOLIB_ERR_NONE && frame.version == 2 &&
+               !seen_frames.accept(frame.sender, frame.seq)) {
+      Serial.println(F("Duplicate frame --- Dropped Packet!"));
+    } else if (lora_rx_state == RADIOLIB_ERR_NONE) {
+      byte receiver = frame.recipient;
+      byte sender = frame.sender;
 
-      byte messageArray[length - 2];
-      memcpy(messageArray, payloadArray + 2, length - 2);
-
-      String message = String((char*)messageArray);
+      String message = lora_frame_text(frame);
 
       Serial.println("Receiver: " + String(receiver, HEX));
       Serial.println("Sender: " + String(sender, HEX));
+      if (frame.version == 2) {
+        Serial.println("Frame v2, type " + String(frame.type) + ", seq " +
+                       String(frame.seq));
+      }
 
-      String rssi = String(radio.getRSSI()) + "dBm";
-      String snr = String(radio.getSNR()) + "dB";
+      String rssi = String(received->rssi) + "dBm";
+      String snr = String(received->snr) + "dB";
 
-      if (receiver != localAddress) {
+      if (receiver != lora.localAddress) {
         Serial.println("Message not for me!");
       } else {
         Serial.println("Message received --- Full string: " + String(message));
@@ -412,27 +273,24 @@ void loop() {
           int f_sf = sf.toInt();
 
           lora_switch_parameters(parameterset(f_freq, f_bw, f_sf));
+          lora.listen();
         } else {
           Serial.println("Returning to standard parameters");
           lora_switch_parameters(standard_ps);
+          lora.listen();
 
           message_reception_num = 0;
           first_code.clear();
           second_code.clear();
           third_code.clear();
 
-          // increase key to next address for testing
-          Serial.println(localAddress, HEX);
-          int rNibble = (localAddress & 0x0F);
-          int lNibble = (localAddress & 0xF0) >> 4;
-
-          int incR = rNibble + 1;
-          int incL = lNibble + 1;
-          incL = incL << 4;
-
-          localAddress = incL | incR;
-          Serial.println(localAddress, HEX);
-          myKey = groupkeys.at(localAddress);
+          // switch to the next group of the codebook for testing
+          Serial.println(lora.localAddress, HEX);
+          int next = (CODEBOOK_INDEX[lora.localAddress] + 1) %
+                     CODEBOOK_GROUP_COUNT;
+          lora.localAddress = CODEBOOK[next].deviceId;
+          Serial.println(lora.localAddress, HEX);
+          myKey = CODEBOOK[next].key;
         }
       }
     } else if (lora_rx_state == RADIOLIB_ERR_CRC_MISMATCH) {
@@ -444,131 +302,63 @@ void loop() {
       Serial.println(lora_rx_state);
     }
     Serial.println("-------");
-    // put module back to listen mode
-    lora_state = 0;
-    radio.startReceive();
+    // free the slot for the next reception
+    lora.release();
   }
 
   // transmit triggered?
   if (transmit_request) {
-    if (lora_transmit_available()) {
+    if (lora.transmitAvailable()) {
       Serial.println("LoRa sending request to 0x" +
                      String(receiverAddress, HEX));
-      display.drawString(
-          0, 50, "LORA sending REQ to 0x" + String(receiverAddress, HEX));
+      ui.set(ui_status,
+             "LORA sending REQ to 0x" + String(receiverAddress, HEX));
 
-      lora_send_packet(myKey, receiverAddress);
+      lora.sendPacket(myKey, receiverAddress, LORA_MSG_REQUEST);
       // put module back to listen mode
       transmit_request = false;
     } else {
-      RadioLibTime_t waitTime =
-          (lora_transmission_end_time + LORA_DUTY_CYCLE_INTERVAL) - millis();
-      display.drawString(0, 50, "LORA DC " + String(waitTime / 1000) + "s");
+      RadioLibTime_t waitTime = lora.dutyCycleWait();
+      ui.set(ui_status, "LORA DC " + String(waitTime / 1000) + "s");
     }
   } else {
-    lora_dutyCycle_available();  // required for reset
-    display.drawString(0, 50, "LoRa TX");
-  }
-
-  // write the buffer to the display
-  display.display();
-
-  delay(100);
-}
-
-//
-//
-//
-//
-bool lora_transmit_available() {
-  if (lora_tx_available && lora_dutyCycle_available())
-    return true;
-  else {
-    return false;
-  }
-}
-
-bool lora_dutyCycle_available() {
-  if (lora_transmission_end_time + LORA_DUTY_CYCLE_INTERVAL < millis()) {
-    lora_transmission_end_time = 0;
-    return true;
-  } else {
-    return false;
+    lora.dutyCycleAvailable();  // required for reset
+    ui.set(ui_status, "LoRa TX");
   }
-}
 
-bool lora_send_packet(String payload, byte recipientAddress) {
-  // String to byte array
-  // cf.
-  // https://arduino.stackexchange.com/questions/21846/how-to-convert-string-to-byte-array
-
-  /*
-   * DO NOT USE sizeof(payload), as it will possibly return not the right length
-   * of the String! +1 because of '\0' termination of string
-   */
-  int payloadSize = payload.length() + 1;
-  byte bytePayload[payloadSize];
-  payload.getBytes(bytePayload, sizeof(bytePayload));
-
-  // Comment on size of payload cf. https://stackoverflow.com/a/37539
-  return lora_send_packet(bytePayload, sizeof(bytePayload) / sizeof(byte),
-                          recipientAddress);
-}
+  // draw the changed labels, at most OLED_UI_MAX_FPS times a second
+  ui.render();
 
-bool lora_send_packet(byte payload[], size_t size, byte recipientAddress) {
-  // check if the previous transmission finished
-  if (!lora_transmit_available()) {
-    Serial.println(F("Last transmission not finished"));
-    return false;
-  }
-
-  if (size >= 254) {
-    Serial.println(F("Payload exceeds 254 Bytes"));
-    return false;
-  }
-
-  /**
-   * cf.
-   * https://stackoverflow.com/questions/71316261/arduino-how-to-concatenate-byte-arrays-to-get-a-final-array
-   */
-  // concatenate header + payload
-  byte header[] = {recipientAddress, localAddress};
-  byte message[sizeof(header) + size];
-
-  memcpy(message, header, sizeof(header));
-  memcpy(message + sizeof(header), payload, size);
-
-  // reset flag
-  lora_tx_available = false;
-  lora_state = 2;
-
-  // transmit
-  Serial.println("Transmit duration estimated: [" + String(sizeof(message)) +
-                 "Byte] " + String(radio.getTimeOnAir(sizeof(message)) / 1000) +
-                 "ms");
-  lora_tx_state = radio.startTransmit(message, sizeof(message));
-  return true;
+  // sleep until the next radio event, at most 100ms
+  lora.waitEvent(100);
 }
 
 void click_callback(Button2& b) {
-  if (transmit_request == false && lora_transmission_end_time == 0)
+  if (transmit_request == false && lora.transmissionEndTime() == 0)
     transmit_request = true;
 }
 
 void lora_switch_parameters(parameterset ps) {
-  if (radio.setFrequency(ps.frequency) == RADIOLIB_ERR_INVALID_FREQUENCY) {
+  // only the settings that differ from the current ones are written
+  int state = lora.retune(ps.frequency, ps.bandwidth, ps.spreadingfactor);
+  if (state == RADIOLIB_ERR_INVALID_FREQUENCY) {
     Serial.println(F("Selected frequency is invalid for this module!"));
     while (true);
   }
 
-  if (radio.setBandwidth(ps.bandwidth) == RADIOLIB_ERR_INVALID_BANDWIDTH) {
+  if (state == RADIOLIB_ERR_INVALID_BANDWIDTH) {
     Serial.println(F("Selected bandwidth is invalid for this module!"));
     while (true);
   }
 
-  if (radio.setSpreadingFactor(ps.spreadingfactor) ==
-      RADIOLIB_ERR_INVALID_SPREADING_FACTOR) {
+  if (state == RADIOLIB_ERR_INVALID_SPREADING_FACTOR) {
     Serial.println(F("Selected spreading factor is invalid for this module!"));
     while (true);
   }
+
+  LoRaRetuneStats stats = lora.retuneStats();
+  Serial.println("Retune " + String(stats.lastTime) + "us, " +
+                 String(stats.retunes) + " retunes, " +
+                 String(stats.unchanged) + " unchanged, avg " +
+                 String(stats.totalTime / stats.retunes) + "us");
 }
\ No newline at end of file
@@ -1,4 +1,5 @@
 import math
+import sys
 
 def generate_output():
     '''
@@ -31,48 +32,67 @@ def generate_output():
         ("7wHYvR", "Your passphrase: Cocktail Bar")
     ]
 
-    print("Copy this block for the plaintext mapping: (Level 4)")
-    print_plaintextmap(keymap)
-    print("")
-    print("Copy this block for the codetext mapping: (Level 4)")
-    print_codemap(encode(keymap))
-    print("")
-    print("Copy this block for the deviceID-groupkey mapping: (Level 3+4)")
-    print_groupkey_map(keymap, device_IDs)
+    if len(keymap) > len(device_IDs):
+        sys.exit("Error: deviceID list is shorter than the given group key list")
+
+    codes = encode(keymap)
+    verify(keymap, codes)
+
+    output = codebook_header(keymap, codes, device_IDs)
+
+    # --check: compare with the header in the repo instead of writing it (run by the native tests of
+    # lib/WorkshopCodebook)
+    if sys.argv[1:] == ["--check"]:
+        with open(CODEBOOK_HEADER) as header:
+            if header.read() != output:
+                sys.exit("Error: " + CODEBOOK_HEADER + " is not the output of this script, run it again")
+        print(CODEBOOK_HEADER + " matches the codebook of " + str(len(keymap)) + " groups")
+        return
+
+    path = sys.argv[1] if len(sys.argv) > 1 else CODEBOOK_HEADER
+    with open(path, "w") as header:
+        header.write(output)
+    print("Wrote the codebook of " + str(len(keymap)) + " groups to " + path + " (Level 3+4)")
 ###
 
+# shared by the level devices 3 and 4 and the example solutions
+CODEBOOK_HEADER = "lib/WorkshopCodebook/src/codebook.h"
+
+# the level 4 device sends every MESSAGE_ROTATION_NUM-th byte of the code per message
+MESSAGE_ROTATION_NUM = 3
+
 def encode(keymap):
     '''
-    Encode the passphrases from the given keymap with the respective keys by performing a simple bit-wise XOR operation.
-    Outputs the decrypted hex repesentation as a list of formatted strings to be used in the c++ code.
+    Encode the passphrases from the given keymap with the respective keys by performing a byte-wise XOR operation.
+    Returns the codes as bytes, leading zero bytes (e.g. 'Y' ^ 'Q') included.
     '''
 
-    encodemap = []
-
-    for i in  range(len(keymap)):
-        text = keymap[i][1]
-        key = padded_key(text, keymap[i][0])
-
-        a = int(text_to_bits(text), 2)
-        b = int(text_to_bits(key), 2)
-
-        xor = a ^ b
-        hexrep = hex(xor)
+    codes = []
+    for key, text in keymap:
+        padded = padded_key(text, key).encode('utf-8')
+        codes.append(bytes(a ^ b for a, b in zip(text.encode('utf-8'), padded)))
+    return codes
 
-        n = 2
-        s = [hexrep[i:i+n] for i in range(0, len(hexrep), n)]
-        s = s[1:]
-        all : str = "{"
 
-        for e in s:
-            all += ("0x" + e + ", ")
+def verify(keymap, codes):
+    '''
+    Decode the codes the way the participants (see example_solutions/4_solution) do: collect the
+    MESSAGE_ROTATION_NUM fragments as sent by the level 4 device, interleave them again and XOR with
+    the repeated key. Stops if any passphrase does not survive the round trip.
+    '''
 
-        all = all[:-2]
-        all += "}"
+    for (key, text), code in zip(keymap, codes):
+        fragments = [code[fwd::MESSAGE_ROTATION_NUM] for fwd in range(MESSAGE_ROTATION_NUM)]
+        interleaved = bytearray()
+        for i in range(len(fragments[0])):
+            for fragment in fragments:
+                if i < len(fragment):
+                    interleaved.append(fragment[i])
 
-        xor2 = xor ^ b
-        encodemap.append((keymap[i][0], all))
-    return encodemap
+        padded = padded_key(text, key).encode('utf-8')
+        decoded = bytes(a ^ b for a, b in zip(interleaved, padded)).decode('utf-8')
+        if decoded != text:
+            sys.exit("Error: decoding the code of " + key + " gives '" + decoded + "'")
 
 ##################
 ## conversions
@@ -103,35 +123,71 @@ def text_from_realbits(realbits, encoding='utf-8', errors='surrogatepass'):
 ## print functions
 ####################################
 
-def print_codemap(kvmap):
-    print("std::map<String, std::vector<unsigned char>> codetextmap {")
-    for i in range(len(kvmap)):
-        key = kvmap[i][0]
-        text = kvmap[i][1]        
-        print('  {\"' + key + '\", ' + text + '},')
-    print("};")
-
-
-def print_plaintextmap(kvmap):
-    print("std::map<String, String> plaintextmap {")
-    for i in range(len(kvmap)):
-        key = kvmap[i][0]
-        text = kvmap[i][1]        
-        print('  {\"' + key + '\", "' + text + '\"},')
-    print("};")
-
+def codebook_header(keymap, codes, deviceID_list):
+    '''
+    C++ header with the codebook as constexpr arrays, so the firmware keeps it in flash and looks up
+    the group of a device ID by direct indexing.
+    '''
 
-def print_groupkey_map(kvmap, deviceID_list):
-    if len(kvmap) > len(deviceID_list):
-        print("Error: deviceID list is shorter than the given group key list")
-        return
+    lines = [
+        "/**",
+        " * @file codebook.h",
+        " * @brief Device IDs, keys and passphrases of the workshop groups.",
+        " *",
+        " * Generated by generate-codephrases.py, do not edit.",
+        " */",
+        "#pragma once",
+        "",
+        "#include <stdint.h>",
+        "",
+        "#define CODEBOOK_GROUP_COUNT " + str(len(keymap)),
+        "",
+        "struct CodebookEntry {",
+        "  uint8_t deviceId;",
+        "  const char* key;",
+        "  const char* plaintext;",
+        "  const uint8_t* code;  // plaintext XOR repeated key",
+        "  uint8_t codeLength;",
+        "};",
+        "",
+    ]
 
-    print("std::map<byte, String> groupkeys{")
-    for i in range(len(kvmap)):
-        syncword = hex(deviceID_list[i])
-        key = kvmap[i][0]        
-        print('  {' + syncword + ', "' + key + '\"},')
-    print("};")
+    for i in range(len(keymap)):
+        lines.append("static constexpr uint8_t CODEBOOK_CODE_%d[] = {" % i)
+        for row in range(0, len(codes[i]), 12):
+            lines.append("    " + ", ".join("0x%02x" % b for b in codes[i][row:row + 12]) + ",")
+        lines.append("};")
+    lines.append("")
+
+    lines.append("static constexpr CodebookEntry CODEBOOK[CODEBOOK_GROUP_COUNT] = {")
+    for i in range(len(keymap)):
+        key, text = keymap[i]
+        lines.append('    {0x%02x, "%s", "%s", CODEBOOK_CODE_%d, %d},'
+                     % (deviceID_list[i], key, text, i, len(codes[i])))
+    lines.append("};")
+    lines.append("")
+
+    index = [0xFF] * 256
+    for i in range(len(keymap)):
+        index[deviceID_list[i]] = i
+    lines.append("// index into CODEBOOK by device ID, 0xff == no group")
+    lines.append("static constexpr uint8_t CODEBOOK_INDEX[256] = {")
+    for row in range(0, 256, 16):
+        lines.append("    " + ", ".join("0x%02x" % v for v in index[row:row + 16]) + ",")
+    lines.append("};")
+    lines.append("")
+
+    lines += [
+        "/**",
+        " * Returns the group of a device ID, or nullptr.",
+        " */",
+        "inline const CodebookEntry* codebook_find(uint8_t deviceId) {",
+        "  uint8_t index = CODEBOOK_INDEX[deviceId];",
+        "  return index == 0xff ? nullptr : &CODEBOOK[index];",
+        "}",
+        "",
+    ]
+    return "\n".join(lines)
 
 
 
@@ -0,0 +1,70 @@
+/**
+ * @file nmea_capture.h
+ * @brief NMEA output of the NEO-6M of a T-Beam, 1 fix per second at 9600
+ * baud, as read from SerialGPS.
+ *
+ * Three epochs without a fix (the first one before the receiver knows the
+ * time), then five with a fix while walking. The GGA sentence of 14:32:02
+ * has a wrong checksum, as after a lost byte on the UART.
+ */
+#pragma once
+
+// sentences before the first fix
+#define NMEA_CAPTURE_NO_FIX_SENTENCES 18
+// epochs with a fix, after those
+#define NMEA_CAPTURE_FIX_EPOCHS 5
+
+static const char NMEA_CAPTURE[] =
+    "$GPRMC,,V,,,,,,,,,,N*53\r\n"
+    "$GPVTG,,,,,,,,,N*30\r\n"
+    "$GPGGA,,,,,,0,00,99.99,,,,,,*48\r\n"
+    "$GPGSA,A,1,,,,,,,,,,,,,99.99,99.99,99.99*30\r\n"
+    "$GPGSV,1,1,01,17,,,27*7B\r\n"
+    "$GPGLL,,,,,,V,N*64\r\n"
+    "$GPRMC,143158.00,V,,,,,,,161026,,,N*75\r\n"
+    "$GPVTG,,,,,,,,,N*30\r\n"
+    "$GPGGA,143158.00,,,,,0,03,4.72,,,,,,*5E\r\n"
+    "$GPGSA,A,1,17,19,28,,,,,,,,,,4.83,4.72,1.00*0B\r\n"
+    "$GPGSV,1,1,03,17,61,287,31,19,42,081,28,28,23,152,25*43\r\n"
+    "$GPGLL,,,,,143158.00,V,N*40\r\n"
+    "$GPRMC,143159.00,V,,,,,,,161026,,,N*74\r\n"
+    "$GPVTG,,,,,,,,,N*30\r\n"
+    "$GPGGA,143159.00,,,,,0,03,4.72,,,,,,*5F\r\n"
+    "$GPGSA,A,1,17,19,28,,,,,,,,,,4.83,4.72,1.00*0B\r\n"
+    "$GPGSV,1,1,03,17,61,287,31,19,42,081,28,28,23,152,25*43\r\n"
+    "$GPGLL,,,,,143159.00,V,N*41\r\n"
+    "$GPRMC,143200.00,A,5231.03600,N,01324.09000,E,0.412,38.20,161026,,,A*5B\r\n"
+    "$GPVTG,38.20,T,,M,0.412,N,0.763,K,A*01\r\n"
+    "$GPGGA,143200.00,5231.03600,N,01324.09000,E,1,05,1.52,41.2,M,44.6,M,,*67\r\n"
+    "$GPGSA,A,3,17,19,28,06,,,,,,,,,2.61,1.52,2.12*02\r\n"
+    "$GPGSV,2,1,07,02,14,041,18,06,33,219,30,12,08,327,,17,61,287,33*78\r\n"
+    "$GPGSV,2,2,07,19,42,081,31,24,05,114,,28,23,152,27*44\r\n"
+    "$GPGLL,5231.03600,N,01324.09000,E,143200.00,A,A*60\r\n"
+    "$GPRMC,143201.00,A,5231.03612,N,01324.09021,E,0.412,38.20,161026,,,A*5A\r\n"
+    "$GPVTG,38.20,T,,M,0.412,N,0.763,K,A*01\r\n"
+    "$GPGGA,143201.00,5231.03612,N,01324.09021,E,1,05,1.52,41.0,M,44.6,M,,*64\r\n"
+    "$GPGSA,A,3,17,19,28,06,,,,,,,,,2.61,1.52,2.12*02\r\n"
+    "$GPGSV,2,1,07,02,14,041,18,06,33,219,30,12,08,327,,17,61,287,33*78\r\n"
+    "$GPGSV,2,2,07,19,42,081,31,24,05,114,,28,23,152,27*44\r\n"
+    "$GPGLL,5231.03612,N,01324.09021,E,143201.00,A,A*61\r\n"
+    "$GPRMC,143202.00,A,5231.03641,N,01324.09055,E,0.412,38.20,161026,,,A*5C\r\n"
+    "$GPVTG,38.20,T,,M,0.412,N,0.763,K,A*01\r\n"
+    "$GPGGA,143202.00,5231.03641,N,01324.09055,E,1,06,1.52,40.7,M,44.6,M,,*77\r\n"
+    "$GPGSA,A,3,17,19,28,06,,,,,,,,,2.61,1.52,2.12*02\r\n"
+    "$GPGSV,2,1,07,02,14,041,18,06,33,219,30,12,08,327,,17,61,287,33*78\r\n"
+    "$GPGSV,2,2,07,19,42,081,31,24,05,114,,28,23,152,27*44\r\n"
+    "$GPGLL,5231.03641,N,01324.09055,E,143202.00,A,A*67\r\n"
+    "$GPRMC,143203.00,A,5231.03675,N,01324.09080,E,0.412,38.20,161026,,,A*52\r\n"
+    "$GPVTG,38.20,T,,M,0.412,N,0.763,K,A*01\r\n"
+    "$GPGGA,143203.00,5231.03675,N,01324.09080,E,1,06,1.52,40.9,M,44.6,M,,*67\r\n"
+    "$GPGSA,A,3,17,19,28,06,,,,,,,,,2.61,1.52,2.12*02\r\n"
+    "$GPGSV,2,1,07,02,14,041,18,06,33,219,30,12,08,327,,17,61,287,33*78\r\n"
+    "$GPGSV,2,2,07,19,42,081,31,24,05,114,,28,23,152,27*44\r\n"
+    "$GPGLL,5231.03675,N,01324.09080,E,143203.00,A,A*69\r\n"
+    "$GPRMC,143204.00,A,5231.03702,N,01324.09113,E,0.412,38.20,161026,,,A*5F\r\n"
+    "$GPVTG,38.20,T,,M,0.412,N,0.763,K,A*01\r\n"
+    "$GPGGA,143204.00,5231.03702,N,01324.09113,E,1,07,1.52,41.3,M,44.6,M,,*60\r\n"
+    "$GPGSA,A,3,17,19,28,06,,,,,,,,,2.61,1.52,2.12*02\r\n"
+    "$GPGSV,2,1,07,02,14,041,18,06,33,219,30,12,08,327,,17,61,287,33*78\r\n"
+    "$GPGSV,2,2,07,19,42,081,31,24,05,114,,28,23,152,27*44\r\n"
+    "$GPGLL,5231.03702,N,01324.09113,E,143204.00,A,A*64\r\n";
@@ -0,0 +1,209 @@
+/**
+ * NMEA parsing of GpsFeed: a captured receiver stream replayed through
+ * feed() gives the fixes of the board, with one update per RMC or GGA
+ * sentence that carries a fix, whatever the chunk size of the UART reads.
+ *
+ * The task is not started, the tests call feed() directly as its drain
+ * loop does.
+ *
+ * test_bench reports the bytes and the parse time per fix epoch of the fix
+ * part of the capture, test_ubx does the same for the equivalent UBX
+ * stream.
+ */
+#include <Arduino.h>
+#include <GpsFeed.h>
+#include <unity.h>
+
+#include <chrono>
+
+#include "nmea_capture.h"
+
+// RMC and GGA of the five fix epochs, less the GGA with the bad checksum
+#define CAPTURE_UPDATES 9
+#define CAPTURE_SENTENCES 53
+
+// replays of the capture for the parse time
+#define BENCH_ROUNDS 10000
+
+static GpsFeed* feed;
+
+// feeds the capture in chunks of size bytes, size 0 == all at once
+static void replay(GpsFeed& target, size_t size) {
+  const uint8_t* data = (const uint8_t*)NMEA_CAPTURE;
+  size_t length = strlen(NMEA_CAPTURE);
+  if (size == 0) size = length;
+  for (size_t offset = 0; offset < length; offset += size) {
+    target.feed(data + offset, length - offset < size ? length - offset : size);
+  }
+}
+
+// start of the sentence after count sentences
+static const char* skipSentences(const char* from, uint16_t count) {
+  for (uint16_t i = 0; i < count; i++) from = strchr(from, '\n') + 1;
+  return from;
+}
+
+// feeds count sentences, starting at the first sentence
+static const char* feedSentences(const char* from, uint16_t count) {
+  for (uint16_t i = 0; i < count; i++) {
+    const char* end = strchr(from, '\n') + 1;
+    feed->feed((const uint8_t*)from, end - from);
+    from = end;
+  }
+  return from;
+}
+
+void setUp() {
+  fake_reset(1000000);
+  Serial.output.clear();
+  feed = new GpsFeed();
+}
+
+void tearDown() { delete feed; }
+
+void test_no_fix_before_lock() {
+  feedSentences(NMEA_CAPTURE, NMEA_CAPTURE_NO_FIX_SENTENCES);
+  GpsFix fix = feed->fix();
+  TEST_ASSERT_FALSE(fix.valid);
+  TEST_ASSERT_EQUAL(0, fix.updates);
+
+  GpsFeedStats stats = feed->feedStats();
+  TEST_ASSERT_EQUAL(NMEA_CAPTURE_NO_FIX_SENTENCES, stats.sentences);
+  TEST_ASSERT_EQUAL(0, stats.failed);
+  TEST_ASSERT_EQUAL(0, stats.fixes);
+}
+
+void test_replay_capture() {
+  replay(*feed, GPS_CHUNK_SIZE);
+
+  // the GGA of the last epoch
+  GpsFix fix = feed->fix();
+  TEST_ASSERT_TRUE(fix.valid);
+  TEST_ASSERT_EQUAL(CAPTURE_UPDATES, fix.updates);
+  TEST_ASSERT_DOUBLE_WITHIN(1e-7, 52 + 31.03702 / 60, fix.lat);
+  TEST_ASSERT_DOUBLE_WITHIN(1e-7, 13 + 24.09113 / 60, fix.lng);
+  TEST_ASSERT_DOUBLE_WITHIN(1e-3, 41.3, fix.altitude);
+  TEST_ASSERT_EQUAL(7, fix.satellites);
+  TEST_ASSERT_EQUAL(2026, fix.year);
+  TEST_ASSERT_EQUAL(10, fix.month);
+  TEST_ASSERT_EQUAL(16, fix.day);
+  TEST_ASSERT_EQUAL(14, fix.hour);
+  TEST_ASSERT_EQUAL(32, fix.minute);
+  TEST_ASSERT_EQUAL(4, fix.second);
+  TEST_ASSERT_EQUAL(0, fix.centisecond);
+
+  GpsFeedStats stats = feed->feedStats();
+  TEST_ASSERT_EQUAL(strlen(NMEA_CAPTURE), stats.bytes);
+  TEST_ASSERT_EQUAL(CAPTURE_SENTENCES - 1, stats.sentences);
+  TEST_ASSERT_EQUAL(1, stats.failed);
+  TEST_ASSERT_EQUAL(CAPTURE_UPDATES, stats.fixes);
+}
+
+void test_chunk_size_does_not_matter() {
+  replay(*feed, 0);
+  GpsFix whole = feed->fix();
+
+  const size_t sizes[] = {1, 7, 13, GPS_CHUNK_SIZE};
+  for (size_t size : sizes) {
+    GpsFeed chunked;
+    replay(chunked, size);
+    GpsFix fix = chunked.fix();
+    TEST_ASSERT_EQUAL(whole.updates, fix.updates);
+    TEST_ASSERT_EQUAL_DOUBLE(whole.lat, fix.lat);
+    TEST_ASSERT_EQUAL_DOUBLE(whole.lng, fix.lng);
+    TEST_ASSERT_EQUAL_DOUBLE(whole.altitude, fix.altitude);
+    TEST_ASSERT_EQUAL(whole.satellites, fix.satellites);
+    TEST_ASSERT_EQUAL(whole.second, fix.second);
+    TEST_ASSERT_EQUAL(1, chunked.feedStats().failed);
+  }
+}
+
+void test_update_per_fix_sentence() {
+  const char* next =
+      feedSentences(NMEA_CAPTURE, NMEA_CAPTURE_NO_FIX_SENTENCES);
+
+  // RMC of 14:32:00: the position, no altitude yet and the satellites of
+  // the last GGA without a fix
+  next = feedSentences(next, 1);
+  GpsFix fix = feed->fix();
+  TEST_ASSERT_TRUE(fix.valid);
+  TEST_ASSERT_EQUAL(1, fix.updates);
+  TEST_ASSERT_DOUBLE_WITHIN(1e-7, 52 + 31.036 / 60, fix.lat);
+  TEST_ASSERT_EQUAL_DOUBLE(0, fix.altitude);
+  TEST_ASSERT_EQUAL(3, fix.satellites);
+
+  // VTG, then the GGA completes the fix
+  next = feedSentences(next, 1);
+  TEST_ASSERT_EQUAL(1, feed->fix().updates);
+  next = feedSentences(next, 1);
+  fix = feed->fix();
+  TEST_ASSERT_EQUAL(2, fix.updates);
+  TEST_ASSERT_DOUBLE_WITHIN(1e-3, 41.2, fix.altitude);
+  TEST_ASSERT_EQUAL(5, fix.satellites);
+
+  // GSA, GSV, GLL and the epoch of 14:32:01
+  next = feedSentences(next, 11);
+  TEST_ASSERT_EQUAL(4, feed->fix().updates);
+
+  // the RMC of 14:32:02 counts, its GGA with the bad checksum does not
+  next = feedSentences(next, 3);
+  fix = feed->fix();
+  TEST_ASSERT_EQUAL(5, fix.updates);
+  TEST_ASSERT_DOUBLE_WITHIN(1e-7, 52 + 31.03641 / 60, fix.lat);
+  TEST_ASSERT_DOUBLE_WITHIN(1e-3, 41.0, fix.altitude);
+  TEST_ASSERT_EQUAL(5, fix.satellites);
+  TEST_ASSERT_EQUAL(1, feed->feedStats().failed);
+}
+
+void test_fix_age() {
+  replay(*feed, GPS_CHUNK_SIZE);
+  uint32_t parsed = millis();
+  delay(250);
+  GpsFix fix = feed->fix();
+  TEST_ASSERT_EQUAL(parsed, fix.time);
+  TEST_ASSERT_EQUAL(250, fix.age());
+
+  // nothing new: the same fix again
+  TEST_ASSERT_EQUAL(fix.updates, feed->fix().updates);
+}
+
+void test_bench() {
+  // the fix part of the capture, in chunks as the task reads them; the
+  // simulated clock does not move, the host clock times the parsing
+  const char* start = skipSentences(NMEA_CAPTURE, NMEA_CAPTURE_NO_FIX_SENTENCES);
+  const uint8_t* data = (const uint8_t*)start;
+  size_t length = strlen(start);
+
+  auto begin = std::chrono::steady_clock::now();
+  for (uint32_t round = 0; round < BENCH_ROUNDS; round++) {
+    for (size_t offset = 0; offset < length; offset += GPS_CHUNK_SIZE) {
+      size_t rest = length - offset;
+      feed->feed(data + offset, rest < GPS_CHUNK_SIZE ? rest : GPS_CHUNK_SIZE);
+    }
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  uint32_t epochs = BENCH_ROUNDS * NMEA_CAPTURE_FIX_EPOCHS;
+  double us = std::chrono::duration<double, std::micro>(end - begin).count();
+  char line[120];
+  snprintf(line, sizeof(line),
+           "NMEA: %.1f bytes/fix, %.3f us/fix on the host, %u fixes",
+           (double)length / NMEA_CAPTURE_FIX_EPOCHS, us / epochs,
+           (unsigned)epochs);
+  TEST_MESSAGE(line);
+
+  // each epoch was parsed: RMC and GGA, less the one bad GGA
+  TEST_ASSERT_EQUAL(BENCH_ROUNDS * (CAPTURE_UPDATES), feed->fix().updates);
+  TEST_ASSERT_EQUAL(BENCH_ROUNDS, feed->feedStats().failed);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_no_fix_before_lock);
+  RUN_TEST(test_replay_capture);
+  RUN_TEST(test_chunk_size_does_not_matter);
+  RUN_TEST(test_update_per_fix_sentence);
+  RUN_TEST(test_fix_age);
+  RUN_TEST(test_bench);
+  return UNITY_END();
+}
@@ -0,0 +1,326 @@
+/**
+ * Binary UBX mode of GpsFeed: frames of UbxParser with valid and broken
+ * checksums, and the navigation epochs of NAV-POSLLH, NAV-SOL and
+ * NAV-TIMEUTC, which are published only once all three of the same time of
+ * week (iTOW) arrived.
+ *
+ * The frames are built with UbxParser::write() and the field offsets of the
+ * u-blox 6 protocol specification, as the NEO-6M sends them.
+ *
+ * test_bench reports the bytes and the parse time per fix epoch of the fix
+ * epochs of the NMEA capture of test_gps_feed, sent as UBX.
+ */
+#define GPS_UBX
+
+#include <Arduino.h>
+#include <GpsFeed.h>
+#include <unity.h>
+
+#include <chrono>
+#include <string>
+
+// ms, GPS time of week of the test epochs
+#define EPOCH_1 387138000
+#define EPOCH_2 387139000
+
+// replays of the capture for the parse time, as in test_gps_feed
+#define BENCH_ROUNDS 10000
+
+static GpsFeed* feed;
+
+// the bytes of one frame
+static std::string frame(uint8_t cls, uint8_t id, const uint8_t* payload,
+                         uint16_t size) {
+  HardwareSerial out;
+  UbxParser::write(out, cls, id, payload, size);
+  return out.output;
+}
+
+static void put4(uint8_t* payload, uint8_t offset, uint32_t value) {
+  for (uint8_t i = 0; i < 4; i++) payload[offset + i] = value >> (8 * i);
+}
+
+// lat and lng in 1e-7 degrees, altitude above mean sea level in mm
+static std::string posllh(uint32_t itow, int32_t lat, int32_t lng,
+                          int32_t hmsl) {
+  uint8_t payload[28] = {};
+  put4(payload, 0, itow);
+  put4(payload, 4, lng);
+  put4(payload, 8, lat);
+  put4(payload, 12, hmsl + 44600);  // above the ellipsoid
+  put4(payload, 16, hmsl);
+  put4(payload, 20, 2500);  // mm, horizontal accuracy
+  put4(payload, 24, 3800);  // mm, vertical accuracy
+  return frame(UBX_CLASS_NAV, UBX_NAV_POSLLH, payload, sizeof(payload));
+}
+
+// gpsFix 0x03 == 3D, gpsFixOk in bit 0 of the flags
+static std::string sol(uint32_t itow, uint8_t gpsFix, uint8_t flags,
+                       uint8_t satellites) {
+  uint8_t payload[52] = {};
+  put4(payload, 0, itow);
+  payload[8] = 2337 & 0xff;  // GPS week
+  payload[9] = 2337 >> 8;
+  payload[10] = gpsFix;
+  payload[11] = flags;
+  payload[47] = satellites;
+  return frame(UBX_CLASS_NAV, UBX_NAV_SOL, payload, sizeof(payload));
+}
+
+static std::string timeutc(uint32_t itow, uint8_t second, int32_t nano) {
+  uint8_t payload[20] = {};
+  put4(payload, 0, itow);
+  put4(payload, 4, 25);  // ns, time accuracy
+  put4(payload, 8, nano);
+  payload[12] = 2026 & 0xff;
+  payload[13] = 2026 >> 8;
+  payload[14] = 10;
+  payload[15] = 16;
+  payload[16] = 11;
+  payload[17] = 32;
+  payload[18] = second;
+  payload[19] = 0x07;  // time of week, week number and UTC valid
+  return frame(UBX_CLASS_NAV, UBX_NAV_TIMEUTC, payload, sizeof(payload));
+}
+
+static std::string epoch(uint32_t itow, int32_t lat, int32_t lng) {
+  return posllh(itow, lat, lng, 41300) + sol(itow, 0x03, 0x0D, 7) +
+         timeutc(itow, 18, 120000000);
+}
+
+// the five fix epochs of nmea_capture.h, 14:32:00 to 14:32:04
+static std::string captureEpochs() {
+  // 1e-7 degrees of 52 31.036xx N, 13 24.09xxx E
+  static const double minutesLat[] = {31.03600, 31.03612, 31.03641, 31.03675,
+                                      31.03702};
+  static const double minutesLng[] = {24.09000, 24.09021, 24.09055, 24.09080,
+                                      24.09113};
+  static const int32_t hmsl[] = {41200, 41000, 40700, 40900, 41300};
+  static const uint8_t satellites[] = {5, 5, 6, 6, 7};
+  std::string bytes;
+  for (uint8_t i = 0; i < 5; i++) {
+    uint32_t itow = EPOCH_1 + i * 1000;
+    bytes += posllh(itow, lround((52 + minutesLat[i] / 60) * 1e7),
+                    lround((13 + minutesLng[i] / 60) * 1e7), hmsl[i]);
+    bytes += sol(itow, 0x03, 0x0D, satellites[i]);
+    bytes += timeutc(itow, i, 0);
+  }
+  return bytes;
+}
+
+static void feedBytes(const std::string& bytes) {
+  feed->feed((const uint8_t*)bytes.data(), bytes.size());
+}
+
+// frames the parser completed, byte by byte
+static uint32_t encodeAll(UbxParser& parser, const std::string& bytes) {
+  uint32_t frames = 0;
+  for (char c : bytes) {
+    if (parser.encode(c)) frames++;
+  }
+  return frames;
+}
+
+void setUp() {
+  fake_reset(1000000);
+  Serial.output.clear();
+  feed = new GpsFeed();
+}
+
+void tearDown() { delete feed; }
+
+void test_parse_frame() {
+  UbxParser parser;
+  std::string bytes = posllh(EPOCH_1, 525172670, 134015188, 41300);
+  TEST_ASSERT_EQUAL(6 + 28 + 2, bytes.size());
+  for (size_t i = 0; i < bytes.size() - 1; i++) {
+    TEST_ASSERT_FALSE(parser.encode(bytes[i]));
+  }
+  TEST_ASSERT_TRUE(parser.encode(bytes.back()));
+
+  TEST_ASSERT_TRUE(parser.is(UBX_CLASS_NAV, UBX_NAV_POSLLH));
+  TEST_ASSERT_EQUAL(28, parser.length());
+  TEST_ASSERT_EQUAL(EPOCH_1, parser.u4(0));
+  TEST_ASSERT_EQUAL(134015188, parser.i4(4));
+  TEST_ASSERT_EQUAL(525172670, parser.i4(8));
+  TEST_ASSERT_EQUAL(41300, parser.i4(16));
+  TEST_ASSERT_EQUAL(1, parser.passedChecksum());
+  TEST_ASSERT_EQUAL(0, parser.failedChecksum());
+}
+
+void test_negative_fields() {
+  // south and west
+  UbxParser parser;
+  TEST_ASSERT_EQUAL(
+      1, encodeAll(parser, posllh(EPOCH_1, -338567890, -704512345, -12000)));
+  TEST_ASSERT_EQUAL(-338567890, parser.i4(8));
+  TEST_ASSERT_EQUAL(-704512345, parser.i4(4));
+  TEST_ASSERT_EQUAL(-12000, parser.i4(16));
+}
+
+void test_checksum_failure() {
+  UbxParser parser;
+  std::string bytes = sol(EPOCH_1, 0x03, 0x0D, 7);
+
+  // a payload byte changed on the UART: CK_A does not match
+  std::string corrupt = bytes;
+  corrupt[6 + 47] ^= 0x04;
+  TEST_ASSERT_EQUAL(0, encodeAll(parser, corrupt));
+  TEST_ASSERT_EQUAL(1, parser.failedChecksum());
+
+  // only CK_B wrong
+  corrupt = bytes;
+  corrupt.back() ^= 0x01;
+  TEST_ASSERT_EQUAL(0, encodeAll(parser, corrupt));
+  TEST_ASSERT_EQUAL(2, parser.failedChecksum());
+
+  // the next frame is read again
+  TEST_ASSERT_EQUAL(1, encodeAll(parser, bytes));
+  TEST_ASSERT_EQUAL(7, parser.u1(47));
+  TEST_ASSERT_EQUAL(1, parser.passedChecksum());
+  TEST_ASSERT_EQUAL(2, parser.failedChecksum());
+}
+
+void test_sync_after_nmea_and_long_frames() {
+  UbxParser parser;
+  // NMEA sentences, sent before the receiver took the configuration, and a
+  // NAV-SVINFO longer than the buffer
+  std::string bytes = "$GPGGA,,,,,,0,00,99.99,,,,,,*48\r\n";
+  uint8_t svinfo[8 + 12 * 10] = {};
+  bytes += frame(UBX_CLASS_NAV, 0x30, svinfo, sizeof(svinfo));
+  bytes += timeutc(EPOCH_1, 18, 120000000);
+
+  TEST_ASSERT_EQUAL(1, encodeAll(parser, bytes));
+  TEST_ASSERT_TRUE(parser.is(UBX_CLASS_NAV, UBX_NAV_TIMEUTC));
+  TEST_ASSERT_EQUAL(1, parser.skippedFrames());
+  TEST_ASSERT_EQUAL(0, parser.failedChecksum());
+}
+
+void test_epoch_published() {
+  feedBytes(epoch(EPOCH_1, 525172670, 134015188));
+
+  GpsFix fix = feed->fix();
+  TEST_ASSERT_TRUE(fix.valid);
+  TEST_ASSERT_EQUAL(1, fix.updates);
+  TEST_ASSERT_DOUBLE_WITHIN(1e-9, 52.5172670, fix.lat);
+  TEST_ASSERT_DOUBLE_WITHIN(1e-9, 13.4015188, fix.lng);
+  TEST_ASSERT_DOUBLE_WITHIN(1e-9, 41.3, fix.altitude);
+  TEST_ASSERT_EQUAL(7, fix.satellites);
+  TEST_ASSERT_EQUAL(2026, fix.year);
+  TEST_ASSERT_EQUAL(10, fix.month);
+  TEST_ASSERT_EQUAL(16, fix.day);
+  TEST_ASSERT_EQUAL(11, fix.hour);
+  TEST_ASSERT_EQUAL(32, fix.minute);
+  TEST_ASSERT_EQUAL(18, fix.second);
+  TEST_ASSERT_EQUAL(12, fix.centisecond);
+
+  GpsFeedStats stats = feed->feedStats();
+  TEST_ASSERT_EQUAL(3, stats.sentences);
+  TEST_ASSERT_EQUAL(0, stats.failed);
+  TEST_ASSERT_EQUAL(1, stats.fixes);
+}
+
+void test_epoch_in_any_order() {
+  feedBytes(timeutc(EPOCH_1, 18, -25000));
+  feedBytes(sol(EPOCH_1, 0x03, 0x0D, 7));
+  TEST_ASSERT_EQUAL(0, feed->fix().updates);
+  feedBytes(posllh(EPOCH_1, 525172670, 134015188, 41300));
+
+  GpsFix fix = feed->fix();
+  TEST_ASSERT_EQUAL(1, fix.updates);
+  TEST_ASSERT_DOUBLE_WITHIN(1e-9, 52.5172670, fix.lat);
+  // a negative nanosecond part before the full second
+  TEST_ASSERT_EQUAL(0, fix.centisecond);
+}
+
+void test_itow_mismatch() {
+  // the position of epoch 1, then the solution and time of epoch 2: no fix
+  // mixed of two epochs
+  feedBytes(posllh(EPOCH_1, 525172670, 134015188, 41300));
+  feedBytes(sol(EPOCH_2, 0x03, 0x0D, 7));
+  feedBytes(timeutc(EPOCH_2, 19, 120000000));
+  TEST_ASSERT_EQUAL(0, feed->fix().updates);
+
+  // the position of epoch 2 completes it
+  feedBytes(posllh(EPOCH_2, 525172702, 134015213, 41400));
+  GpsFix fix = feed->fix();
+  TEST_ASSERT_EQUAL(1, fix.updates);
+  TEST_ASSERT_DOUBLE_WITHIN(1e-9, 52.5172702, fix.lat);
+  TEST_ASSERT_DOUBLE_WITHIN(1e-9, 41.4, fix.altitude);
+  TEST_ASSERT_EQUAL(19, fix.second);
+  TEST_ASSERT_EQUAL(0, feed->feedStats().failed);
+}
+
+void test_epoch_with_bad_checksum_dropped() {
+  // the POSLLH of epoch 1 is lost to a checksum error
+  std::string first = epoch(EPOCH_1, 525172670, 134015188);
+  first[6 + 8] ^= 0x20;
+  feedBytes(first);
+  TEST_ASSERT_EQUAL(0, feed->fix().updates);
+  TEST_ASSERT_EQUAL(1, feed->feedStats().failed);
+
+  feedBytes(epoch(EPOCH_2, 525172702, 134015213));
+  GpsFix fix = feed->fix();
+  TEST_ASSERT_EQUAL(1, fix.updates);
+  TEST_ASSERT_DOUBLE_WITHIN(1e-9, 52.5172702, fix.lat);
+  TEST_ASSERT_EQUAL(5, feed->feedStats().sentences);
+}
+
+void test_no_fix_not_published() {
+  // complete epochs, but without a fix or with gpsFixOk cleared
+  feedBytes(posllh(EPOCH_1, 0, 0, 0) + sol(EPOCH_1, 0x00, 0x0C, 2) +
+            timeutc(EPOCH_1, 18, 0));
+  feedBytes(posllh(EPOCH_2, 525172670, 134015188, 41300) +
+            sol(EPOCH_2, 0x03, 0x0C, 4) + timeutc(EPOCH_2, 19, 0));
+  GpsFix fix = feed->fix();
+  TEST_ASSERT_FALSE(fix.valid);
+  TEST_ASSERT_EQUAL(0, fix.updates);
+  TEST_ASSERT_EQUAL(6, feed->feedStats().sentences);
+}
+
+void test_bench() {
+  // in chunks as the task reads them; the simulated clock does not move,
+  // the host clock times the parsing
+  std::string bytes = captureEpochs();
+  const uint8_t* data = (const uint8_t*)bytes.data();
+  size_t length = bytes.size();
+
+  auto begin = std::chrono::steady_clock::now();
+  for (uint32_t round = 0; round < BENCH_ROUNDS; round++) {
+    for (size_t offset = 0; offset < length; offset += GPS_CHUNK_SIZE) {
+      size_t rest = length - offset;
+      feed->feed(data + offset, rest < GPS_CHUNK_SIZE ? rest : GPS_CHUNK_SIZE);
+    }
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  uint32_t epochs = BENCH_ROUNDS * 5;
+  double us = std::chrono::duration<double, std::micro>(end - begin).count();
+  char line[120];
+  snprintf(line, sizeof(line),
+           "UBX: %.1f bytes/fix, %.3f us/fix on the host, %u fixes",
+           (double)length / 5, us / epochs, (unsigned)epochs);
+  TEST_MESSAGE(line);
+
+  GpsFix fix = feed->fix();
+  TEST_ASSERT_EQUAL(epochs, fix.updates);
+  TEST_ASSERT_DOUBLE_WITHIN(1e-7, 52 + 31.03702 / 60, fix.lat);
+  TEST_ASSERT_DOUBLE_WITHIN(1e-7, 13 + 24.09113 / 60, fix.lng);
+  TEST_ASSERT_EQUAL(7, fix.satellites);
+  TEST_ASSERT_EQUAL(0, feed->feedStats().failed);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_parse_frame);
+  RUN_TEST(test_negative_fields);
+  RUN_TEST(test_checksum_failure);
+  RUN_TEST(test_sync_after_nmea_and_long_frames);
+  RUN_TEST(test_epoch_published);
+  RUN_TEST(test_epoch_in_any_order);
+  RUN_TEST(test_itow_mismatch);
+  RUN_TEST(test_epoch_with_bad_checksum_dropped);
+  RUN_TEST(test_no_fix_not_published);
+  RUN_TEST(test_bench);
+  return UNITY_END();
+}
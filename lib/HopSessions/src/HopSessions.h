@@ -0,0 +1,407 @@
+/**
+ * @file HopSessions.h
+ * @brief Concurrent message sequences of the challenge 4 flipping sender.
+ *
+ * A group that sends its key gets a sequence of MESSAGE_ROTATION_NUM coded
+ * messages, each naming the parameter set (frequency, bandwidth, spreading
+ * factor) of the next one, and a final hint. Every group has a session of
+ * its own: the scheduler sends all sessions due on the same parameter set
+ * in one batch, so the radio is retuned once per batch instead of once per
+ * message, and a new request never waits for the sequence of another group.
+ *
+ *   HopSessions<decltype(lora)> hop_sessions(lora, standard_ps, lora_sets,
+ *                                            LORA_SET_COUNT, CONFIG_RADIO_CR);
+ *   ...
+ *   if (lora.txDone()) hop_sessions.sent();
+ *   ...
+ *   hop_sessions.run();
+ *
+ * The hop backoff of a session starts when its frame is done on air, not when
+ * it is queued: a frame held back by the airtime budget or by listen before
+ * talk still leaves the participant HOP_BACKOFF to switch parameters.
+ */
+#pragma once
+
+#include <Arduino.h>
+#include <HudText.h>
+#include <LoRaLink.h>
+#include <codebook.h>
+
+#ifndef MESSAGE_ROTATION_NUM
+#define MESSAGE_ROTATION_NUM 3
+#endif
+
+// delay before the first message of a session and between its hops
+#ifndef REQUEST_BACKOFF
+#define REQUEST_BACKOFF 500  // ms
+#endif
+#ifndef HOP_BACKOFF
+#define HOP_BACKOFF 1000  // ms
+#endif
+
+// due time of a session whose frame is queued, until its TX done
+#define HOP_DUE_SENT (~(RadioLibTime_t)0)
+
+/**
+ * Radio settings of a hop.
+ */
+struct HopParameterSet {
+  float frequency;  // MHz
+  float bandwidth;  // kHz
+  uint8_t spreadingFactor;
+};
+
+/**
+ * One running message sequence. Each session waits on the parameter set its
+ * participant listens on.
+ */
+struct HopSession {
+  bool active;
+  uint8_t version;           // answer in the frame format of the request
+  uint8_t message_num;       // messages sent so far
+  uint8_t parameterset_num;  // set of the next message, 0 == standard
+  RadioLibTime_t due;        // ms, time of the next message
+  RadioLibTime_t started;    // ms
+};
+
+struct HopSessionStats {
+  uint32_t completed;
+  uint32_t retunes;  // parameter set switches for a batch
+  RadioLibTime_t firstStart;  // ms, start of the first session
+};
+
+template <typename Link>
+class HopSessions {
+ public:
+  /**
+   * sets are the hop parameter sets, the standard set is the one requests
+   * are received on.
+   */
+  HopSessions(Link& link, const HopParameterSet& standard,
+              const HopParameterSet* sets, uint8_t setCount,
+              uint8_t codingRate)
+      : link(link),
+        standard(standard),
+        sets(sets),
+        setCount(setCount),
+        codingRate(codingRate) {}
+
+  /**
+   * Starts the message sequence for a group, unless it is already running.
+   */
+  bool start(byte sender, uint8_t version) {
+    HopSession& session = sessions[sender];
+    if (session.active) {
+      Serial.println(
+          log_text.format("Session of ", hud_hex(sender), " already running"));
+      return false;
+    }
+
+    session.active = true;
+    session.version = version;
+    session.message_num = 0;
+    // the first message goes out on the standard parameters
+    session.parameterset_num = 0;
+    session.started = millis();
+    session.due = session.started + REQUEST_BACKOFF;
+    active_sessions++;
+    if (stats.firstStart == 0) {
+      stats.firstStart = session.started;
+    }
+    Serial.println(log_text.format("Session of ", hud_hex(sender),
+                                   " started, ", active_sessions, " active"));
+    return true;
+  }
+
+  /**
+   * Starts the hop backoff of the sessions whose frames were queued. Call when
+   * the link reports its last queued frame done (txDone()), the batch is on
+   * air by then.
+   */
+  void sent() {
+    RadioLibTime_t now = millis();
+    for (int addr = 0; addr < 256; addr++) {
+      HopSession& session = sessions[addr];
+      if (session.active && session.due == HOP_DUE_SENT) {
+        session.due = now + HOP_BACKOFF;
+      }
+    }
+  }
+
+  /**
+   * Sends the messages that are due. The radio stays on its parameter set as
+   * long as sessions are due there, otherwise it is retuned to the set of the
+   * longest waiting session. All sessions of a batch hop to the same next
+   * set, so they stay batched. Without a due session, the radio listens on
+   * the standard parameters for new requests.
+   */
+  void run() {
+    // retune only after the queued frames are sent on the current set
+    if (link.queueDepth() > 0 || link.state() == LORA_STATE_TX) {
+      return;
+    }
+
+    RadioLibTime_t now = millis();
+    bool dueOnTuned = false;
+    int oldest = -1;
+    for (int addr = 0; addr < 256; addr++) {
+      const HopSession& session = sessions[addr];
+      if (!session.active || session.due > now) continue;
+      if (session.parameterset_num == tuned_parameterset_num) {
+        dueOnTuned = true;
+      }
+      if (oldest < 0 || session.due < sessions[oldest].due) {
+        oldest = addr;
+      }
+    }
+
+    if (oldest < 0) {
+      if (tuned_parameterset_num != 0) {
+        Serial.println("Back to standard parameters for requests");
+        tuned_parameterset_num = 0;
+        retune(standard);
+        link.listen();
+      }
+      return;
+    }
+
+    if (!dueOnTuned) {
+      tuned_parameterset_num = sessions[oldest].parameterset_num;
+      Serial.println("Switching parameterset! ");
+      retune(parameterset(tuned_parameterset_num));
+      link.listen();
+      stats.retunes++;
+    }
+
+    // the hop of this batch, planned for the longest message
+    uint8_t next_num =
+        planNext(LORA_V2_HEADER_SIZE + 20 +
+                     codebook_find(oldest)->codeLength / MESSAGE_ROTATION_NUM +
+                     2,
+                 tuned_parameterset_num) +
+        1;
+
+    for (int addr = 0; addr < 256 && link.queueAvailable(); addr++) {
+      HopSession& session = sessions[addr];
+      if (!session.active || session.due > now ||
+          session.parameterset_num != tuned_parameterset_num) {
+        continue;
+      }
+
+      byte receiverAddress = addr;
+
+      if (session.message_num < MESSAGE_ROTATION_NUM) {
+        Serial.println(log_text.format(">>> LoRa sending coded message ",
+                                       millis(), " to ",
+                                       hud_hex(receiverAddress)));
+        if (!sendMessage(receiverAddress, session, next_num)) {
+          break;
+        }
+        session.message_num++;
+        session.parameterset_num = next_num;
+        // the backoff starts at TX done, see sent()
+        session.due = HOP_DUE_SENT;
+      } else {
+        Serial.println(log_text.format(">>> LoRa sending final message ",
+                                       millis(), " to ",
+                                       hud_hex(receiverAddress)));
+        if (!sendMessage(receiverAddress, session, next_num)) {
+          break;
+        }
+
+        // last message sent, the participant returns to the standard
+        // parameters
+        session.active = false;
+        active_sessions--;
+        stats.completed++;
+        Serial.println(log_text.format(
+            "-- sent all messages to ", hud_hex(receiverAddress), " in ",
+            millis() - session.started, "ms --"));
+        printStats(Serial);
+      }
+    }
+  }
+
+  /**
+   * Prints the completed sessions, their rate per hour since the first
+   * request and the retunes, then the message cache.
+   */
+  void printStats(Print& out) {
+    RadioLibTime_t running = millis() - stats.firstStart;
+    out.println(log_text.format(
+        "Sessions: ", stats.completed, " completed, ", active_sessions,
+        " active, ",
+        running > 0 ? stats.completed * 3600000.0 / running : 0.0, "/h, ",
+        stats.retunes, " retunes"));
+    out.print("Message cache: ");
+    message_cache.cacheStats().print(out);
+  }
+
+  uint8_t activeCount() const { return active_sessions; }
+  const HopSession& session(byte address) const { return sessions[address]; }
+  HopSessionStats sessionStats() const { return stats; }
+  LoRaFrameCacheStats cacheStats() const {
+    return message_cache.cacheStats();
+  }
+
+  HopParameterSet parameterset(uint8_t num) const {
+    return num == 0 ? standard : sets[num - 1];
+  }
+
+ private:
+  Link& link;
+  const HopParameterSet standard;
+  const HopParameterSet* sets;
+  const uint8_t setCount;
+  const uint8_t codingRate;
+
+  HopSession sessions[256] = {};
+  uint8_t active_sessions = 0;
+  // parameter set the radio is tuned to, 0 == standard, else index into sets
+  // + 1
+  uint8_t tuned_parameterset_num = 0;
+  HopSessionStats stats = {};
+
+  // encoded messages, keyed by receiver, message number and next parameter
+  // set
+  LoRaFrameCache<32, 64> message_cache;
+  HudText<160> log_text;
+
+  /**
+   * Writes the next message of a session into the frame buffer: the
+   * parameters "fff.fff,bbb.bb,ss. " (3 and 2 decimal places) of the next
+   * hop followed by every MESSAGE_ROTATION_NUM-th char of the code message,
+   * or the final hint. Returns the payload size.
+   */
+  size_t buildMessage(byte receiverAddress, const HopSession& session,
+                      uint8_t next_num) {
+    char* entire_message = (char*)link.framePayload();
+    int size = 0;
+
+    if (session.message_num < MESSAGE_ROTATION_NUM) {
+      // get code message part
+      const CodebookEntry* group = codebook_find(receiverAddress);
+      const uint8_t* current_message = group->code;
+
+      HopParameterSet next = parameterset(next_num);
+      size = snprintf(entire_message, link.maxPayloadSize(), "%.3f,%.2f,%d. ",
+                      next.frequency, next.bandwidth, next.spreadingFactor);
+
+      int fwd = session.message_num % MESSAGE_ROTATION_NUM;
+      for (int i = 0; i < group->codeLength - fwd;
+           i = i + MESSAGE_ROTATION_NUM) {
+        entire_message[size++] = current_message[i + fwd];
+      }
+    } else {
+      size = snprintf(entire_message, link.maxPayloadSize(),
+                      "XOR with your key. Bye.");
+    }
+
+    // '\0' termination, as for String payloads in v1 frames
+    if (link.getFrameVersion() == 1) {
+      entire_message[size++] = '\0';
+    }
+    return size;
+  }
+
+  /**
+   * Queues the next message of a session, from the frame cache if it was sent
+   * before with the same next parameter set and frame format.
+   */
+  bool sendMessage(byte receiverAddress, const HopSession& session,
+                   uint8_t next_num) {
+    uint32_t start = micros();
+    bool hop = session.message_num < MESSAGE_ROTATION_NUM;
+    uint8_t rotation = hop ? next_num : 0;
+    LoRaCachedFrame* cached = message_cache.find(
+        receiverAddress, session.message_num, rotation, session.version);
+    bool hit = cached != nullptr;
+
+    if (!hit) {
+      // answer in the frame format of the request
+      link.setFrameVersion(session.version);
+      size_t size = buildMessage(receiverAddress, session, next_num);
+      cached = message_cache.slotFor(receiverAddress, session.message_num,
+                                     rotation);
+      if (cached == nullptr ||
+          !link.encodeFrame(*cached, link.framePayload(), size,
+                            receiverAddress,
+                            hop ? LORA_MSG_HOP : LORA_MSG_ANSWER)) {
+        return false;
+      }
+    }
+
+    if (!link.sendCached(*cached)) {
+      return false;
+    }
+    message_cache.record(hit, micros() - start);
+    return true;
+  }
+
+  /**
+   * Picks the next hop, different to the current parameter set. Sets whose
+   * sub-band has the airtime for the next frame right away are preferred, one
+   * of them is picked at random. If no sub-band has headroom, the set with
+   * the shortest wait is used. Returns the index into sets.
+   */
+  uint8_t planNext(size_t frameSize, uint8_t current) {
+    const LoRaAirtimeBudget& budget = link.airtimeBudget();
+    RadioLibTime_t now = millis();
+
+    uint8_t ready[256];
+    uint8_t readyCount = 0;
+    uint8_t best = 0;
+    RadioLibTime_t bestWait = ~(RadioLibTime_t)0;
+
+    for (uint8_t i = 0; i < setCount; i++) {
+      if (i + 1 == current) continue;
+
+      const HopParameterSet& ps = sets[i];
+      RadioLibTime_t airtime =
+          (lora_time_on_air(frameSize, ps.spreadingFactor, ps.bandwidth,
+                            codingRate) +
+           999) /
+          1000;
+      RadioLibTime_t wait = budget.wait(ps.frequency, airtime, now);
+      if (wait == 0) {
+        ready[readyCount++] = i;
+      } else if (wait < bestWait) {
+        best = i;
+        bestWait = wait;
+      }
+    }
+
+    if (readyCount > 0) {
+      return ready[random(0, readyCount)];
+    }
+    Serial.println(log_text.format(
+        "No sub-band with airtime left, next hop in ", bestWait / 1000, "s"));
+    return best;
+  }
+
+  void retune(const HopParameterSet& ps) {
+    // only the settings that differ from the current ones are written
+    int state = link.retune(ps.frequency, ps.bandwidth, ps.spreadingFactor);
+    if (state == RADIOLIB_ERR_INVALID_FREQUENCY) {
+      Serial.println(F("Selected frequency is invalid for this module!"));
+      while (true);
+    }
+
+    if (state == RADIOLIB_ERR_INVALID_BANDWIDTH) {
+      Serial.println(F("Selected bandwidth is invalid for this module!"));
+      while (true);
+    }
+
+    if (state == RADIOLIB_ERR_INVALID_SPREADING_FACTOR) {
+      Serial.println(
+          F("Selected spreading factor is invalid for this module!"));
+      while (true);
+    }
+
+    LoRaRetuneStats retunes = link.retuneStats();
+    Serial.println(log_text.format("Retune ", retunes.lastTime, "us, ",
+                                   retunes.retunes, " retunes, ",
+                                   retunes.unchanged, " unchanged, avg ",
+                                   retunes.totalTime / retunes.retunes, "us"));
+  }
+};
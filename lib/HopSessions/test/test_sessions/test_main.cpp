@@ -0,0 +1,313 @@
+/**
+ * Throughput of the concurrent hop sessions against the serial scheduler of
+ * the original challenge 4 sender, and the hop backoff measured from the TX
+ * done of each frame.
+ *
+ * The groups of the codebook request their message sequence, and request it
+ * again REQUEST_AGAIN after its final message, for a simulated hour. The
+ * fake radio takes the time-on-air of the applied settings, so the airtime
+ * budget of each sub-band limits the frames as on the board. Participants
+ * are not simulated: the frames on fake_air show when each group got its
+ * messages.
+ *
+ * The serial scheduler serves one group at a time, as the original loop()
+ * did. It keeps later requests in a queue instead of dropping them, which
+ * makes it an upper bound of the original.
+ */
+#include <Arduino.h>
+#include <HopSessions.h>
+#include <unity.h>
+
+#include <deque>
+
+typedef LoRaLink<SX1276, LoRaPins<18, 26, 23, 33>> TBeamLink;
+
+// the settings of devices/4_flipping_sender
+static const LoRaConfig config = {868.3, 125.0, 8, 5, 0x12, 10, false, 0};
+static const HopParameterSet standard = {868.3, 125.0, 8};
+static const HopParameterSet sets[] = {
+    {869.4, 125.0, 8},    {869.5, 125.0, 8},    {869.525, 250.0, 8},
+    {869.525, 250.0, 9},  {869.525, 250.0, 10}, {869.525, 250.0, 11},
+    {869.48, 125.0, 8},   {869.48, 125.0, 10},  {869.55, 125.0, 8},
+    {869.55, 125.0, 10},
+};
+#define SET_COUNT (sizeof(sets) / sizeof(sets[0]))
+
+#define SIM_TIME 3600000000ULL  // us
+// ms from the final message of a group to its next request
+#define REQUEST_AGAIN 5000
+// ms, the backoff is due at millis() resolution, so a frame ending 0.7 ms
+// into a millisecond has the next one 999.3 ms after it
+#define MIN_HOP_GAP (HOP_BACKOFF - 1)
+
+static TBeamLink* link;
+
+struct SimResult {
+  uint32_t completed;
+  uint32_t frames;
+  uint32_t minHopGap;  // ms, shortest TX done to next frame of a group
+  uint64_t sessionTime;  // ms, request to final message, all sessions
+
+  float perHour() const { return completed * 3600000000.0 / SIM_TIME; }
+  uint32_t meanTime() const {
+    return completed > 0 ? sessionTime / completed : 0;
+  }
+};
+
+/**
+ * The scheduler of the original loop(): one group at a time, a random next
+ * set per hop, retuned and listening after the TX done, the next hop
+ * HOP_BACKOFF after it.
+ */
+struct SerialScheduler {
+  std::deque<byte> requests;
+  byte receiver = 0;  // 0 == idle
+  uint8_t message_num = 0;
+  uint8_t current = 0;  // 0 == standard, else index into sets + 1
+  uint8_t next = 0;
+  bool waiting = false;  // frame queued, TX done pending
+  RadioLibTime_t due = 0;
+
+  void start(byte sender) { requests.push_back(sender); }
+
+  // returns true when the final message of receiver was queued
+  bool run(byte& finished) {
+    if (waiting) {
+      if (!link->txDone()) return false;
+      waiting = false;
+      current = next;
+      HopParameterSet ps = current == 0 ? standard : sets[current - 1];
+      link->retune(ps.frequency, ps.bandwidth, ps.spreadingFactor);
+      link->listen();
+      due = millis() + HOP_BACKOFF;
+    }
+    if (receiver == 0) {
+      if (requests.empty()) return false;
+      receiver = requests.front();
+      requests.pop_front();
+      message_num = 0;
+      due = millis() + REQUEST_BACKOFF;
+    }
+    if (millis() < due || !link->transmitAvailable()) return false;
+
+    char message[64];
+    int size;
+    if (message_num < MESSAGE_ROTATION_NUM) {
+      do {
+        next = random(0, SET_COUNT) + 1;
+      } while (next == current);
+      const HopParameterSet& ps = sets[next - 1];
+      const CodebookEntry* group = codebook_find(receiver);
+      size = snprintf(message, sizeof(message), "%.3f,%.2f,%d. ",
+                      ps.frequency, ps.bandwidth, ps.spreadingFactor);
+      for (int i = message_num; i < group->codeLength;
+           i += MESSAGE_ROTATION_NUM) {
+        message[size++] = group->code[i];
+      }
+    } else {
+      next = 0;
+      size = snprintf(message, sizeof(message), "XOR with your key. Bye.");
+    }
+    message[size++] = '\0';
+    if (!link->sendPacket((const byte*)message, size, receiver)) return false;
+    waiting = true;
+    if (++message_num <= MESSAGE_ROTATION_NUM) return false;
+    finished = receiver;
+    receiver = 0;
+    return true;
+  }
+};
+
+// per group: time of its next request, 0 == session running
+struct Group {
+  byte address;
+  RadioLibTime_t request;
+  RadioLibTime_t started;
+};
+
+static void collectFrames(SimResult& result, uint64_t end) {
+  uint64_t last[256] = {};
+  result.minHopGap = UINT32_MAX;
+  for (const FakeAirFrame& frame : fake_air) {
+    if (frame.end > end) continue;
+    result.frames++;
+    byte recipient = frame.data[0];
+    if (last[recipient] != 0) {
+      uint32_t gap = (frame.start - last[recipient]) / 1000;
+      // a new session of the group starts with REQUEST_AGAIN
+      if (gap < REQUEST_AGAIN && gap < result.minHopGap) {
+        result.minHopGap = gap;
+      }
+    }
+    last[recipient] = frame.end;
+  }
+}
+
+static void begin(uint8_t groupCount, Group* groups) {
+  fake_reset(1000000);
+  fake_air.clear();
+  randomSeed(23);
+  link = new TBeamLink(0x31);
+  link->begin(config);
+  link->radio.loraTiming = true;
+  for (uint8_t i = 0; i < groupCount; i++) {
+    // first requests spread over the first minute
+    groups[i] = {CODEBOOK[i].deviceId, (RadioLibTime_t)random(1, 60000), 0};
+  }
+}
+
+static SimResult simulateConcurrent(uint8_t groupCount) {
+  Group groups[CODEBOOK_GROUP_COUNT];
+  begin(groupCount, groups);
+  auto* sessions = new HopSessions<TBeamLink>(*link, standard, sets,
+                                              SET_COUNT, config.codingRate);
+
+  SimResult result = {};
+  uint64_t end = fake_now + SIM_TIME;
+  while (fake_now < end) {
+    if (link->txDone()) sessions->sent();
+    for (uint8_t i = 0; i < groupCount; i++) {
+      Group& group = groups[i];
+      if (group.request != 0 && millis() >= group.request) {
+        sessions->start(group.address, 1);
+        group.request = 0;
+        group.started = millis();
+      } else if (group.request == 0 &&
+                 !sessions->session(group.address).active) {
+        result.completed++;
+        result.sessionTime += millis() - group.started;
+        group.request = millis() + REQUEST_AGAIN;
+      }
+    }
+    link->poll();
+    sessions->run();
+    Serial.output.clear();
+    link->waitEvent(10);
+  }
+  collectFrames(result, end);
+
+  delete sessions;
+  delete link;
+  return result;
+}
+
+static SimResult simulateSerial(uint8_t groupCount) {
+  Group groups[CODEBOOK_GROUP_COUNT];
+  begin(groupCount, groups);
+  SerialScheduler scheduler;
+
+  SimResult result = {};
+  uint64_t end = fake_now + SIM_TIME;
+  while (fake_now < end) {
+    for (uint8_t i = 0; i < groupCount; i++) {
+      Group& group = groups[i];
+      if (group.request != 0 && millis() >= group.request) {
+        scheduler.start(group.address);
+        group.request = 0;
+        group.started = millis();
+      }
+    }
+    byte finished;
+    if (scheduler.run(finished)) {
+      for (uint8_t i = 0; i < groupCount; i++) {
+        Group& group = groups[i];
+        if (group.address != finished) continue;
+        result.completed++;
+        result.sessionTime += millis() - group.started;
+        group.request = millis() + REQUEST_AGAIN;
+      }
+    }
+    link->poll();
+    Serial.output.clear();
+    link->waitEvent(10);
+  }
+  collectFrames(result, end);
+
+  delete link;
+  return result;
+}
+
+static void report(const char* name, uint8_t groupCount,
+                   const SimResult& result) {
+  char line[160];
+  snprintf(line, sizeof(line),
+           "%s, %u groups: %u sessions in 1 h (%.0f/h), %u frames, session "
+           "%u ms on average, shortest hop gap %u ms",
+           name, groupCount, (unsigned)result.completed, result.perHour(),
+           (unsigned)result.frames, (unsigned)result.meanTime(),
+           (unsigned)result.minHopGap);
+  TEST_MESSAGE(line);
+}
+
+void setUp() { Serial.output.clear(); }
+
+void tearDown() {}
+
+void test_single_group() {
+  SimResult serial = simulateSerial(1);
+  SimResult concurrent = simulateConcurrent(1);
+  report("serial", 1, serial);
+  report("concurrent", 1, concurrent);
+
+  // nothing to batch: about the same rate
+  TEST_ASSERT_GREATER_THAN(0, concurrent.completed);
+  TEST_ASSERT_GREATER_OR_EQUAL(serial.completed * 9 / 10,
+                               concurrent.completed);
+  TEST_ASSERT_GREATER_OR_EQUAL(MIN_HOP_GAP, concurrent.minHopGap);
+}
+
+void test_all_groups() {
+  SimResult serial = simulateSerial(CODEBOOK_GROUP_COUNT);
+  SimResult concurrent = simulateConcurrent(CODEBOOK_GROUP_COUNT);
+  report("serial", CODEBOOK_GROUP_COUNT, serial);
+  report("concurrent", CODEBOOK_GROUP_COUNT, concurrent);
+
+  // both are held by the 1 % budget of the request channel, the first
+  // message of every session is sent there: the concurrent sessions serve
+  // the same number per hour, but a group waits for its own session only
+  TEST_ASSERT_GREATER_OR_EQUAL(serial.completed * 95 / 100,
+                               concurrent.completed);
+  TEST_ASSERT_LESS_THAN(serial.meanTime() / 4, concurrent.meanTime());
+  TEST_ASSERT_GREATER_OR_EQUAL(MIN_HOP_GAP, concurrent.minHopGap);
+}
+
+void test_backoff_from_tx_done() {
+  // the channel is busy for the first hop: LBT holds the frame back
+  Group groups[1];
+  begin(1, groups);
+  link->setListenBeforeTalk(true);
+  HopSessions<TBeamLink> sessions(*link, standard, sets, SET_COUNT,
+                                  config.codingRate);
+  sessions.start(groups[0].address, 1);
+
+  bool busy = false;
+  uint64_t end = fake_now + 60000000ULL;
+  while (fake_now < end) {
+    if (link->txDone()) sessions.sent();
+    if (!busy && sessions.session(groups[0].address).message_num == 1) {
+      // behind the first frame, a neighbour takes the channel
+      link->radio.busyScans = LORA_LBT_MAX_TRIES;
+      busy = true;
+    }
+    link->poll();
+    sessions.run();
+    Serial.output.clear();
+    link->waitEvent(10);
+  }
+  TEST_ASSERT_EQUAL(0, sessions.activeCount());
+  TEST_ASSERT_GREATER_THAN(0, link->lbtStats().busy);
+
+  SimResult result = {};
+  collectFrames(result, end);
+  TEST_ASSERT_EQUAL(MESSAGE_ROTATION_NUM + 1, result.frames);
+  TEST_ASSERT_GREATER_OR_EQUAL(MIN_HOP_GAP, result.minHopGap);
+  delete link;
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_single_group);
+  RUN_TEST(test_all_groups);
+  RUN_TEST(test_backoff_from_tx_done);
+  return UNITY_END();
+}
@@ -0,0 +1,119 @@
+/**
+ * @file HudText.h
+ * @brief Fixed-size text buffer for display labels and Serial status lines.
+ *
+ * The firmwares built their labels and log lines from String temporaries,
+ * one heap allocation per "+" in every loop() pass. Over a workshop day
+ * that fragments the heap until the largest free block no longer fits a
+ * frame buffer. HudText formats into a char array of fixed size with the
+ * number formatting of Print, so no text is ever allocated. Text beyond
+ * the size is cut off and truncated() is set.
+ *
+ *   HudText<OLED_UI_TEXT_SIZE> label_text;
+ *   HudText<160> log_text;
+ *   ...
+ *   ui.set(ui_battery, label_text.format("Bat ", percent, "%"));
+ *   Serial.println(log_text.format("Sender: ", hud_hex(sender)));
+ *
+ * A buffer is reused for every line, format() starts it over. The returned
+ * pointer stays valid until the next format() of the same buffer.
+ */
+#pragma once
+
+#include <Arduino.h>
+
+// format() argument printed in hexadecimal, as String(value, HEX)
+struct HudHex {
+  uint32_t value;
+};
+
+// format() argument printed with a fixed number of decimals
+struct HudFixed {
+  double value;
+  uint8_t digits;
+};
+
+inline HudHex hud_hex(uint32_t value) { return {value}; }
+
+inline HudFixed hud_fixed(double value, uint8_t digits) {
+  return {value, digits};
+}
+
+template <size_t N>
+class HudText : public Print {
+ public:
+  HudText() { clear(); }
+
+  size_t write(uint8_t c) override {
+    if (used + 1 >= N) {
+      cut = true;
+      return 0;
+    }
+    buffer[used++] = c;
+    buffer[used] = '\0';
+    return 1;
+  }
+
+  size_t write(const uint8_t* data, size_t size) override {
+    size_t room = N - 1 - used;
+    if (size > room) {
+      size = room;
+      cut = true;
+    }
+    memcpy(buffer + used, data, size);
+    used += size;
+    buffer[used] = '\0';
+    return size;
+  }
+  using Print::write;
+
+  void clear() {
+    used = 0;
+    buffer[0] = '\0';
+    cut = false;
+  }
+
+  /**
+   * Replaces the text by the arguments printed one after another and
+   * returns it. Arguments are anything Print prints, hud_hex() and
+   * hud_fixed().
+   */
+  template <typename... Args>
+  const char* format(const Args&... args) {
+    clear();
+    return append(args...);
+  }
+
+  // appends the arguments to the text, see format()
+  template <typename... Args>
+  const char* append(const Args&... args) {
+    add(args...);
+    return buffer;
+  }
+
+  const char* c_str() const { return buffer; }
+  size_t length() const { return used; }
+  // text was cut off since the last format() or clear()
+  bool truncated() const { return cut; }
+
+ private:
+  char buffer[N];
+  size_t used;
+  bool cut;
+
+  void add() {}
+
+  template <typename T, typename... Rest>
+  void add(const T& first, const Rest&... rest) {
+    put(first);
+    add(rest...);
+  }
+
+  void put(const HudHex& value) { print(value.value, HEX); }
+  void put(const HudFixed& value) { print(value.value, value.digits); }
+
+  template <typename T>
+  void put(const T& value) {
+    print(value);
+  }
+};
@@ -0,0 +1,262 @@
+/**
+ * Heap soak of HudText: the labels and status lines of a display frame,
+ * formatted over and over as loop() does during a workshop day, allocate
+ * nothing, and the largest free block of the heap stays the same.
+ *
+ * operator new and delete are replaced by a first-fit heap in a fixed
+ * arena, as small as the free heap of a busy board, that counts the
+ * allocations and tells the largest free block. The same frame built from
+ * String concatenations, as the firmwares did before, runs against it for
+ * comparison. The lines are printed to a sink that keeps no copy, the
+ * Serial fake would allocate for its output.
+ */
+#include <Arduino.h>
+#include <HudText.h>
+#include <unity.h>
+
+#include <cstdlib>
+#include <new>
+
+#define SOAK_FRAMES 100000
+#define ARENA_SIZE 16384  // bytes
+
+/**
+ * First-fit heap in a fixed arena. Each block starts with its size and
+ * state, free neighbours are merged on free.
+ */
+struct FakeHeap {
+  struct Block {
+    uint32_t size;  // bytes, with this header
+    bool free;
+  };
+
+  alignas(16) uint8_t arena[ARENA_SIZE];
+  bool tracking = false;
+  uint32_t allocations = 0;
+  uint32_t frees = 0;
+
+  void reset() {
+    Block* first = (Block*)arena;
+    first->size = ARENA_SIZE;
+    first->free = true;
+    allocations = 0;
+    frees = 0;
+  }
+
+  bool owns(void* p) const {
+    return p >= arena && p < arena + ARENA_SIZE;
+  }
+
+  void* allocate(size_t size) {
+    uint32_t need = (sizeof(Block) + size + 15) & ~15u;
+    for (uint32_t at = 0; at < ARENA_SIZE;) {
+      Block* block = (Block*)(arena + at);
+      if (block->free && block->size >= need) {
+        if (block->size - need >= 32) {
+          Block* rest = (Block*)(arena + at + need);
+          rest->size = block->size - need;
+          rest->free = true;
+          block->size = need;
+        }
+        block->free = false;
+        allocations++;
+        return block + 1;
+      }
+      at += block->size;
+    }
+    return nullptr;
+  }
+
+  void release(void* p) {
+    ((Block*)p - 1)->free = true;
+    frees++;
+    for (uint32_t at = 0; at < ARENA_SIZE;) {
+      Block* block = (Block*)(arena + at);
+      Block* next = (Block*)(arena + at + block->size);
+      if (block->free && at + block->size < ARENA_SIZE && next->free) {
+        block->size += next->size;
+      } else {
+        at += block->size;
+      }
+    }
+  }
+
+  // bytes, as ESP.getMaxAllocHeap()
+  uint32_t largestFree() const {
+    uint32_t largest = 0;
+    for (uint32_t at = 0; at < ARENA_SIZE;) {
+      const Block* block = (const Block*)(arena + at);
+      if (block->free && block->size - sizeof(Block) > largest) {
+        largest = block->size - sizeof(Block);
+      }
+      at += block->size;
+    }
+    return largest;
+  }
+};
+
+static FakeHeap heap;
+
+void* operator new(size_t size) {
+  void* p = heap.tracking ? heap.allocate(size) : malloc(size);
+  if (p == nullptr) throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void* p) noexcept {
+  if (heap.owns(p)) {
+    heap.release(p);
+  } else {
+    free(p);
+  }
+}
+
+void operator delete(void* p, size_t) noexcept { operator delete(p); }
+
+// takes the text of a line without keeping it
+class NullPrint : public Print {
+ public:
+  uint32_t bytes = 0;
+
+  size_t write(uint8_t c) override {
+    bytes++;
+    return 1;
+  }
+};
+
+static NullPrint out;
+
+// the values of a frame, changing as on the board
+struct FrameValues {
+  uint32_t wait;
+  int percent;
+  float vbat;
+  byte sender;
+  float rssi;
+  float snr;
+  double lat;
+  double lng;
+  float frequency;
+};
+
+static FrameValues values(uint32_t frame) {
+  return {frame * 37 % 60000,
+          (int)(frame % 101),
+          3.3f + (frame % 90) / 100.0f,
+          (byte)(frame * 7),
+          -60.0f - (frame % 600) / 10.0f,
+          -20.0f + (frame % 300) / 10.0f,
+          52.5172670 + (frame % 1000) * 1e-7,
+          13.4015188 - (frame % 1000) * 1e-7,
+          frame % 2 ? 869.525f : 868.3f};
+}
+
+struct SoakResult {
+  uint32_t allocations;
+  uint32_t largestBefore;
+  uint32_t largestMin;
+  uint32_t largestAfter;
+};
+
+static SoakResult soak(void (*render)(const FrameValues&)) {
+  heap.reset();
+  SoakResult result;
+  heap.tracking = true;
+  result.largestBefore = heap.largestFree();
+  result.largestMin = result.largestBefore;
+  for (uint32_t frame = 0; frame < SOAK_FRAMES; frame++) {
+    render(values(frame));
+    if (frame % 100 == 0) {
+      uint32_t largest = heap.largestFree();
+      if (largest < result.largestMin) result.largestMin = largest;
+    }
+  }
+  result.largestAfter = heap.largestFree();
+  result.allocations = heap.allocations;
+  heap.tracking = false;
+  return result;
+}
+
+static HudText<24> label_text;
+static HudText<160> log_text;
+
+static void renderHudText(const FrameValues& v) {
+  out.print(label_text.format("LORA DC ", v.wait / 1000, "s"));
+  out.print(label_text.format("Bat ", v.percent, "% ", v.vbat, "V"));
+  out.print(label_text.format("Sender: ", hud_hex(v.sender)));
+  out.print(label_text.format(hud_fixed(v.frequency, 3), "MHz"));
+  out.println(log_text.format("Sender: ", hud_hex(v.sender), ", RSSI ",
+                              v.rssi, " dBm, SNR ", v.snr, " dB, at ",
+                              hud_fixed(v.lat, 5), ",", hud_fixed(v.lng, 5)));
+}
+
+// the last received line, kept as the firmwares kept their messages
+static String last_line;
+
+static void renderString(const FrameValues& v) {
+  out.print(String("LORA DC ") + String(v.wait / 1000) + "s");
+  out.print(String("Bat ") + String(v.percent) + "% " + String(v.vbat) + "V");
+  out.print(String("Sender: ") + String(v.sender, HEX));
+  out.print(String(v.frequency, 3) + "MHz");
+  String line = String("Sender: ") + String(v.sender, HEX) + ", RSSI " +
+                String(v.rssi) + " dBm, SNR " + String(v.snr) + " dB, at " +
+                String(v.lat, 5) + "," + String(v.lng, 5);
+  out.println(line);
+  last_line = line;
+}
+
+static void report(const char* name, const SoakResult& result) {
+  char line[160];
+  snprintf(line, sizeof(line),
+           "%s: %u frames, %u allocations (%.1f per frame), largest free "
+           "block %u B before, %u B lowest, %u B after",
+           name, SOAK_FRAMES, (unsigned)result.allocations,
+           (double)result.allocations / SOAK_FRAMES,
+           (unsigned)result.largestBefore, (unsigned)result.largestMin,
+           (unsigned)result.largestAfter);
+  TEST_MESSAGE(line);
+}
+
+void setUp() { out.bytes = 0; }
+
+void tearDown() {}
+
+void test_hud_text_allocates_nothing() {
+  SoakResult result = soak(renderHudText);
+  report("HudText", result);
+
+  TEST_ASSERT_EQUAL(0, result.allocations);
+  TEST_ASSERT_EQUAL(result.largestBefore, result.largestMin);
+  TEST_ASSERT_EQUAL(result.largestBefore, result.largestAfter);
+  TEST_ASSERT_FALSE(label_text.truncated());
+  TEST_ASSERT_FALSE(log_text.truncated());
+}
+
+void test_string_allocates_per_frame() {
+  SoakResult result = soak(renderString);
+  report("String", result);
+
+  // the tracker sees the temporaries it replaced
+  TEST_ASSERT_GREATER_OR_EQUAL(SOAK_FRAMES, result.allocations);
+  TEST_ASSERT_LESS_THAN(result.largestBefore, result.largestMin);
+}
+
+void test_same_output() {
+  NullPrint hud;
+  for (uint32_t frame = 0; frame < 1000; frame++) {
+    out.bytes = 0;
+    renderHudText(values(frame));
+    hud.bytes = out.bytes;
+    out.bytes = 0;
+    renderString(values(frame));
+    TEST_ASSERT_EQUAL(out.bytes, hud.bytes);
+  }
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_hud_text_allocates_nothing);
+  RUN_TEST(test_string_allocates_per_frame);
+  RUN_TEST(test_same_output);
+  return UNITY_END();
+}
@@ -0,0 +1,121 @@
+/**
+ * Formatting of HudText: the same text as the String concatenations it
+ * replaced in the firmwares, append(), hud_hex() and hud_fixed(), and
+ * the cut at the buffer size.
+ */
+#include <Arduino.h>
+#include <HudText.h>
+#include <unity.h>
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_format_matches_string() {
+  HudText<40> text;
+  uint32_t wait = 12345;
+  int percent = 87;
+  float vbat = 3.9172;
+  byte sender = 0x3C;
+
+  TEST_ASSERT_EQUAL_STRING(
+      (String("LORA DC ") + String(wait / 1000) + "s").c_str(),
+      text.format("LORA DC ", wait / 1000, "s"));
+  TEST_ASSERT_EQUAL_STRING(
+      (String("Bat ") + String(percent) + "% " + String(vbat) + "V").c_str(),
+      text.format("Bat ", percent, "% ", vbat, "V"));
+  TEST_ASSERT_EQUAL_STRING(
+      (String("Sender: ") + String(sender, HEX)).c_str(),
+      text.format("Sender: ", hud_hex(sender)));
+  TEST_ASSERT_EQUAL_STRING("RSSI -104.50 dBm, SNR -7.25 dB",
+                           text.format("RSSI ", -104.5, " dBm, SNR ", -7.25,
+                                       " dB"));
+  TEST_ASSERT_EQUAL_STRING("x", text.format('x'));
+  TEST_ASSERT_EQUAL_STRING("Hello", text.format(String("Hello")));
+}
+
+void test_format_starts_over() {
+  HudText<40> text;
+  text.format("a long first line");
+  TEST_ASSERT_EQUAL_STRING("short", text.format("short"));
+  TEST_ASSERT_EQUAL(5, text.length());
+  TEST_ASSERT_EQUAL_STRING("", text.format());
+  TEST_ASSERT_EQUAL(0, text.length());
+}
+
+void test_append() {
+  HudText<40> text;
+  text.format("Answers: ", 3);
+  TEST_ASSERT_EQUAL_STRING("Answers: 3, 1 merged",
+                           text.append(", ", 1, " merged"));
+  TEST_ASSERT_EQUAL_STRING("Answers: 3, 1 merged", text.c_str());
+  TEST_ASSERT_EQUAL(20, text.length());
+}
+
+void test_hud_hex() {
+  HudText<40> text;
+  TEST_ASSERT_EQUAL_STRING("FF", text.format(hud_hex(0xFF)));
+  // no leading zero, like String(value, HEX)
+  TEST_ASSERT_EQUAL_STRING("A", text.format(hud_hex(0x0A)));
+  TEST_ASSERT_EQUAL_STRING("DEADBEEF", text.format(hud_hex(0xDEADBEEF)));
+  TEST_ASSERT_EQUAL_STRING("0", text.format(hud_hex(0)));
+}
+
+void test_hud_fixed() {
+  HudText<40> text;
+  TEST_ASSERT_EQUAL_STRING("869.525", text.format(hud_fixed(869.525, 3)));
+  TEST_ASSERT_EQUAL_STRING("48.13704",
+                           text.format(hud_fixed(48.137039, 5)));
+  TEST_ASSERT_EQUAL_STRING("-11.58", text.format(hud_fixed(-11.5753, 2)));
+  TEST_ASSERT_EQUAL_STRING("3", text.format(hud_fixed(2.6, 0)));
+  TEST_ASSERT_EQUAL_STRING("250.0kHz",
+                           text.format(hud_fixed(250.0, 1), "kHz"));
+}
+
+void test_truncated() {
+  HudText<8> text;
+  // 7 chars and the '\0'
+  TEST_ASSERT_EQUAL_STRING("1234567", text.format("1234567"));
+  TEST_ASSERT_FALSE(text.truncated());
+
+  TEST_ASSERT_EQUAL_STRING("1234567", text.format("12345678"));
+  TEST_ASSERT_TRUE(text.truncated());
+  TEST_ASSERT_EQUAL(7, text.length());
+
+  // char by char through write(uint8_t) and numbers alike
+  TEST_ASSERT_EQUAL_STRING("abc1234", text.format("abc", 123456789));
+  TEST_ASSERT_TRUE(text.truncated());
+  TEST_ASSERT_EQUAL_STRING("abc1234", text.append("more"));
+  text.format("abcdefg");
+  TEST_ASSERT_EQUAL_STRING("abcdefg", text.append('h'));
+  TEST_ASSERT_TRUE(text.truncated());
+
+  // format() and clear() reset the flag
+  text.format("ok");
+  TEST_ASSERT_FALSE(text.truncated());
+  text.format("12345678");
+  text.clear();
+  TEST_ASSERT_FALSE(text.truncated());
+  TEST_ASSERT_EQUAL_STRING("", text.c_str());
+}
+
+void test_print_into() {
+  // a HudText is a Print, e.g. for the stats printers
+  HudText<40> text;
+  text.print("Display: ");
+  text.print(10);
+  text.println(" fps");
+  TEST_ASSERT_EQUAL_STRING("Display: 10 fps\r\n", text.c_str());
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_format_matches_string);
+  RUN_TEST(test_format_starts_over);
+  RUN_TEST(test_append);
+  RUN_TEST(test_hud_hex);
+  RUN_TEST(test_hud_fixed);
+  RUN_TEST(test_truncated);
+  RUN_TEST(test_print_into);
+  return UNITY_END();
+}
@@ -0,0 +1,178 @@
+/**
+ * @file LoRaDutyCycle.h
+ * @brief Airtime budget of the EU 868 MHz SRD sub-bands.
+ *
+ * The duty cycle limits of the sub-bands apply to the airtime within any one
+ * hour. LoRaAirtimeBudget keeps the airtime of the last hour per sub-band in
+ * one-minute buckets and tells when the remaining budget covers the next frame.
+ *
+ * For the German frequency bands and restrictions consult:
+ * https://www.bundesnetzagentur.de/SharedDocs/Downloads/DE/Sachgebiete/Telekommunikation/Unternehmen_Institutionen/Frequenzen/Allgemeinzuteilungen/FunkanlagenGeringerReichweite/2018_05_SRD_pdf.pdf?__blob=publicationFile&v=7
+ */
+#pragma once
+
+#include <Arduino.h>
+#include <RadioLib.h>
+
+/**
+ * Sub-band with its duty cycle limit in 1/1000 (10 == 1 %).
+ */
+struct LoRaBand {
+  float low;           // MHz
+  float high;          // MHz
+  uint16_t dutyCycle;  // permille
+  const char* name;
+};
+
+static const LoRaBand LORA_BANDS[] = {
+    {863.0, 865.0, 1, "863-865"},      {865.0, 868.0, 10, "865-868"},
+    {868.0, 868.6, 10, "868.0-868.6"}, {868.7, 869.2, 1, "868.7-869.2"},
+    {869.4, 869.65, 100, "869.4-869.65"}, {869.7, 870.0, 10, "869.7-870"},
+};
+#define LORA_BAND_COUNT (sizeof(LORA_BANDS) / sizeof(LORA_BANDS[0]))
+
+// any other frequency gets the strictest limit
+static const LoRaBand LORA_BAND_OTHER = {0.0, 0.0, 1, "other"};
+
+/**
+ * Time-on-air in us of a LoRa frame with explicit header, see the SX1276/
+ * SX1262 datasheets. Unlike Radio::getTimeOnAir() this works for any
+ * setting, not only the one the radio is configured to.
+ */
+inline RadioLibTime_t lora_time_on_air(size_t length, uint8_t spreadingFactor,
+                                       float bandwidth, uint8_t codingRate,
+                                       bool crc = false,
+                                       uint16_t preambleLength = 8) {
+  float symbol = (float)(1UL << spreadingFactor) / bandwidth;  // ms
+  // low data rate optimization above 16 ms per symbol
+  int lowDataRate = symbol > 16.0 ? 1 : 0;
+  int bits = 8 * (int)length - 4 * spreadingFactor + 28 + (crc ? 16 : 0);
+  int divisor = 4 * (spreadingFactor - 2 * lowDataRate);
+  int symbols = 8;
+  if (bits > 0) {
+    symbols += ((bits + divisor - 1) / divisor) * codingRate;
+  }
+  return (RadioLibTime_t)(((preambleLength + 4.25) + symbols) * symbol * 1000);
+}
+
+class LoRaAirtimeBudget {
+ public:
+  // sliding window of one hour: 60 full minutes plus the current one, so a
+  // bucket only drops out once all of its airtime is older than an hour
+  static const uint8_t BUCKETS = 61;
+  static const RadioLibTime_t BUCKET_LENGTH = 60000;  // ms
+
+  /**
+   * Selects the sub-band of the given carrier frequency, its airtime of the
+   * last hour is kept when switching back and forth.
+   */
+  void select(float frequency) { current = bandIndex(frequency); }
+
+  const LoRaBand& band() const { return bandAt(current); }
+
+  // ms of airtime per hour
+  RadioLibTime_t budget() const { return budgetOf(current); }
+
+  // ms of airtime used within the last hour
+  RadioLibTime_t used(RadioLibTime_t now) const { return usedOf(current, now); }
+
+  /**
+   * Milliseconds until the budget covers a frame of the given airtime (ms).
+   * Frames longer than the whole budget never fit, see fits().
+   */
+  RadioLibTime_t wait(RadioLibTime_t airtime, RadioLibTime_t now) const {
+    return waitOf(current, airtime, now);
+  }
+
+  // same for the sub-band of another frequency, e.g. to plan a hop
+  RadioLibTime_t wait(float frequency, RadioLibTime_t airtime,
+                      RadioLibTime_t now) const {
+    return waitOf(bandIndex(frequency), airtime, now);
+  }
+
+  // ms of airtime left within the last hour in the sub-band of a frequency
+  RadioLibTime_t headroom(float frequency, RadioLibTime_t now) const {
+    uint8_t index = bandIndex(frequency);
+    RadioLibTime_t usedTime = usedOf(index, now);
+    return usedTime < budgetOf(index) ? budgetOf(index) - usedTime : 0;
+  }
+
+  bool fits(RadioLibTime_t airtime) const { return airtime <= budget(); }
+
+  // books the airtime (ms) of a started frame
+  void consume(RadioLibTime_t airtime, RadioLibTime_t now) {
+    Account& account = accounts[current];
+    RadioLibTime_t minute = now / BUCKET_LENGTH;
+    uint8_t i = minute % BUCKETS;
+    if (account.minute[i] != minute) {
+      account.minute[i] = minute;
+      account.airtime[i] = 0;
+    }
+    account.airtime[i] += airtime;
+  }
+
+ private:
+  struct Account {
+    // minute (millis() / BUCKET_LENGTH) of each bucket, ~0 marks it unused
+    RadioLibTime_t minute[BUCKETS];
+    RadioLibTime_t airtime[BUCKETS];  // ms
+
+    Account() {
+      for (uint8_t i = 0; i < BUCKETS; i++) {
+        minute[i] = ~(RadioLibTime_t)0;
+        airtime[i] = 0;
+      }
+    }
+  };
+
+  // one account per sub-band plus one for all other frequencies
+  Account accounts[LORA_BAND_COUNT + 1];
+  uint8_t current = LORA_BAND_COUNT;
+
+  static uint8_t bandIndex(float frequency) {
+    for (uint8_t i = 0; i < LORA_BAND_COUNT; i++) {
+      if (frequency >= LORA_BANDS[i].low && frequency <= LORA_BANDS[i].high) {
+        return i;
+      }
+    }
+    return LORA_BAND_COUNT;
+  }
+
+  static const LoRaBand& bandAt(uint8_t index) {
+    return index < LORA_BAND_COUNT ? LORA_BANDS[index] : LORA_BAND_OTHER;
+  }
+
+  static RadioLibTime_t budgetOf(uint8_t index) {
+    return bandAt(index).dutyCycle * 3600UL;
+  }
+
+  RadioLibTime_t usedOf(uint8_t index, RadioLibTime_t now) const {
+    const Account& account = accounts[index];
+    RadioLibTime_t minute = now / BUCKET_LENGTH;
+    RadioLibTime_t sum = 0;
+    for (uint8_t i = 0; i < BUCKETS; i++) {
+      if (minute - account.minute[i] < BUCKETS) sum += account.airtime[i];
+    }
+    return sum;
+  }
+
+  RadioLibTime_t waitOf(uint8_t index, RadioLibTime_t airtime,
+                        RadioLibTime_t now) const {
+    RadioLibTime_t usedTime = usedOf(index, now);
+    if (usedTime + airtime <= budgetOf(index)) return 0;
+
+    // walk the buckets from the oldest one until enough airtime drops out
+    const Account& account = accounts[index];
+    RadioLibTime_t minute = now / BUCKET_LENGTH;
+    RadioLibTime_t missing = usedTime + airtime - budgetOf(index);
+    for (RadioLibTime_t m = minute - (BUCKETS - 1); m != minute + 1; m++) {
+      uint8_t i = m % BUCKETS;
+      if (account.minute[i] != m) continue;
+      if (account.airtime[i] >= missing) {
+        return (m + BUCKETS) * BUCKET_LENGTH - now;
+      }
+      missing -= account.airtime[i];
+    }
+    return BUCKETS * BUCKET_LENGTH;
+  }
+};
@@ -0,0 +1,189 @@
+/**
+ * @file LoRaFrame.h
+ * @brief On-air frame formats of the ESP32+LoRa workshop.
+ *
+ * v1 (participant templates):
+ *   [recipient][sender][payload ... '\0']
+ *
+ * v2:
+ *   [recipient][sender][0xE2][type << 4 | flags][sequence][length][payload]
+ *
+ * The third byte of a v2 frame marks the version (0xE0 | 2). Together with
+ * the length byte matching the frame size, v1 frames are told apart without
+ * any further hint. The one v1 payload that reads as v2 header starts with
+ * 0xE2 (e.g. the UTF-8 of a leading '€' or '–') and has its 4th byte equal
+ * to the number of bytes behind it, see lora_v1_ambiguous(). LoRaLink
+ * refuses to send it as v1, other v1 senders must avoid it as well.
+ */
+#pragma once
+
+#include <Arduino.h>
+
+// v1 frame layout: {recipient, sender} header, followed by the payload
+#define LORA_HEADER_SIZE 2
+#define LORA_MAX_PAYLOAD_SIZE 253
+
+#define LORA_BROADCAST_ADDRESS 0xFF
+
+// v2 frame layout: {recipient, sender, marker, type/flags, seq, length}
+#define LORA_V2_HEADER_SIZE 6
+#define LORA_V2_MARKER 0xE2
+#define LORA_MAX_FRAME_SIZE 255
+
+// message types of v2 frames (4 bit)
+#define LORA_MSG_TEXT 0x0
+#define LORA_MSG_REQUEST 0x1
+#define LORA_MSG_ANSWER 0x2
+#define LORA_MSG_HOP 0x3
+
+/**
+ * Returns true if a v1 payload would be parsed as v2 frame, see above.
+ */
+inline bool lora_v1_ambiguous(const byte* payload, size_t size) {
+  return size >= LORA_V2_HEADER_SIZE - LORA_HEADER_SIZE &&
+         payload[0] == LORA_V2_MARKER &&
+         payload[3] == size - (LORA_V2_HEADER_SIZE - LORA_HEADER_SIZE);
+}
+
+/**
+ * A received frame. The payload points into the receive buffer, so the frame
+ * is only valid as long as the buffer is.
+ */
+struct LoRaFrame {
+  byte recipient;
+  byte sender;
+  uint8_t version;  // 1 or 2
+  uint8_t type;     // LORA_MSG_*, LORA_MSG_TEXT for v1 frames
+  uint8_t flags;    // 4 bit, application defined, 0 for v1 frames
+  uint8_t seq;      // 0 for v1 frames
+  const byte* payload;
+  size_t length;  // payload bytes, without the '\0' of v1 frames
+};
+
+/**
+ * Splits a received frame into header and payload. Returns false for frames
+ * too short to carry a header.
+ */
+inline bool lora_parse_frame(const byte* data, size_t size, LoRaFrame& frame) {
+  if (size < LORA_HEADER_SIZE) {
+    return false;
+  }
+  frame.recipient = data[0];
+  frame.sender = data[1];
+
+  if (size >= LORA_V2_HEADER_SIZE && data[2] == LORA_V2_MARKER &&
+      data[5] == size - LORA_V2_HEADER_SIZE) {
+    frame.version = 2;
+    frame.type = data[3] >> 4;
+    frame.flags = data[3] & 0x0F;
+    frame.seq = data[4];
+    frame.payload = data + LORA_V2_HEADER_SIZE;
+    frame.length = data[5];
+    return true;
+  }
+
+  frame.version = 1;
+  frame.type = LORA_MSG_TEXT;
+  frame.flags = 0;
+  frame.seq = 0;
+  frame.payload = data + LORA_HEADER_SIZE;
+  frame.length = size - LORA_HEADER_SIZE;
+  // drop the '\0' termination of String payloads
+  if (frame.length > 0 && frame.payload[frame.length - 1] == '\0') {
+    frame.length--;
+  }
+  return true;
+}
+
+/**
+ * Returns the payload as String, without relying on a '\0' termination.
+ */
+inline String lora_frame_text(const LoRaFrame& frame) {
+  String text;
+  text.concat((const char*)frame.payload, frame.length);
+  return text;
+}
+
+/**
+ * Compares the payload to a '\0' terminated text, without copying it into a
+ * String first.
+ */
+inline bool lora_frame_text_equals(const LoRaFrame& frame, const char* text) {
+  return strlen(text) == frame.length &&
+         memcmp(frame.payload, text, frame.length) == 0;
+}
+
+// a sender silent for this long that goes back in its sequence restarted
+#ifndef LORA_SEQ_RESTART_GAP
+#define LORA_SEQ_RESTART_GAP 1000  // ms
+#endif
+
+/**
+ * Duplicate filter for v2 frames: per sender, the highest sequence number seen
+ * and a bitmap of the 32 numbers before it. accept() is O(1) and needs no
+ * history of the messages themselves.
+ *
+ * A sender starts its sequence at a random number after a reboot, which may
+ * fall just behind the last one seen. So a step back only counts as late
+ * frame or duplicate while frames of the sender keep coming, within
+ * LORA_SEQ_RESTART_GAP. A step back after a pause, or one beyond the
+ * window, starts the entry over.
+ */
+class LoRaSeqWindow {
+ public:
+  /**
+   * Returns false if the sequence number was already seen from this sender.
+   */
+  bool accept(byte sender, uint8_t seq) {
+    Entry& entry = entries[sender];
+    uint32_t now = millis();
+    uint32_t silent = now - entry.time;
+    entry.time = now;
+    if (!entry.valid) {
+      entry.valid = true;
+      restart(entry, seq);
+      return true;
+    }
+
+    uint8_t ahead = seq - entry.last;
+    if (ahead == 0) {
+      return false;
+    }
+    if (ahead < 128) {
+      // newer frame, slide the window
+      entry.seen = ahead < 32 ? (entry.seen << ahead) | 1 : 1;
+      entry.last = seq;
+      return true;
+    }
+
+    uint8_t behind = entry.last - seq;
+    if (behind < 32 && silent < LORA_SEQ_RESTART_GAP) {
+      // late frame within the window
+      uint32_t bit = 1UL << behind;
+      if (entry.seen & bit) {
+        return false;
+      }
+      entry.seen |= bit;
+      return true;
+    }
+
+    // back after a pause or far behind the window: the sender restarted
+    restart(entry, seq);
+    return true;
+  }
+
+ private:
+  struct Entry {
+    uint8_t last;
+    bool valid;
+    uint32_t seen;  // bit n: sequence number last - n was seen
+    uint32_t time;  // ms, millis() of the last frame
+  };
+
+  static void restart(Entry& entry, uint8_t seq) {
+    entry.last = seq;
+    entry.seen = 1;
+  }
+
+  Entry entries[256] = {};
+};
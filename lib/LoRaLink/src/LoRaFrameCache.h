@@ -0,0 +1,159 @@
+/**
+ * @file LoRaFrameCache.h
+ * @brief Cache of encoded frames for repeated transmissions.
+ *
+ * The level devices send the same messages again and again. A cached frame
+ * holds the encoded header and payload, keyed by recipient, message id and
+ * rotation (e.g. the part of a fragmented message). LoRaLink::encodeFrame()
+ * fills an entry once, LoRaLink::sendCached() queues a pointer to it, so a
+ * repeated send neither formats nor copies the payload.
+ */
+#pragma once
+
+#include <Arduino.h>
+
+#include <atomic>
+
+#include "LoRaFrame.h"
+
+/**
+ * An encoded frame. The sequence number of v2 frames is written when the frame
+ * goes on air, so the same entry can be sent any number of times.
+ */
+struct LoRaCachedFrame {
+  byte recipient = 0;
+  uint8_t id = 0;        // application defined message id
+  uint8_t rotation = 0;  // application defined variant of the message
+  uint8_t version = 1;   // frame format, 1 or 2
+  bool valid = false;
+  // sends waiting in the TX queue, pins the entry. Incremented by
+  // sendCached() and decremented by startQueued() when the frame goes to the
+  // radio, both in loop(); the TX timer only flags the frame as due.
+  std::atomic<uint8_t> queued{0};
+  size_t size = 0;  // header and payload
+  size_t capacity = 0;
+  byte* frame = nullptr;
+};
+
+/**
+ * Counters of a frame cache, with the time callers spent to get a frame
+ * queued on a hit (pointer handoff) and on a miss (formatting and encoding),
+ * and the free heap at the first recorded frame and now. A hit allocates
+ * nothing, so the free heap should not drop while only hits are recorded.
+ */
+struct LoRaFrameCacheStats {
+  uint32_t hits;
+  uint32_t misses;
+  uint32_t hitTime;   // us, total
+  uint32_t missTime;  // us, total
+  uint32_t heapBefore;     // bytes free at the first recorded frame
+  uint32_t minFreeBefore;  // lowest free heap at the first recorded frame
+  uint32_t heapAfter;      // bytes free now
+  uint32_t minFreeAfter;   // lowest free heap now
+
+  // prints the counters and the average time per frame
+  void print(Print& out) const {
+    out.print(hits);
+    out.print(" hits, avg ");
+    out.print(hits > 0 ? hitTime / hits : 0);
+    out.print("us/frame, ");
+    out.print(misses);
+    out.print(" misses, avg ");
+    out.print(misses > 0 ? missTime / misses : 0);
+    out.println("us/frame");
+    out.print("Heap: ");
+    out.print(heapAfter);
+    out.print(" bytes free (");
+    out.print(heapBefore);
+    out.print(" at first frame), min free ");
+    out.print(minFreeAfter);
+    out.print(" (");
+    out.print(minFreeBefore);
+    out.println(")");
+  }
+};
+
+/**
+ * N entries of up to SIZE bytes each, statically allocated. Entries are
+ * replaced round robin, skipping the ones still waiting in the TX queue.
+ */
+template <uint8_t N, size_t SIZE = LORA_MAX_FRAME_SIZE>
+class LoRaFrameCache {
+ public:
+  LoRaFrameCache() {
+    for (uint8_t i = 0; i < N; i++) {
+      entries[i].capacity = SIZE;
+      entries[i].frame = buffers[i];
+    }
+  }
+
+  /**
+   * Returns the entry of the key in the given frame format, or nullptr.
+   */
+  LoRaCachedFrame* find(byte recipient, uint8_t id, uint8_t rotation,
+                        uint8_t version) {
+    for (uint8_t i = 0; i < N; i++) {
+      LoRaCachedFrame& entry = entries[i];
+      if (entry.valid && entry.recipient == recipient && entry.id == id &&
+          entry.rotation == rotation && entry.version == version) {
+        return &entry;
+      }
+    }
+    return nullptr;
+  }
+
+  /**
+   * Returns an entry to encode a frame for the key into: the one of the key
+   * itself if present, otherwise the next one not waiting for transmission.
+   * Returns nullptr if all entries are queued.
+   */
+  LoRaCachedFrame* slotFor(byte recipient, uint8_t id, uint8_t rotation) {
+    for (uint8_t i = 0; i < N; i++) {
+      LoRaCachedFrame& entry = entries[i];
+      if (entry.valid && entry.recipient == recipient && entry.id == id &&
+          entry.rotation == rotation && entry.queued == 0) {
+        return &entry;
+      }
+    }
+    for (uint8_t tries = 0; tries < N; tries++) {
+      LoRaCachedFrame& entry = entries[next_victim];
+      next_victim = (next_victim + 1) % N;
+      if (entry.queued == 0) {
+        entry.valid = false;
+        entry.recipient = recipient;
+        entry.id = id;
+        entry.rotation = rotation;
+        return &entry;
+      }
+    }
+    return nullptr;
+  }
+
+  // time to get a frame queued, measured by the caller
+  void record(bool hit, uint32_t time) {
+    if (stats.hits == 0 && stats.misses == 0) {
+      stats.heapBefore = ESP.getFreeHeap();
+      stats.minFreeBefore = ESP.getMinFreeHeap();
+    }
+    if (hit) {
+      stats.hits++;
+      stats.hitTime += time;
+    } else {
+      stats.misses++;
+      stats.missTime += time;
+    }
+  }
+
+  LoRaFrameCacheStats cacheStats() const {
+    LoRaFrameCacheStats current = stats;
+    current.heapAfter = ESP.getFreeHeap();
+    current.minFreeAfter = ESP.getMinFreeHeap();
+    return current;
+  }
+
+ private:
+  LoRaCachedFrame entries[N];
+  byte buffers[N][SIZE];
+  uint8_t next_victim = 0;
+  LoRaFrameCacheStats stats = {};
+};
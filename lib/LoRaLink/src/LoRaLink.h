@@ -0,0 +1,1406 @@
+/**
+ * @file LoRaLink.h
+ * @brief Shared LoRa link layer of the ESP32+LoRa workshop firmwares.
+ *
+ * Radio bring-up, the interrupt driven RX/TX state machine, the receive ring,
+ * the per sender link statistics (see LoRaSenderStats.h), the framed send
+ * helpers (see LoRaFrame.h and LoRaFrameCache.h), the transmit queue with
+ * optional listen before talk and the duty cycle gate (see LoRaDutyCycle.h),
+ * used by all level devices and example solutions. The radio chip and the
+ * pin map are template parameters, so each firmware only compiles the code
+ * paths of its own chip:
+ *
+ *   LoRaLink<SX1262, LoRaPins<SS, DIO1, RST_LoRa, BUSY_LoRa>> lora(0xC1);
+ *   LoRaLink<SX1276, LoRaPins<RADIO_CS_PIN, RADIO_DIO0_PIN, RADIO_RST_PIN,
+ *                             RADIO_DIO1_PIN>> lora(0x31);
+ *
+ * For the German frequency bands and restrictions consult:
+ * https://www.bundesnetzagentur.de/SharedDocs/Downloads/DE/Sachgebiete/Telekommunikation/Unternehmen_Institutionen/Frequenzen/Allgemeinzuteilungen/FunkanlagenGeringerReichweite/2018_05_SRD_pdf.pdf?__blob=publicationFile&v=7
+ */
+#pragma once
+
+#include <Arduino.h>
+#include <RadioLib.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <atomic>
+
+#include "LoRaDutyCycle.h"
+#include "LoRaFrame.h"
+#include "LoRaFrameCache.h"
+#include "LoRaSenderStats.h"
+
+/*
+ * 0 -> receive mode, received frames wait in the RX ring (see receive())
+ * 2 -> transmitting
+ * 3 -> transmission complete (transmit-only devices, listening devices are
+ *      back in receive mode right away, see txDone())
+ */
+#define LORA_STATE_RECEIVE 0
+#define LORA_STATE_TX 2
+#define LORA_STATE_TX_DONE 3
+
+// number of frames that can wait for transmission
+#ifndef LORA_TX_QUEUE_SIZE
+#define LORA_TX_QUEUE_SIZE 4
+#endif
+
+/*
+ * Listen before talk, see setListenBeforeTalk(): a frame that finds the
+ * channel busy is retried after a random backoff of up to its own airtime
+ * times 2^tries, at most LORA_LBT_MAX_BACKOFF. After LORA_LBT_MAX_TRIES busy
+ * checks it is sent anyway, so a jammed channel cannot stall the queue.
+ */
+#ifndef LORA_LBT_MAX_TRIES
+#define LORA_LBT_MAX_TRIES 5
+#endif
+#ifndef LORA_LBT_MAX_BACKOFF
+#define LORA_LBT_MAX_BACKOFF 2000  // ms
+#endif
+
+// longest timeout of the TX timer: the hourly airtime window of
+// LoRaAirtimeBudget, 61 one-minute buckets
+#define LORA_MAX_TX_WAIT 3660000UL  // ms
+
+// number of received frames that can wait for the application
+#ifndef LORA_RX_RING_SIZE
+#define LORA_RX_RING_SIZE 4
+#endif
+
+/*
+ * Interrupt events, as recorded by the ISR
+ * 0 -> RX done (interrupt in receive mode)
+ * 1 -> TX done (interrupt while transmitting)
+ * 2 -> interrupt while a completed transmission is still unhandled
+ */
+#define LORA_EVENT_RX_DONE 0
+#define LORA_EVENT_TX_DONE 1
+#define LORA_EVENT_UNHANDLED 2
+
+// number of interrupt events that can wait for the consumer
+#ifndef LORA_EVENT_RING_SIZE
+#define LORA_EVENT_RING_SIZE 8
+#endif
+
+#define LORA_HISTOGRAM_BUCKETS 16
+
+/**
+ * Pin map of the radio module: chip select, interrupt (DIO1 on the SX126x,
+ * DIO0 on the SX127x), reset and gpio pin (BUSY on the SX126x, DIO1 on the
+ * SX127x). The SX127x signals a detected preamble on DIO1, with another pin
+ * there scanChannel() reports a free channel on every check.
+ */
+template <uint32_t CS, uint32_t IRQ, uint32_t RST, uint32_t GPIO>
+struct LoRaPins {
+  static const uint32_t cs = CS;
+  static const uint32_t irq = IRQ;
+  static const uint32_t rst = RST;
+  static const uint32_t gpio = GPIO;
+};
+
+/**
+ * LoRa settings applied by LoRaLink::begin().
+ */
+struct LoRaConfig {
+  float frequency;                   // MHz
+  float bandwidth;                   // kHz
+  uint8_t spreadingFactor;           //
+  uint8_t codingRate;                // 4/x
+  uint8_t syncWord;                  // not every sync word works!
+  int8_t outputPower;                // dBm
+  bool crc;                          //
+  RadioLibTime_t txInterval;         // ms, pause after each frame, 0 = none
+};
+
+/**
+ * Counters of the transmit queue. Gaps are measured between the TX done
+ * interrupt of a frame and the start of the next queued frame, the latency is
+ * the part of the gap beyond the duty cycle wait.
+ */
+struct LoRaTxStats {
+  uint32_t queued;        // frames accepted by sendFrame()
+  uint32_t sent;          // frames handed to the radio
+  uint32_t dropped;       // frames rejected because the queue was full
+  uint8_t depth;          // frames currently waiting
+  uint8_t maxDepth;       //
+  uint32_t lastGap;       // us
+  uint32_t maxGap;        // us
+  uint32_t lastLatency;   // us
+  uint32_t maxLatency;    // us
+};
+
+/**
+ * Counters of the receive path. Frames addressed to other devices are dropped
+ * after reading their header only, the savings are the payload bytes not read
+ * over SPI and the estimated time of the skipped full read. Overruns are
+ * frames for this device lost because the application left the RX ring full.
+ */
+struct LoRaRxStats {
+  uint32_t received;       // frames read in full
+  uint32_t rejected;       // frames dropped after the header peek
+  uint32_t spiBytesSaved;  // payload bytes not read
+  uint32_t cpuSaved;       // us
+  uint32_t overruns;       // frames dropped because the ring was full
+  uint8_t depth;           // frames currently waiting
+  uint8_t maxDepth;        //
+};
+
+/**
+ * Counters of listen before talk. Collisions can not be seen by the sender,
+ * the busy share of the checks shows how crowded the channel is and the
+ * forced sends how often a frame went out on a busy channel nonetheless.
+ */
+struct LoRaLbtStats {
+  uint32_t checks;   // channel activity detections
+  uint32_t busy;     // checks that found the channel busy
+  uint32_t forced;   // frames sent after LORA_LBT_MAX_TRIES busy checks
+  uint32_t backoff;  // ms, total backoff
+  uint32_t cadTime;  // us, total time of the checks
+};
+
+/**
+ * Time the radio of a listening device was out of receive mode, i.e. deaf to
+ * frames sent to it: from an RX done interrupt until the radio listens again,
+ * and from the start of each transmission until it listens again. Queued
+ * frames waiting for the duty cycle do not count, the radio listens between
+ * them. The CAD before a frame is in LoRaLbtStats::cadTime. Hours are counted
+ * from begin().
+ */
+struct LoRaBlindStats {
+  uint32_t rxTime;    // ms, handling receptions
+  uint32_t txTime;    // ms, transmitting
+  uint32_t rxGaps;    //
+  uint32_t txGaps;    //
+  uint32_t maxGap;    // us
+  uint32_t thisHour;  // ms, blind time of the current hour so far
+  uint32_t lastHour;  // ms, blind time of the last full hour
+};
+
+/**
+ * A received frame with its link quality, as taken from the radio right after
+ * the RX done interrupt. state is the result of the read, e.g.
+ * RADIOLIB_ERR_CRC_MISMATCH.
+ */
+struct LoRaRxFrame {
+  byte data[LORA_MAX_FRAME_SIZE];
+  size_t length;
+  int state;        //
+  float rssi;       // dBm
+  float snr;        // dB
+  uint32_t micros;  // time of the RX done interrupt
+};
+
+/**
+ * An interrupt of the radio. The ISR stays off the SPI bus, so the IRQ flags
+ * are read by the consumer when it takes the event from the ring.
+ */
+struct LoRaEvent {
+  uint8_t type;       // LORA_EVENT_*
+  uint32_t micros;    // time of the interrupt
+  uint32_t irqFlags;  // radio IRQ flags, see Radio::getIrqFlags()
+};
+
+/**
+ * Histogram of durations with power of two buckets: bucket 0 counts 0us,
+ * bucket n counts [2^(n-1), 2^n) us, the last bucket everything above.
+ * add() is cheap enough for the ISR.
+ */
+struct LoRaHistogram {
+  uint32_t counts[LORA_HISTOGRAM_BUCKETS];
+  uint32_t max;  // us
+
+  ICACHE_RAM_ATTR void add(uint32_t value) {
+    uint8_t bucket = value == 0 ? 0 : 32 - __builtin_clz(value);
+    if (bucket >= LORA_HISTOGRAM_BUCKETS) bucket = LORA_HISTOGRAM_BUCKETS - 1;
+    counts[bucket]++;
+    if (value > max) max = value;
+  }
+
+  // prints the non-empty buckets as "<upper bound>us:<count>"
+  void print(Print& out) const {
+    for (uint8_t i = 0; i < LORA_HISTOGRAM_BUCKETS; i++) {
+      if (counts[i] == 0) continue;
+      if (i == LORA_HISTOGRAM_BUCKETS - 1) {
+        out.print(">=");
+        out.print(1UL << (i - 1));
+      } else {
+        out.print("<");
+        out.print(1UL << i);
+      }
+      out.print("us:");
+      out.print(counts[i]);
+      out.print(" ");
+    }
+    out.print("max ");
+    out.print(max);
+    out.println("us");
+  }
+};
+
+/**
+ * Counters of the interrupt events. The ISR duration is measured in the ISR
+ * itself, the latency from the interrupt to the consumer taking the event.
+ */
+struct LoRaEventStats {
+  uint32_t events;   // events handled by the consumer
+  uint32_t dropped;  // events lost because the ring was full
+  LoRaHistogram isrDuration;
+  LoRaHistogram latency;
+};
+
+/**
+ * Counters of retune(). Only the settings that differ from the applied ones
+ * are written to the radio, a retune to the applied settings costs no SPI
+ * traffic at all.
+ */
+struct LoRaRetuneStats {
+  uint32_t retunes;    // calls of retune()
+  uint32_t unchanged;  // calls without any changed setting
+  uint32_t writes;     // settings written to the radio
+  uint32_t lastTime;   // us
+  uint32_t maxTime;    // us
+  uint32_t totalTime;  // us
+};
+
+/**
+ * Chip specific parts of the link, specialized for each supported radio.
+ */
+template <class Radio>
+struct LoRaChip;
+
+template <>
+struct LoRaChip<SX1262> {
+  static const char* name() { return "SX1262"; }
+
+  // DIO1 signals both RX done and TX done
+  static void setAction(SX1262& radio, void (*action)(void)) {
+    radio.setDio1Action(action);
+  }
+
+  // reads the first bytes of the received frame from the RX buffer
+  static int16_t peek(SX1262& radio, uint8_t* data, size_t length) {
+    Module* mod = radio.getMod();
+    // {payload length, RX start buffer pointer}
+    uint8_t status[2] = {0, 0};
+    int16_t state =
+        mod->SPIreadStream(RADIOLIB_SX126X_CMD_GET_RX_BUFFER_STATUS, status, 2);
+    if (state != RADIOLIB_ERR_NONE) {
+      return state;
+    }
+    uint8_t cmd[] = {RADIOLIB_SX126X_CMD_READ_BUFFER, status[1]};
+    return mod->SPIreadStream(cmd, 2, data, length);
+  }
+
+  // result of Radio::scanChannel() for a LoRa preamble on the channel
+  static bool channelBusy(int16_t cad) { return cad == RADIOLIB_LORA_DETECTED; }
+};
+
+template <>
+struct LoRaChip<SX1276> {
+  static const char* name() { return "SX1276"; }
+
+  // DIO0 is mapped to RX done in receive mode and to TX done while sending
+  static void setAction(SX1276& radio, void (*action)(void)) {
+    radio.setDio0Action(action, RISING);
+  }
+
+  // reads the first bytes of the received frame from the FIFO
+  static int16_t peek(SX1276& radio, uint8_t* data, size_t length) {
+    Module* mod = radio.getMod();
+    uint8_t start =
+        mod->SPIreadRegister(RADIOLIB_SX127X_REG_FIFO_RX_CURRENT_ADDR);
+    mod->SPIwriteRegister(RADIOLIB_SX127X_REG_FIFO_ADDR_PTR, start);
+    mod->SPIreadRegisterBurst(RADIOLIB_SX127X_REG_FIFO, length, data);
+    // rewind, so readData() gets the whole frame
+    mod->SPIwriteRegister(RADIOLIB_SX127X_REG_FIFO_ADDR_PTR, start);
+    return RADIOLIB_ERR_NONE;
+  }
+
+  // result of Radio::scanChannel() for a LoRa preamble on the channel
+  static bool channelBusy(int16_t cad) {
+    return cad == RADIOLIB_PREAMBLE_DETECTED;
+  }
+};
+
+template <class Radio, class Pins>
+class LoRaLink {
+ public:
+  typedef LoRaChip<Radio> Chip;
+
+  Radio radio;
+  byte localAddress;
+
+  explicit LoRaLink(byte address)
+      : radio(new Module(Pins::cs, Pins::irq, Pins::rst, Pins::gpio)),
+        localAddress(address) {}
+
+  /**
+   * Initializes the radio with the given settings and registers the interrupt.
+   * Starts listening unless listen is false (transmit-only devices). Halts on
+   * any invalid setting.
+   */
+  void begin(const LoRaConfig& config, bool listen = true) {
+    instance = this;
+    listening = listen;
+    // begin() runs in setup(), i.e. in the task that runs loop()
+    loop_task = xTaskGetCurrentTaskHandle();
+    txInterval = config.txInterval;
+    // random start, so receivers do not take the first frames after a
+    // restart for duplicates
+    lora_tx_seq = random(0, 256);
+    airtime.select(config.frequency);
+
+    // one-shot timer that sends the next queued frame after a TX done
+    const esp_timer_create_args_t timerArgs = {
+        .callback = onTxTimer,
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "lora_tx",
+        .skip_unhandled_events = false,
+    };
+    esp_timer_create(&timerArgs, &tx_timer);
+
+    Serial.print("[");
+    Serial.print(Chip::name());
+    Serial.print(F("] Initializing ... "));
+
+    int state = radio.begin();
+    if (state == RADIOLIB_ERR_NONE) {
+      Serial.println(F("success!"));
+    } else {
+      Serial.print(F("failed, code "));
+      Serial.println(state);
+      while (true);
+    }
+
+    /*
+     *   Sets carrier frequency.
+     *   SX1278/SX1276 : Allowed values range from 137.0 MHz to 525.0 MHz.
+     *   SX1268/SX1262 : Allowed values are in range from 150.0 to 960.0 MHz.
+     * * * */
+    if (radio.setFrequency(config.frequency) ==
+        RADIOLIB_ERR_INVALID_FREQUENCY) {
+      Serial.println(F("Selected frequency is invalid for this module!"));
+      while (true);
+    }
+
+    /*
+     *   Sets LoRa link bandwidth.
+     *   SX1278/SX1276 : Allowed values are 10.4, 15.6, 20.8, 31.25, 41.7,
+     * 62.5, 125, 250 and 500 kHz. Only available in %LoRa mode. SX1268/SX1262 :
+     * Allowed values are 7.8, 10.4, 15.6, 20.8, 31.25, 41.7, 62.5, 125.0, 250.0
+     * and 500.0 kHz.
+     * * * */
+    if (radio.setBandwidth(config.bandwidth) ==
+        RADIOLIB_ERR_INVALID_BANDWIDTH) {
+      Serial.println(F("Selected bandwidth is invalid for this module!"));
+      while (true);
+    }
+
+    /*
+     * Sets LoRa link spreading factor.
+     * SX1278/SX1276 :  Allowed values range from 6 to 12. Only available in
+     * LoRa mode. SX1262        :  Allowed values range from 5 to 12.
+     * * * */
+    if (radio.setSpreadingFactor(config.spreadingFactor) ==
+        RADIOLIB_ERR_INVALID_SPREADING_FACTOR) {
+      Serial.println(
+          F("Selected spreading factor is invalid for this module!"));
+      while (true);
+    }
+
+    /*
+     * Sets LoRa coding rate denominator.
+     * SX1278/SX1276/SX1268/SX1262 : Allowed values range from 5 to 8. Only
+     * available in LoRa mode.
+     * * * */
+    if (radio.setCodingRate(config.codingRate) ==
+        RADIOLIB_ERR_INVALID_CODING_RATE) {
+      Serial.println(F("Selected coding rate is invalid for this module!"));
+      while (true);
+    }
+
+    /*
+     * Sets LoRa sync word.
+     * SX1278/SX1276/SX1268/SX1262/SX1280 : Sets LoRa sync word. Only available
+     * in LoRa mode.
+     * * */
+    if (radio.setSyncWord(config.syncWord) != RADIOLIB_ERR_NONE) {
+      Serial.println(F("Unable to set sync word!"));
+      while (true);
+    }
+
+    /*
+     * Sets transmission output power.
+     * SX1278/SX1276 :  Allowed values range from +2 to +17 dBm (PA_BOOST pin).
+     * High power +20 dBm operation is also supported. Defaults to PA_BOOST.
+     * SX1262        :  Allowed values are in range from -9 to 22 dBm.
+     * * * */
+    if (radio.setOutputPower(config.outputPower) ==
+        RADIOLIB_ERR_INVALID_OUTPUT_POWER) {
+      Serial.println(F("Selected output power is invalid for this module!"));
+      while (true);
+    }
+
+    // Enables or disables CRC check of received packets.
+    if (radio.setCRC(config.crc) == RADIOLIB_ERR_INVALID_CRC_CONFIGURATION) {
+      Serial.println(F("Selected CRC is invalid for this module!"));
+      while (true);
+    }
+
+    // shadow of the applied settings for retune()
+    tuned_frequency = config.frequency;
+    tuned_bandwidth = config.bandwidth;
+    tuned_spreading_factor = config.spreadingFactor;
+
+    // set the function that will be called on RX done and TX done
+    Chip::setAction(radio, onInterrupt);
+    lora_state = LORA_STATE_RECEIVE;
+    lora_tx_available = true;
+
+    if (listen) {
+      // start listening for LoRa packets
+      Serial.print("[");
+      Serial.print(Chip::name());
+      Serial.print(F("] Starting to listen ... "));
+      lora_rx_state = radio.startReceive();
+      blind_hour_start = millis();
+      if (lora_rx_state == RADIOLIB_ERR_NONE) {
+        Serial.println(F("success!"));
+      } else {
+        Serial.print(F("failed, code "));
+        Serial.println(lora_rx_state);
+        while (true);
+      }
+    }
+  }
+
+  /**
+   * Puts the radio back into receive mode, e.g. after a handled reception or
+   * a completed transmission.
+   */
+  void listen() {
+    lora_state = LORA_STATE_RECEIVE;
+    lora_rx_state = radio.startReceive();
+    if (tx_blind) {
+      tx_blind = false;
+      addBlindTime(micros() - tx_blind_since, false);
+    }
+  }
+
+  /**
+   * Returns true once after the last queued frame is done. Listening devices
+   * are already back in receive mode then, there is no need to call listen().
+   */
+  bool txDone() {
+    handleEvents();
+    return lora_tx_done.exchange(false);
+  }
+
+  LoRaBlindStats blindStats() {
+    rollBlindHour();
+    LoRaBlindStats stats = blind_stats;
+    stats.rxTime = blind_rx_micros / 1000;
+    stats.txTime = blind_tx_micros / 1000;
+    stats.thisHour = blind_hour_micros / 1000;
+    return stats;
+  }
+
+  uint8_t state() {
+    handleEvents();
+    return lora_state;
+  }
+
+  // result of the last startTransmit()
+  int txState() const { return lora_tx_state; }
+
+  RadioLibTime_t transmissionEndTime() const {
+    return lora_transmission_end_time;
+  }
+
+  bool transmitAvailable() {
+    handleEvents();
+    if (lora_tx_available && dutyCycleAvailable())
+      return true;
+    else {
+      return false;
+    }
+  }
+
+  /**
+   * Checks the pause after the last frame and the airtime budget of the
+   * current sub-band for the next frame. Without a queued frame, the airtime
+   * of the last frame is taken as estimate.
+   */
+  bool dutyCycleAvailable() {
+    handleEvents();
+    if (lora_transmission_end_time + txInterval < millis()) {
+      lora_transmission_end_time = 0;
+    }
+    return dutyCycleWait() == 0;
+  }
+
+  /**
+   * Milliseconds until the duty cycle allows the next transmission.
+   */
+  RadioLibTime_t dutyCycleWait() const {
+    RadioLibTime_t now = millis();
+    RadioLibTime_t wait = 0;
+    if (lora_transmission_end_time != 0 &&
+        lora_transmission_end_time + txInterval >= now) {
+      wait = (lora_transmission_end_time + txInterval) - now;
+    }
+    RadioLibTime_t next = queueDepth() > 0
+                              ? tx_slots[tx_tail.load()].airtime
+                              : lora_last_airtime;
+    RadioLibTime_t budgetWait = airtime.wait(next, now);
+    return budgetWait > wait ? budgetWait : wait;
+  }
+
+  /**
+   * Sets the carrier frequency and switches the airtime budget to its
+   * sub-band.
+   */
+  int setFrequency(float frequency) {
+    int state = radio.setFrequency(frequency);
+    if (state == RADIOLIB_ERR_NONE) {
+      airtime.select(frequency);
+      tuned_frequency = frequency;
+    } else {
+      // unknown state of the radio, apply again on the next retune()
+      tuned_frequency = 0;
+    }
+    return state;
+  }
+
+  /**
+   * Switches frequency, bandwidth and spreading factor, writing only the
+   * settings that differ from the applied ones. Returns the error of the
+   * first failed setting, e.g. RADIOLIB_ERR_INVALID_BANDWIDTH, then all
+   * settings are applied again on the next call. Call listen() afterwards to
+   * receive with the new settings.
+   */
+  int retune(float frequency, float bandwidth, uint8_t spreadingFactor) {
+    uint32_t start = micros();
+    uint8_t writes = 0;
+    int state = RADIOLIB_ERR_NONE;
+
+    if (frequency != tuned_frequency) {
+      state = setFrequency(frequency);
+      writes++;
+    }
+    if (state == RADIOLIB_ERR_NONE && bandwidth != tuned_bandwidth) {
+      state = radio.setBandwidth(bandwidth);
+      tuned_bandwidth = bandwidth;
+      writes++;
+    }
+    if (state == RADIOLIB_ERR_NONE &&
+        spreadingFactor != tuned_spreading_factor) {
+      state = radio.setSpreadingFactor(spreadingFactor);
+      tuned_spreading_factor = spreadingFactor;
+      writes++;
+    }
+    if (state != RADIOLIB_ERR_NONE) {
+      // unknown state of the radio, apply everything on the next call
+      tuned_frequency = 0;
+      tuned_bandwidth = 0;
+      tuned_spreading_factor = 0;
+    }
+
+    uint32_t time = micros() - start;
+    retune_stats.retunes++;
+    retune_stats.writes += writes;
+    if (writes == 0) retune_stats.unchanged++;
+    retune_stats.lastTime = time;
+    retune_stats.totalTime += time;
+    if (time > retune_stats.maxTime) retune_stats.maxTime = time;
+    return state;
+  }
+
+  LoRaRetuneStats retuneStats() const { return retune_stats; }
+
+  const LoRaAirtimeBudget& airtimeBudget() const { return airtime; }
+
+  /**
+   * Returns the oldest received frame, or nullptr. Frames for other devices
+   * never get here. The frame stays valid until release(), the radio keeps
+   * receiving into the other slots of the ring meanwhile, so take the frames
+   * at any pace, one per loop() is fine.
+   */
+  const LoRaRxFrame* receive() {
+    handleEvents();
+    uint8_t tail = rx_tail.load(std::memory_order_relaxed);
+    if (tail == rx_head.load(std::memory_order_acquire)) {
+      return nullptr;
+    }
+    return &rx_slots[tail];
+  }
+
+  // frees the frame returned by receive() for the next reception
+  void release() {
+    uint8_t tail = rx_tail.load(std::memory_order_relaxed);
+    if (tail != rx_head.load(std::memory_order_acquire)) {
+      rx_tail.store((tail + 1) % LORA_RX_SLOTS, std::memory_order_release);
+    }
+  }
+
+  uint8_t rxDepth() const {
+    return (rx_head.load(std::memory_order_acquire) + LORA_RX_SLOTS -
+            rx_tail.load(std::memory_order_acquire)) %
+           LORA_RX_SLOTS;
+  }
+
+  LoRaRxStats rxStats() const {
+    LoRaRxStats stats = rx_stats;
+    stats.depth = rxDepth();
+    return stats;
+  }
+
+  /**
+   * Frame format of the following sends, 1 (default, understood by the
+   * participant templates) or 2 (with type, sequence number and length).
+   */
+  void setFrameVersion(uint8_t version) { frameVersion = version; }
+
+  uint8_t getFrameVersion() const { return frameVersion; }
+
+  /**
+   * Listen before talk: checks the channel with a channel activity detection
+   * right before each frame and backs off for a random time if another device
+   * is sending, instead of colliding and losing the frame and its airtime.
+   * Listening devices go back to receive mode during the backoff and between
+   * queued frames, only the frame itself and its CAD take the radio off the
+   * channel.
+   */
+  void setListenBeforeTalk(bool enable) { lbtEnabled = enable; }
+
+  LoRaLbtStats lbtStats() const { return lbt_stats; }
+
+  // largest payload of the current frame format
+  size_t maxPayloadSize() const {
+    return frameVersion == 2 ? LORA_MAX_FRAME_SIZE - LORA_V2_HEADER_SIZE
+                             : LORA_MAX_PAYLOAD_SIZE;
+  }
+
+  /**
+   * Returns the payload area of the next free queue slot. The header bytes of
+   * either frame format are reserved in front of it, so a payload written in
+   * place is sent with sendFrame() without any further copy.
+   */
+  byte* framePayload() {
+    return tx_slots[tx_head.load(std::memory_order_relaxed)].frame +
+           LORA_V2_HEADER_SIZE;
+  }
+
+  /**
+   * Queues the payload written into framePayload() for a specific recipient.
+   * The frame is sent right away if the link is idle, otherwise as soon as the
+   * previous frame is done and the duty cycle allows it. Returns false if the
+   * queue is full, or for a v1 payload that reads as v2 header (see
+   * lora_v1_ambiguous()). Type and flags are only sent in v2 frames.
+   */
+  bool sendFrame(size_t size, byte recipientAddress,
+                 uint8_t type = LORA_MSG_TEXT, uint8_t flags = 0) {
+    if (size > maxPayloadSize()) {
+      printPayloadExceeds(maxPayloadSize());
+      return false;
+    }
+    if (frameVersion == 1 && lora_v1_ambiguous(framePayload(), size)) {
+      printV1Ambiguous();
+      return false;
+    }
+
+    size_t headerSize =
+        frameVersion == 2 ? LORA_V2_HEADER_SIZE : LORA_HEADER_SIZE;
+    uint8_t head;
+    RadioLibTime_t frameAirtime;
+    if (!admit(headerSize + size, head, frameAirtime)) {
+      return false;
+    }
+
+    // fill in the header bytes reserved in front of the payload, a v1 header
+    // takes only the last two of them
+    TxSlot& slot = tx_slots[head];
+    slot.offset = LORA_V2_HEADER_SIZE - headerSize;
+    slot.cached = nullptr;
+    writeHeader(slot.frame + slot.offset, recipientAddress, type, flags, size);
+    if (frameVersion == 2) {
+      slot.frame[slot.offset + 4] = lora_tx_seq++;
+    }
+    slot.size = headerSize + size;
+    slot.airtime = frameAirtime;
+    enqueue(head);
+    return true;
+  }
+
+  /**
+   * Encodes a frame in the current frame format into a cache entry, see
+   * LoRaFrameCache. Returns false if it does not fit the entry.
+   */
+  bool encodeFrame(LoRaCachedFrame& entry, const byte payload[], size_t size,
+                   byte recipientAddress, uint8_t type = LORA_MSG_TEXT,
+                   uint8_t flags = 0) {
+    size_t headerSize =
+        frameVersion == 2 ? LORA_V2_HEADER_SIZE : LORA_HEADER_SIZE;
+    if (size > maxPayloadSize() || headerSize + size > entry.capacity) {
+      printPayloadExceeds(entry.capacity - headerSize);
+      entry.valid = false;
+      return false;
+    }
+    if (frameVersion == 1 && lora_v1_ambiguous(payload, size)) {
+      printV1Ambiguous();
+      entry.valid = false;
+      return false;
+    }
+
+    writeHeader(entry.frame, recipientAddress, type, flags, size);
+    memcpy(entry.frame + headerSize, payload, size);
+    entry.recipient = recipientAddress;
+    entry.version = frameVersion;
+    entry.size = headerSize + size;
+    entry.valid = true;
+    return true;
+  }
+
+  /**
+   * Queues a cached frame, like sendFrame() but without building or copying
+   * it: the queue holds a pointer to the entry until the frame is on air.
+   */
+  bool sendCached(LoRaCachedFrame& entry) {
+    if (!entry.valid) {
+      return false;
+    }
+    uint8_t head;
+    RadioLibTime_t frameAirtime;
+    if (!admit(entry.size, head, frameAirtime)) {
+      return false;
+    }
+
+    TxSlot& slot = tx_slots[head];
+    slot.cached = &entry;
+    slot.seq = lora_tx_seq++;
+    slot.size = entry.size;
+    slot.airtime = frameAirtime;
+    entry.queued++;
+    enqueue(head);
+    return true;
+  }
+
+  /**
+   * Starts the next queued frame if the link is idle and the duty cycle
+   * allows it. Frames queued behind a transmission are chained by the TX
+   * timer, which wakes loop() to send them in handleEvents(). Call this from
+   * loop() to pick up frames that waited for the duty cycle while the link
+   * was idle.
+   */
+  void poll() {
+    handleEvents();
+    // transmitting
+    if (lora_state == LORA_STATE_TX) {
+      return;
+    }
+    if (queueDepth() > 0 && transmitAvailable()) {
+      startQueued();
+    }
+  }
+
+  bool queueAvailable() const { return queueDepth() < LORA_TX_QUEUE_SIZE; }
+
+  uint8_t queueDepth() const {
+    return (tx_head.load(std::memory_order_acquire) + LORA_TX_SLOTS -
+            tx_tail.load(std::memory_order_acquire)) %
+           LORA_TX_SLOTS;
+  }
+
+  /**
+   * Takes the interrupt events recorded by the ISR and does the state
+   * transitions and logging for them, then sends the queued frame the TX
+   * timer is due for. Called by state(), poll() and the duty cycle checks, so
+   * loop() needs no extra call.
+   */
+  void handleEvents() {
+    uint8_t tail = event_tail.load(std::memory_order_relaxed);
+    while (tail != event_head.load(std::memory_order_acquire)) {
+      LoRaEvent event = events[tail];
+      tail = (tail + 1) % LORA_EVENT_SLOTS;
+      event_tail.store(tail, std::memory_order_release);
+
+      event.irqFlags = radio.getIrqFlags();
+      event_stats.events++;
+      event_stats.latency.add(micros() - event.micros);
+      handleEvent(event);
+    }
+
+    if (lora_tx_due.exchange(false)) {
+      startDue();
+    }
+  }
+
+  LoRaEventStats eventStats() const { return event_stats; }
+
+  /**
+   * Sleeps until the next radio interrupt or wake(), at most timeout ms.
+   * Replaces the delay() at the end of loop(): events are handled right away
+   * and the CPU idles in between. Build with LORA_POLL_LOOP to get the plain
+   * delay() back and compare the ISR-to-handler latency of eventStats().
+   */
+  void waitEvent(uint32_t timeout) {
+#ifdef LORA_POLL_LOOP
+    delay(timeout);
+#else
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(timeout));
+#endif
+  }
+
+  // ends the waitEvent() of loop(), e.g. from another task or a timer
+  void wake() {
+    if (loop_task != nullptr) {
+      xTaskNotifyGive(loop_task);
+    }
+  }
+
+  // ends the waitEvent() of loop() from an interrupt, e.g. of a button
+  ICACHE_RAM_ATTR void wakeFromISR() {
+    if (loop_task != nullptr) {
+      BaseType_t woken = pdFALSE;
+      vTaskNotifyGiveFromISR(loop_task, &woken);
+      if (woken) {
+        portYIELD_FROM_ISR();
+      }
+    }
+  }
+
+  LoRaTxStats txStats() const {
+    LoRaTxStats stats = tx_stats;
+    stats.depth = queueDepth();
+    return stats;
+  }
+
+  /**
+   * Sends a String payload to a specific recipient. v1 frames include the
+   * '\0' termination, v2 frames carry the length instead.
+   */
+  bool sendPacket(const String& payload, byte recipientAddress,
+                  uint8_t type = LORA_MSG_TEXT, uint8_t flags = 0) {
+    /*
+     * DO NOT USE sizeof(payload), as it will possibly return not the right
+     * length of the String! +1 because of '\0' termination of string
+     */
+    size_t payloadSize = payload.length() + (frameVersion == 2 ? 0 : 1);
+    if (payloadSize > maxPayloadSize()) {
+      printPayloadExceeds(maxPayloadSize());
+      return false;
+    }
+
+    // copy the String straight into the frame, behind the reserved header
+    payload.getBytes(framePayload(), payload.length() + 1);
+    return sendFrame(payloadSize, recipientAddress, type, flags);
+  }
+
+  /**
+   * Sends a byte payload to a specific recipient.
+   */
+  bool sendPacket(const byte payload[], size_t size, byte recipientAddress,
+                  uint8_t type = LORA_MSG_TEXT, uint8_t flags = 0) {
+    if (size > maxPayloadSize()) {
+      printPayloadExceeds(maxPayloadSize());
+      return false;
+    }
+
+    // payloads written in place via framePayload() need no copy at all
+    if (payload != framePayload()) {
+      memcpy(framePayload(), payload, size);
+    }
+    return sendFrame(size, recipientAddress, type, flags);
+  }
+
+ private:
+  static LoRaLink* instance;
+
+  // save transmission state between loops
+  int lora_tx_state = RADIOLIB_ERR_NONE;
+  int lora_rx_state = RADIOLIB_ERR_NONE;
+  // flag to indicate that transmit is available
+  volatile bool lora_tx_available = false;
+  volatile uint8_t lora_state = LORA_STATE_RECEIVE;
+  volatile RadioLibTime_t lora_transmission_end_time = 0;
+  RadioLibTime_t txInterval = 0;
+
+  uint8_t frameVersion = 1;
+  bool lbtEnabled = false;
+  // busy checks of the next frame to send, the oldest one in the queue
+  uint8_t lbt_tries = 0;
+  // set during a channel activity detection, its interrupt is not an event
+  volatile bool lora_cad = false;
+  LoRaLbtStats lbt_stats = {};
+  // sequence number of the next v2 frame
+  uint8_t lora_tx_seq = 0;
+
+  LoRaAirtimeBudget airtime;
+  RadioLibTime_t lora_last_airtime = 0;  // ms
+
+  // settings applied to the radio, 0 == unknown
+  float tuned_frequency = 0;
+  float tuned_bandwidth = 0;
+  uint8_t tuned_spreading_factor = 0;
+  LoRaRetuneStats retune_stats = {};
+
+  // transmit queue, single producer (sendFrame) and single consumer
+  // (startQueued, from poll() or handleEvents()), one slot always stays free
+  // for framePayload()
+  static const uint8_t LORA_TX_SLOTS = LORA_TX_QUEUE_SIZE + 1;
+  struct TxSlot {
+    byte frame[LORA_V2_HEADER_SIZE + LORA_MAX_PAYLOAD_SIZE];
+    uint8_t offset;  // start of the frame, behind unused header bytes
+    LoRaCachedFrame* cached;  // frame to send instead, see sendCached()
+    uint8_t seq;              // sequence number of a cached v2 frame
+    size_t size;
+    RadioLibTime_t airtime;  // ms
+  };
+  TxSlot tx_slots[LORA_TX_SLOTS];
+  std::atomic<uint8_t> tx_head{0};
+  std::atomic<uint8_t> tx_tail{0};
+  LoRaTxStats tx_stats = {};
+
+  // received frames, single producer (handleEvents) and single consumer
+  // (receive/release), one slot always stays free
+  static const uint8_t LORA_RX_SLOTS = LORA_RX_RING_SIZE + 1;
+  LoRaRxFrame rx_slots[LORA_RX_SLOTS];
+  std::atomic<uint8_t> rx_head{0};
+  std::atomic<uint8_t> rx_tail{0};
+  LoRaRxStats rx_stats = {};
+  // false for transmit-only devices, see begin()
+  bool listening = false;
+  // radio blind time, see LoRaBlindStats
+  volatile bool tx_blind = false;
+  volatile uint32_t tx_blind_since = 0;
+  uint64_t blind_rx_micros = 0;
+  uint64_t blind_tx_micros = 0;
+  uint32_t blind_hour_micros = 0;
+  RadioLibTime_t blind_hour_start = 0;
+  LoRaBlindStats blind_stats = {};
+  // time and bytes of all full reads
+  uint32_t rx_read_micros = 0;
+  uint32_t rx_read_bytes = 0;
+
+  // interrupt events, single producer (ISR) and single consumer
+  // (handleEvents), one slot always stays free
+  static const uint8_t LORA_EVENT_SLOTS = LORA_EVENT_RING_SIZE + 1;
+  LoRaEvent events[LORA_EVENT_SLOTS];
+  std::atomic<uint8_t> event_head{0};
+  std::atomic<uint8_t> event_tail{0};
+  LoRaEventStats event_stats = {};
+  TaskHandle_t loop_task = nullptr;
+
+  esp_timer_handle_t tx_timer = nullptr;
+  // set by the TX timer, the oldest queued frame is due (see onTxTimer)
+  std::atomic<bool> lora_tx_due{false};
+  // set while the next frame is chained after a TX done
+  bool lora_tx_chained = false;
+  std::atomic<bool> lora_tx_done{false};
+  uint32_t lora_tx_done_micros = 0;
+  uint64_t lora_tx_wait_micros = 0;
+
+  /**
+   * Checks the queue space and the airtime budget for a frame of the given
+   * size. Returns the slot to fill and the airtime of the frame.
+   */
+  bool admit(size_t frameSize, uint8_t& head, RadioLibTime_t& frameAirtime) {
+    head = tx_head.load(std::memory_order_relaxed);
+    uint8_t next = (head + 1) % LORA_TX_SLOTS;
+    if (next == tx_tail.load(std::memory_order_acquire)) {
+      Serial.println(F("Transmit queue full --- Dropped Packet!"));
+      tx_stats.dropped++;
+      return false;
+    }
+
+    // airtime in ms, rounded up
+    frameAirtime = (radio.getTimeOnAir(frameSize) + 999) / 1000;
+    if (!airtime.fits(frameAirtime)) {
+      Serial.print("Frame exceeds the airtime budget of ");
+      Serial.print(airtime.budget());
+      Serial.print("ms/h in ");
+      Serial.print(airtime.band().name);
+      Serial.println(" MHz");
+      tx_stats.dropped++;
+      return false;
+    }
+    return true;
+  }
+
+  // publishes the filled slot to the consumer and starts it if idle
+  void enqueue(uint8_t head) {
+    tx_head.store((head + 1) % LORA_TX_SLOTS, std::memory_order_release);
+
+    tx_stats.queued++;
+    uint8_t depth = queueDepth();
+    if (depth > tx_stats.maxDepth) tx_stats.maxDepth = depth;
+
+    poll();
+  }
+
+  // header of the current frame format, the v2 sequence number is left out
+  void writeHeader(byte* header, byte recipientAddress, uint8_t type,
+                   uint8_t flags, size_t size) {
+    header[0] = recipientAddress;
+    header[1] = localAddress;
+    if (frameVersion == 2) {
+      header[2] = LORA_V2_MARKER;
+      header[3] = (type << 4) | (flags & 0x0F);
+      header[4] = 0;
+      header[5] = size;
+    }
+  }
+
+  /**
+   * Hands the oldest queued frame to the radio. Runs in loop() only, via
+   * poll() or via handleEvents() once the TX timer is due, so the radio, the
+   * airtime budget and the statistics have a single user.
+   */
+  void startQueued() {
+    uint8_t tail = tx_tail.load(std::memory_order_relaxed);
+    TxSlot& slot = tx_slots[tail];
+
+    // set flag, the radio leaves receive mode for the CAD and the frame
+    lora_tx_available = false;
+    lora_state = LORA_STATE_TX;
+
+    if (lbtEnabled && !channelFree(slot.airtime)) {
+      // listen during the backoff, the TX timer tries again after it
+      if (listening) {
+        listen();
+      }
+      return;
+    }
+
+    if (lora_tx_chained) {
+      lora_tx_chained = false;
+      uint32_t gap = micros() - lora_tx_done_micros;
+      uint32_t latency =
+          gap > lora_tx_wait_micros ? gap - lora_tx_wait_micros : 0;
+      tx_stats.lastGap = gap;
+      tx_stats.lastLatency = latency;
+      if (gap > tx_stats.maxGap) tx_stats.maxGap = gap;
+      if (latency > tx_stats.maxLatency) tx_stats.maxLatency = latency;
+    }
+
+    // book the airtime before the frame goes on air
+    airtime.consume(slot.airtime, millis());
+    lora_last_airtime = slot.airtime;
+
+    // transmit
+    Serial.print("Transmit duration estimated: [");
+    Serial.print(slot.size);
+    Serial.print("Byte] ");
+    Serial.print(slot.airtime);
+    Serial.print("ms, airtime used ");
+    Serial.print(airtime.used(millis()));
+    Serial.print("/");
+    Serial.print(airtime.budget());
+    Serial.print("ms/h in ");
+    Serial.print(airtime.band().name);
+    Serial.println(" MHz");
+    if (listening) {
+      // deaf until the TX done interrupt puts the radio back into receive
+      tx_blind_since = micros();
+      tx_blind = true;
+    }
+    if (slot.cached != nullptr) {
+      if (slot.cached->version == 2) {
+        slot.cached->frame[4] = slot.seq;
+      }
+      lora_tx_state = radio.startTransmit(slot.cached->frame, slot.size);
+      slot.cached->queued--;
+    } else {
+      lora_tx_state = radio.startTransmit(slot.frame + slot.offset, slot.size);
+    }
+
+    // the radio holds the frame now, release the slot
+    tx_tail.store((tail + 1) % LORA_TX_SLOTS, std::memory_order_release);
+    tx_stats.sent++;
+
+    if (lora_tx_state != RADIOLIB_ERR_NONE) {
+      // there will be no TX done interrupt, finish the transmission here
+      lora_transmission_end_time = millis();
+      finishTransmission();
+      Serial.print(F("failed, code "));
+      Serial.println(lora_tx_state);
+    }
+  }
+
+  /**
+   * Channel activity detection before the oldest queued frame, the one sent
+   * next (frames are added at tx_head and sent from tx_tail). If the channel
+   * is busy, a random backoff (see LORA_LBT_MAX_TRIES) is started on the TX
+   * timer and false returned. The link stays in LORA_STATE_TX during the
+   * backoff, so no other frame overtakes this one, while startQueued() puts
+   * listening devices back into receive mode.
+   */
+  bool channelFree(RadioLibTime_t frameAirtime) {
+    uint32_t start = micros();
+    lora_cad = true;
+    int16_t cad = radio.scanChannel();
+    lora_cad = false;
+    lbt_stats.cadTime += micros() - start;
+    lbt_stats.checks++;
+
+    if (!Chip::channelBusy(cad)) {
+      lbt_tries = 0;
+      return true;
+    }
+    lbt_stats.busy++;
+    if (++lbt_tries > LORA_LBT_MAX_TRIES) {
+      lbt_stats.forced++;
+      lbt_tries = 0;
+      return true;
+    }
+
+    RadioLibTime_t window = frameAirtime << lbt_tries;
+    if (window == 0 || window > LORA_LBT_MAX_BACKOFF) {
+      window = LORA_LBT_MAX_BACKOFF;
+    }
+    RadioLibTime_t backoff = random(1, window + 1);
+    lbt_stats.backoff += backoff;
+    Serial.print("Channel busy, backoff ");
+    Serial.print(backoff);
+    Serial.println("ms");
+    armTxTimer(backoff);
+    return false;
+  }
+
+  /**
+   * Arms the TX timer to wake loop() for the oldest queued frame. The
+   * timeout is computed in 64 bits and capped at the hourly airtime window,
+   * longer waits (e.g. a txInterval beyond an hour) are checked again and
+   * re-armed by startDue() when it expires.
+   */
+  void armTxTimer(RadioLibTime_t wait) {
+    if (wait > LORA_MAX_TX_WAIT) wait = LORA_MAX_TX_WAIT;
+    esp_timer_start_once(tx_timer, (uint64_t)wait * 1000);
+  }
+
+  // sends the frame the TX timer was due for, once the duty cycle allows it
+  void startDue() {
+    if (queueDepth() == 0) {
+      return;
+    }
+    RadioLibTime_t wait = dutyCycleWait();
+    if (wait > 0) {
+      armTxTimer(wait);
+      return;
+    }
+    startQueued();
+  }
+
+  /**
+   * Ends a transmission (or a chain of queued frames): listening devices go
+   * back into receive mode at once, before any logging, transmit-only
+   * devices stay in LORA_STATE_TX_DONE.
+   */
+  void finishTransmission() {
+    lora_tx_available = true;
+    if (listening) {
+      listen();
+    } else {
+      lora_state = LORA_STATE_TX_DONE;
+    }
+    lora_tx_done = true;
+  }
+
+  // books a blind gap, see LoRaBlindStats
+  void addBlindTime(uint32_t gap, bool rx) {
+    rollBlindHour();
+    if (rx) {
+      blind_stats.rxGaps++;
+      blind_rx_micros += gap;
+    } else {
+      blind_stats.txGaps++;
+      blind_tx_micros += gap;
+    }
+    blind_hour_micros += gap;
+    if (gap > blind_stats.maxGap) blind_stats.maxGap = gap;
+  }
+
+  void rollBlindHour() {
+    RadioLibTime_t now = millis();
+    if (now - blind_hour_start >= 3600000) {
+      // no blind time at all in a skipped hour
+      blind_stats.lastHour =
+          now - blind_hour_start < 7200000 ? blind_hour_micros / 1000 : 0;
+      blind_hour_micros = 0;
+      blind_hour_start = now - (now - blind_hour_start) % 3600000;
+    }
+  }
+
+  /**
+   * Peeks at the header of a received frame. Returns false for frames
+   * addressed to another device, without reading their payload.
+   */
+  bool acceptHeader(size_t length) {
+    uint32_t start = micros();
+    byte header[LORA_HEADER_SIZE];
+    if (length < LORA_HEADER_SIZE ||
+        Chip::peek(radio, header, LORA_HEADER_SIZE) != RADIOLIB_ERR_NONE) {
+      // let the full read report the error
+      return true;
+    }
+    if (header[0] == localAddress || header[0] == LORA_BROADCAST_ADDRESS) {
+      return true;
+    }
+
+    uint32_t spent = micros() - start;
+    rx_stats.rejected++;
+    rx_stats.spiBytesSaved += length - LORA_HEADER_SIZE;
+    // a full read would have taken the measured time per byte of the frames
+    // read so far, less the time spent on the peek
+    if (rx_read_bytes > 0) {
+      uint32_t fullRead = (uint64_t)rx_read_micros * length / rx_read_bytes;
+      rx_stats.cpuSaved += fullRead > spent ? fullRead - spent : 0;
+    }
+    return false;
+  }
+
+  /**
+   * Copies the received frame and its link quality into the next slot of the
+   * RX ring and puts the radio back into receive mode right away. A frame for
+   * this device that finds the ring full is counted as overrun.
+   */
+  void drainReceived(const LoRaEvent& event) {
+    size_t length = radio.getPacketLength();
+    if (length > LORA_MAX_FRAME_SIZE) length = LORA_MAX_FRAME_SIZE;
+
+    if (acceptHeader(length)) {
+      uint8_t head = rx_head.load(std::memory_order_relaxed);
+      uint8_t next = (head + 1) % LORA_RX_SLOTS;
+      if (next == rx_tail.load(std::memory_order_acquire)) {
+        rx_stats.overruns++;
+      } else {
+        LoRaRxFrame& frame = rx_slots[head];
+        uint32_t start = micros();
+        frame.state = radio.readData(frame.data, length);
+        rx_read_micros += micros() - start;
+        rx_read_bytes += length;
+        rx_stats.received++;
+
+        frame.length = length;
+        frame.rssi = radio.getRSSI();
+        frame.snr = radio.getSNR();
+        frame.micros = event.micros;
+        rx_head.store(next, std::memory_order_release);
+
+        uint8_t depth = rxDepth();
+        if (depth > rx_stats.maxDepth) rx_stats.maxDepth = depth;
+      }
+    }
+
+    // put module back to listen mode
+    lora_rx_state = radio.startReceive();
+    addBlindTime(micros() - event.micros, true);
+  }
+
+  // runs in the esp_timer task: the radio belongs to loop(), so only flag
+  // the frame as due and wake loop() to send it in handleEvents()
+  static void onTxTimer(void* arg) {
+    LoRaLink* link = static_cast<LoRaLink*>(arg);
+    link->lora_tx_due = true;
+    link->wake();
+  }
+
+  static void printPayloadExceeds(size_t limit) {
+    Serial.print("Payload exceeds ");
+    Serial.print(limit);
+    Serial.println(" Bytes");
+  }
+
+  static void printV1Ambiguous() {
+    Serial.println(F("Payload reads as v2 header, not sent as v1 frame"));
+  }
+
+  /**
+   * State transitions and logging of an interrupt event, in the context of
+   * the caller of handleEvents(). Events are checked against the current
+   * state, as the ISR records them without changing it.
+   */
+  void handleEvent(const LoRaEvent& event) {
+    if (event.type == LORA_EVENT_RX_DONE && lora_state == LORA_STATE_RECEIVE) {
+      // we got a packet, into the ring with it
+      drainReceived(event);
+      Serial.println("CB - Reception complete");
+    } else if (event.type == LORA_EVENT_TX_DONE &&
+               lora_state == LORA_STATE_TX) {
+      // we sent a packet, listen again before anything else
+      uint32_t since = micros() - event.micros;
+      lora_transmission_end_time = millis() - since / 1000;
+      lora_tx_done_micros = event.micros;
+      bool last = queueDepth() == 0;
+      if (last) {
+        finishTransmission();
+      } else if (listening) {
+        // more frames waiting, listen in between (see below)
+        listen();
+      }
+
+      Serial.println("CB - Transmission complete");
+      if (lora_tx_state == RADIOLIB_ERR_NONE) {
+        // packet was successfully sent
+        Serial.println(F("transmission finished!"));
+      } else {
+        Serial.print(F("failed, code "));
+        Serial.println(lora_tx_state);
+      }
+
+      if (!last) {
+        // the TX timer wakes loop() for the next frame once the duty cycle
+        // allows it
+        RadioLibTime_t wait = dutyCycleWait();
+        lora_tx_chained = true;
+        lora_tx_wait_micros = since + (uint64_t)wait * 1000;
+        armTxTimer(wait);
+      }
+    } else {
+      // callback while a completed transmission is still unhandled
+      Serial.print(F("Callback at lora_state "));
+      Serial.print(lora_state);
+      Serial.print(F(", IRQ flags 0x"));
+      Serial.print(event.irqFlags, HEX);
+      Serial.println(F(" --- Error, should not happen?"));
+    }
+  }
+
+  // called on RX done and TX done, only records the event for handleEvents()
+  // and wakes loop()
+  // IMPORTANT: this function MUST be 'void' type and MUST NOT have any
+  // arguments!
+  ICACHE_RAM_ATTR static void onInterrupt(void) {
+    uint32_t start = micros();
+    LoRaLink* link = instance;
+    if (link->lora_cad) {
+      // CAD done, scanChannel() polls for it itself
+      return;
+    }
+
+    uint8_t head = link->event_head.load(std::memory_order_relaxed);
+    uint8_t next = (head + 1) % LORA_EVENT_SLOTS;
+    if (next == link->event_tail.load(std::memory_order_acquire)) {
+      link->event_stats.dropped++;
+    } else {
+      LoRaEvent& event = link->events[head];
+      uint8_t state = link->lora_state;
+      event.type = state == LORA_STATE_RECEIVE ? LORA_EVENT_RX_DONE
+                   : state == LORA_STATE_TX    ? LORA_EVENT_TX_DONE
+                                               : LORA_EVENT_UNHANDLED;
+      event.micros = start;
+      event.irqFlags = 0;
+      link->event_head.store(next, std::memory_order_release);
+    }
+
+    // loop() handles the event as soon as the ISR returns
+    link->wakeFromISR();
+    link->event_stats.isrDuration.add(micros() - start);
+  }
+};
+
+template <class Radio, class Pins>
+LoRaLink<Radio, Pins>* LoRaLink<Radio, Pins>::instance = nullptr;
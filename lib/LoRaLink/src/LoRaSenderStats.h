@@ -0,0 +1,149 @@
+/**
+ * @file LoRaSenderStats.h
+ * @brief Link statistics per sender address.
+ *
+ * One entry per 1-byte address, filled from the RSSI and SNR of each received
+ * frame. RSSI and SNR are kept in quarter dB as integers: a histogram and the
+ * sum for the mean, so recording a frame neither formats text nor allocates.
+ * print() dumps the table of all senders seen so far in one go.
+ */
+#pragma once
+
+#include <Arduino.h>
+#include <RadioLib.h>
+
+// RSSI histogram: bucket 0 < LOW + STEP, last bucket >= LOW + 7 * STEP
+#define LORA_RSSI_BUCKETS 8
+#define LORA_RSSI_LOW -130  // dBm
+#define LORA_RSSI_STEP 10   // dB
+
+// SNR histogram, same layout
+#define LORA_SNR_BUCKETS 8
+#define LORA_SNR_LOW -16  // dB
+#define LORA_SNR_STEP 4   // dB
+
+/**
+ * Counters of one sender. RSSI and SNR sums are in quarter dB.
+ */
+struct LoRaSenderStats {
+  uint32_t packets;    // frames received, including CRC errors
+  uint32_t drops;      // frames dropped by the application, e.g. duplicates
+  uint32_t crcErrors;  //
+  int32_t rssiSum;     // dBm * 4
+  int32_t snrSum;      // dB * 4
+  uint16_t rssi[LORA_RSSI_BUCKETS];
+  uint16_t snr[LORA_SNR_BUCKETS];
+};
+
+class LoRaSenderTable {
+ public:
+  /**
+   * Records a received frame of the sender with its link quality and the
+   * result of the read. Frames with a CRC error are booked on the sender of
+   * their (possibly corrupt) header.
+   */
+  void record(byte sender, float rssi, float snr, int state) {
+    LoRaSenderStats& entry = entries[sender];
+    int16_t rssiQ = quarter(rssi);
+    int16_t snrQ = quarter(snr);
+
+    entry.packets++;
+    if (state == RADIOLIB_ERR_CRC_MISMATCH) {
+      entry.crcErrors++;
+    }
+    entry.rssiSum += rssiQ;
+    entry.snrSum += snrQ;
+    count(entry.rssi[bucket(rssiQ, LORA_RSSI_LOW, LORA_RSSI_STEP,
+                            LORA_RSSI_BUCKETS)]);
+    count(entry.snr[bucket(snrQ, LORA_SNR_LOW, LORA_SNR_STEP,
+                           LORA_SNR_BUCKETS)]);
+  }
+
+  // a frame of the sender dropped after reception, e.g. a duplicate
+  void drop(byte sender) { entries[sender].drops++; }
+
+  const LoRaSenderStats& at(byte sender) const { return entries[sender]; }
+
+  /**
+   * Prints one line per sender seen so far: counters, mean RSSI and SNR and
+   * the histogram buckets from the lowest to the highest.
+   */
+  void print(Print& out) const {
+    out.print("Senders (RSSI buckets <");
+    out.print(LORA_RSSI_LOW + LORA_RSSI_STEP);
+    out.print("dBm, then ");
+    out.print(LORA_RSSI_STEP);
+    out.print("dB each, SNR buckets <");
+    out.print(LORA_SNR_LOW + LORA_SNR_STEP);
+    out.print("dB, then ");
+    out.print(LORA_SNR_STEP);
+    out.println("dB each):");
+    for (int sender = 0; sender < 256; sender++) {
+      const LoRaSenderStats& entry = entries[sender];
+      if (entry.packets == 0 && entry.drops == 0) continue;
+      out.print("0x");
+      if (sender < 0x10) out.print('0');
+      out.print(sender, HEX);
+      out.print(": ");
+      out.print(entry.packets);
+      out.print(" pkts, ");
+      out.print(entry.drops);
+      out.print(" drops, ");
+      out.print(entry.crcErrors);
+      out.print(" crc, RSSI ");
+      printMean(out, entry.rssiSum, entry.packets);
+      out.print("dBm ");
+      printBuckets(out, entry.rssi, LORA_RSSI_BUCKETS);
+      out.print(" SNR ");
+      printMean(out, entry.snrSum, entry.packets);
+      out.print("dB ");
+      printBuckets(out, entry.snr, LORA_SNR_BUCKETS);
+      out.println();
+    }
+  }
+
+ private:
+  LoRaSenderStats entries[256] = {};
+
+  static int16_t quarter(float value) {
+    return (int16_t)(value * 4 + (value < 0 ? -0.5f : 0.5f));
+  }
+
+  static uint8_t bucket(int16_t valueQ, int low, int step, uint8_t buckets) {
+    if (valueQ < low * 4) return 0;
+    int index = (valueQ - low * 4) / (step * 4);
+    return index >= buckets ? buckets - 1 : index;
+  }
+
+  // saturates instead of wrapping
+  static void count(uint16_t& counter) {
+    if (counter < UINT16_MAX) counter++;
+  }
+
+  // mean of quarter dB values with two decimals, e.g. "-87.25"
+  static void printMean(Print& out, int32_t sumQ, uint32_t n) {
+    if (n == 0) {
+      out.print("-");
+      return;
+    }
+    int32_t meanQ = sumQ / (int32_t)n;
+    if (meanQ < 0) {
+      out.print('-');
+      meanQ = -meanQ;
+    }
+    out.print(meanQ / 4);
+    out.print('.');
+    static const char* const fractions[] = {"00", "25", "50", "75"};
+    out.print(fractions[meanQ % 4]);
+  }
+
+  static void printBuckets(Print& out, const uint16_t* counts,
+                           uint8_t buckets) {
+    out.print('[');
+    for (uint8_t i = 0; i < buckets; i++) {
+      if (i > 0) out.print(' ');
+      out.print(counts[i]);
+    }
+    out.print(']');
+  }
+};
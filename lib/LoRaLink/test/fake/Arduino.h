@@ -0,0 +1,358 @@
+/**
+ * @file Arduino.h
+ * @brief Host fake of the Arduino core for the native tests of lib/.
+ *
+ * Only what the libraries use: byte, String, Print with the number
+ * formatting of the core, a Serial that keeps its output for the tests to
+ * check, random(), the math macros TinyGPS++ needs and the simulated clock
+ * of fake_clock.h. unsigned long is 32 bits wide on the ESP32, millis() and
+ * micros() wrap like there.
+ */
+#pragma once
+
+#include <math.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <functional>
+#include <string>
+
+#include "esp_timer.h"
+#include "fake_clock.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+typedef uint8_t byte;
+
+#define ICACHE_RAM_ATTR
+#define IRAM_ATTR
+#define F(text) (text)
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+#define LOW 0x0
+#define HIGH 0x1
+#define RISING 0x01
+#define FALLING 0x02
+#define CHANGE 0x03
+
+#define PI 3.1415926535897932384626433832795
+#define HALF_PI 1.5707963267948966192313216916398
+#define TWO_PI 6.283185307179586476925286766559
+#define DEG_TO_RAD 0.017453292519943295769236907684886
+#define RAD_TO_DEG 57.295779513082320876798154814105
+#define radians(deg) ((deg) * DEG_TO_RAD)
+#define degrees(rad) ((rad) * RAD_TO_DEG)
+#define sq(x) ((x) * (x))
+
+inline unsigned long millis() { return (uint32_t)(fake_now / 1000); }
+inline unsigned long micros() { return (uint32_t)fake_now; }
+inline void delay(uint32_t ms) { fake_advance(ms * 1000ULL); }
+inline void delayMicroseconds(uint32_t us) { fake_advance(us); }
+
+// deterministic, so a failing test fails the same way every run
+inline uint32_t fake_random_state = 1;
+
+inline void randomSeed(unsigned long seed) { fake_random_state = seed | 1; }
+
+inline long random(long howbig) {
+  if (howbig <= 0) return 0;
+  // xorshift32
+  fake_random_state ^= fake_random_state << 13;
+  fake_random_state ^= fake_random_state >> 17;
+  fake_random_state ^= fake_random_state << 5;
+  return fake_random_state % howbig;
+}
+
+inline long random(long howsmall, long howbig) {
+  if (howsmall >= howbig) return howsmall;
+  return random(howbig - howsmall) + howsmall;
+}
+
+class String {
+ public:
+  String(const char* text = "") : text(text != nullptr ? text : "") {}
+  String(char c) : text(1, c) {}
+  String(int value, unsigned char base = DEC) : text(number(value, base)) {}
+  String(unsigned int value, unsigned char base = DEC)
+      : text(number(value, base)) {}
+  String(long value, unsigned char base = DEC) : text(number(value, base)) {}
+  String(unsigned long value, unsigned char base = DEC)
+      : text(number(value, base)) {}
+  String(double value, unsigned int digits = 2) {
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "%.*f", digits, value);
+    text = buffer;
+  }
+
+  unsigned int length() const { return text.size(); }
+  const char* c_str() const { return text.c_str(); }
+  char operator[](unsigned int index) const { return text[index]; }
+
+  bool concat(const char* data, unsigned int size) {
+    text.append(data, size);
+    return true;
+  }
+  bool concat(const String& other) {
+    text += other.text;
+    return true;
+  }
+
+  void getBytes(unsigned char* buffer, unsigned int size,
+                unsigned int index = 0) const {
+    if (size == 0) return;
+    size_t count = index < text.size() ? text.size() - index : 0;
+    if (count > size - 1) count = size - 1;
+    memcpy(buffer, text.data() + index, count);
+    buffer[count] = '\0';
+  }
+
+  String& operator+=(const String& other) {
+    text += other.text;
+    return *this;
+  }
+  bool operator==(const String& other) const { return text == other.text; }
+  bool operator!=(const String& other) const { return text != other.text; }
+  bool operator<(const String& other) const { return text < other.text; }
+  bool equals(const String& other) const { return text == other.text; }
+
+  friend String operator+(const String& a, const String& b) {
+    String sum(a);
+    sum += b;
+    return sum;
+  }
+
+ private:
+  std::string text;
+
+  static std::string number(long long value, unsigned char base) {
+    if (value < 0 && base == DEC) return "-" + number(-value, base);
+    return number((unsigned long long)value, base);
+  }
+
+  static std::string number(unsigned long long value, unsigned char base) {
+    char buffer[65];
+    char* digit = buffer + sizeof(buffer) - 1;
+    *digit = '\0';
+    do {
+      uint8_t d = value % base;
+      *--digit = d < 10 ? '0' + d : 'A' + d - 10;
+      value /= base;
+    } while (value > 0);
+    return digit;
+  }
+  static std::string number(int value, unsigned char base) {
+    return number((long long)value, base);
+  }
+  static std::string number(long value, unsigned char base) {
+    return number((long long)value, base);
+  }
+  static std::string number(unsigned int value, unsigned char base) {
+    return number((unsigned long long)value, base);
+  }
+  static std::string number(unsigned long value, unsigned char base) {
+    return number((unsigned long long)value, base);
+  }
+};
+
+/**
+ * Print of the core, with its formatting of numbers: no padding, upper case
+ * hex digits, floats rounded to the given decimals.
+ */
+class Print {
+ public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t* buffer, size_t size) {
+    size_t n = 0;
+    while (size--) {
+      if (write(*buffer++) == 0) break;
+      n++;
+    }
+    return n;
+  }
+  size_t write(const char* text) {
+    return text == nullptr ? 0 : write((const uint8_t*)text, strlen(text));
+  }
+  size_t write(const char* buffer, size_t size) {
+    return write((const uint8_t*)buffer, size);
+  }
+
+  size_t print(const char* text) { return write(text); }
+  size_t print(const String& text) {
+    return write((const uint8_t*)text.c_str(), text.length());
+  }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(unsigned char value, int base = DEC) {
+    return printNumber(value, base);
+  }
+  size_t print(int value, int base = DEC) {
+    return print((long long)value, base);
+  }
+  size_t print(unsigned int value, int base = DEC) {
+    return printNumber(value, base);
+  }
+  size_t print(long value, int base = DEC) {
+    return print((long long)value, base);
+  }
+  size_t print(unsigned long value, int base = DEC) {
+    return printNumber(value, base);
+  }
+  size_t print(long long value, int base = DEC) {
+    if (base == DEC && value < 0) {
+      return print('-') + printNumber(-(unsigned long long)value, base);
+    }
+    return printNumber(value, base);
+  }
+  size_t print(unsigned long long value, int base = DEC) {
+    return printNumber(value, base);
+  }
+  size_t print(double value, int digits = 2) {
+    return printFloat(value, digits);
+  }
+
+  size_t println() { return write("\r\n"); }
+  template <typename T>
+  size_t println(const T& value) {
+    return print(value) + println();
+  }
+  template <typename T>
+  size_t println(const T& value, int format) {
+    return print(value, format) + println();
+  }
+
+  size_t printf(const char* format, ...) {
+    char buffer[256];
+    va_list args;
+    va_start(args, format);
+    int size = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    if (size < 0) return 0;
+    if (size >= (int)sizeof(buffer)) size = sizeof(buffer) - 1;
+    return write((const uint8_t*)buffer, size);
+  }
+
+ private:
+  size_t printNumber(unsigned long long value, int base) {
+    if (base < 2) base = DEC;
+    char buffer[65];
+    char* digit = buffer + sizeof(buffer) - 1;
+    *digit = '\0';
+    do {
+      uint8_t d = value % base;
+      *--digit = d < 10 ? '0' + d : 'A' + d - 10;
+      value /= base;
+    } while (value > 0);
+    return write(digit);
+  }
+
+  size_t printFloat(double value, int digits) {
+    if (isnan(value)) return print("nan");
+    if (isinf(value)) return print("inf");
+    if (value > 4294967040.0 || value < -4294967040.0) return print("ovf");
+
+    size_t n = 0;
+    if (value < 0.0) {
+      n += print('-');
+      value = -value;
+    }
+    double rounding = 0.5;
+    for (int i = 0; i < digits; i++) rounding /= 10.0;
+    value += rounding;
+
+    unsigned long integer = (unsigned long)value;
+    double remainder = value - (double)integer;
+    n += print(integer);
+    if (digits > 0) n += print('.');
+    while (digits-- > 0) {
+      remainder *= 10.0;
+      unsigned int d = (unsigned int)remainder;
+      n += print(d);
+      remainder -= d;
+    }
+    return n;
+  }
+};
+
+class Stream : public Print {
+ public:
+  virtual int available() { return 0; }
+  virtual int read() { return -1; }
+  virtual int peek() { return -1; }
+
+  size_t readBytes(uint8_t* buffer, size_t size) {
+    size_t n = 0;
+    while (n < size && available() > 0) buffer[n++] = read();
+    return n;
+  }
+};
+
+/**
+ * Serial port that keeps everything written to it in output and hands out
+ * the bytes of input to read().
+ */
+class HardwareSerial : public Stream {
+ public:
+  std::string output;
+  std::string input;
+
+  void begin(unsigned long baud, uint32_t config = 0, int8_t rx = -1,
+             int8_t tx = -1) {}
+  operator bool() const { return true; }
+
+  size_t write(uint8_t c) override {
+    output += (char)c;
+    return 1;
+  }
+  using Print::write;
+
+  int available() override { return input.size() - position; }
+  int read() override {
+    return position < input.size() ? (uint8_t)input[position++] : -1;
+  }
+  int peek() override {
+    return position < input.size() ? (uint8_t)input[position] : -1;
+  }
+
+  void onReceive(std::function<void(void)> callback, bool timeout = false) {
+    receive = callback;
+  }
+  void setRxFIFOFull(uint8_t size) {}
+
+  // appends bytes to the input and calls the onReceive() callback
+  void receiveBytes(const char* data, size_t size) {
+    input.append(data, size);
+    if (receive) receive();
+  }
+
+ private:
+  size_t position = 0;
+  std::function<void(void)> receive;
+};
+
+inline HardwareSerial Serial;
+inline HardwareSerial Serial1;
+
+/**
+ * Heap figures of the ESP class. The host has no fixed heap, the fake
+ * reports what a test sets.
+ */
+class EspClass {
+ public:
+  uint32_t freeHeap = 0;
+  uint32_t maxAllocHeap = 0;
+  uint32_t minFreeHeap = 0;
+
+  uint32_t getFreeHeap() { return freeHeap; }
+  uint32_t getMaxAllocHeap() { return maxAllocHeap; }
+  uint32_t getMinFreeHeap() { return minFreeHeap; }
+};
+
+inline EspClass ESP;
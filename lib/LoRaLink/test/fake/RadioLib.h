@@ -0,0 +1,320 @@
+/**
+ * @file RadioLib.h
+ * @brief Host fake of the RadioLib API used by LoRaLink.
+ *
+ * Module, SX1262 and SX1276 with the calls of LoRaLink.h and nothing more.
+ * The fake radio keeps its settings and mode for the tests to check,
+ * records every frame handed to startTransmit() and raises the TX done
+ * interrupt one time-on-air later on the simulated clock (fake_clock.h).
+ * Frames for the radio are delivered with receive(). All radios share one
+ * channel, fake_air, so scanChannel() sees the frames of the others and a
+ * test can count overlapping frames as collisions.
+ */
+#pragma once
+
+#include <Arduino.h>
+
+#include <vector>
+
+// unsigned long, 32 bits on the ESP32
+typedef uint32_t RadioLibTime_t;
+
+#define RADIOLIB_ERR_NONE 0
+#define RADIOLIB_ERR_UNKNOWN -1
+#define RADIOLIB_ERR_CHIP_NOT_FOUND -2
+#define RADIOLIB_ERR_PACKET_TOO_LONG -4
+#define RADIOLIB_ERR_CRC_MISMATCH -7
+#define RADIOLIB_ERR_INVALID_BANDWIDTH -8
+#define RADIOLIB_ERR_INVALID_SPREADING_FACTOR -9
+#define RADIOLIB_ERR_INVALID_CODING_RATE -10
+#define RADIOLIB_ERR_INVALID_FREQUENCY -12
+#define RADIOLIB_ERR_INVALID_OUTPUT_POWER -13
+#define RADIOLIB_PREAMBLE_DETECTED -14
+#define RADIOLIB_CHANNEL_FREE -15
+#define RADIOLIB_ERR_INVALID_CRC_CONFIGURATION -107
+#define RADIOLIB_LORA_DETECTED -702
+
+#define RADIOLIB_SX126X_CMD_READ_BUFFER 0x1E
+#define RADIOLIB_SX126X_CMD_GET_RX_BUFFER_STATUS 0x13
+#define RADIOLIB_SX127X_REG_FIFO 0x00
+#define RADIOLIB_SX127X_REG_FIFO_ADDR_PTR 0x0D
+#define RADIOLIB_SX127X_REG_FIFO_RX_CURRENT_ADDR 0x10
+
+/**
+ * SPI access to the radio buffer (SX126x) or FIFO (SX127x), reading from
+ * the frame last delivered to the radio.
+ */
+class Module {
+ public:
+  uint8_t buffer[256] = {};
+  size_t length = 0;
+  uint32_t spiBytes = 0;  // bytes read over the fake SPI bus
+
+  Module(uint32_t cs, uint32_t irq, uint32_t rst, uint32_t gpio = 0) {}
+
+  int16_t SPIreadStream(uint16_t cmd, uint8_t* data, size_t size) {
+    if (cmd == RADIOLIB_SX126X_CMD_GET_RX_BUFFER_STATUS && size >= 2) {
+      data[0] = length;
+      data[1] = 0;
+    }
+    return RADIOLIB_ERR_NONE;
+  }
+
+  int16_t SPIreadStream(const uint8_t* cmd, uint8_t cmdSize, uint8_t* data,
+                        size_t size) {
+    read(cmdSize > 1 ? cmd[1] : 0, data, size);
+    return RADIOLIB_ERR_NONE;
+  }
+
+  uint8_t SPIreadRegister(uint16_t reg) { return 0; }
+  void SPIwriteRegister(uint16_t reg, uint8_t value) {
+    if (reg == RADIOLIB_SX127X_REG_FIFO_ADDR_PTR) fifo = value;
+  }
+  void SPIreadRegisterBurst(uint16_t reg, uint8_t size, uint8_t* data) {
+    read(fifo, data, size);
+  }
+
+  void read(size_t offset, uint8_t* data, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+      data[i] = offset + i < sizeof(buffer) ? buffer[offset + i] : 0;
+    }
+    spiBytes += size;
+  }
+
+ private:
+  uint8_t fifo = 0;
+};
+
+class FakeRadio;
+
+// a frame on the shared channel, from startTransmit() to its TX done
+struct FakeAirFrame {
+  FakeRadio* radio;
+  uint64_t start;  // us
+  uint64_t end;    // us
+  std::vector<uint8_t> data;
+};
+
+inline std::vector<FakeAirFrame> fake_air;
+
+enum FakeRadioMode { FAKE_STANDBY, FAKE_RX, FAKE_TX, FAKE_CAD };
+
+/**
+ * The chip independent part of the fake radio.
+ */
+class FakeRadio {
+ public:
+  // settings as last applied
+  float frequency = 0;
+  float bandwidth = 0;
+  uint8_t spreadingFactor = 0;
+  uint8_t codingRate = 0;
+  uint8_t syncWord = 0;
+  int8_t outputPower = 0;
+  bool crc = false;
+
+  FakeRadioMode mode = FAKE_STANDBY;
+  uint32_t receives = 0;   // calls of startReceive()
+  uint32_t transmits = 0;  // calls of startTransmit()
+  uint32_t scans = 0;      // calls of scanChannel()
+  // buffer and stack pointer of the last startTransmit(), to check where a
+  // frame was built and how deep the send path went
+  const uint8_t* lastData = nullptr;
+  uintptr_t lastStack = 0;
+
+  // time-on-air of a frame: base + bytes * perByte, roughly SF7/125 kHz, or
+  // with loraTiming that of the applied settings, as the real radio does
+  RadioLibTime_t timeOnAirBase = 20000;  // us
+  RadioLibTime_t timeOnAirPerByte = 500;  // us
+  bool loraTiming = false;
+  RadioLibTime_t cadTime = 2000;         // us, blocking in scanChannel()
+  // errors to return, e.g. to test the halting of begin()
+  int16_t beginState = RADIOLIB_ERR_NONE;
+  int16_t transmitState = RADIOLIB_ERR_NONE;
+  // scanChannel() sees a busy channel this many more times
+  uint32_t busyScans = 0;
+
+  float rssi = -80;
+  float snr = 8;
+
+  explicit FakeRadio(Module* mod) : mod(mod) {
+    irq.callback = onIrq;
+    irq.arg = this;
+    irq.armed = false;
+  }
+  virtual ~FakeRadio() { fake_timer_stop(&irq); }
+
+  Module* getMod() { return mod; }
+
+  int16_t begin() { return beginState; }
+  int16_t setFrequency(float value) {
+    if (value < 150.0 || value > 960.0) return RADIOLIB_ERR_INVALID_FREQUENCY;
+    frequency = value;
+    return RADIOLIB_ERR_NONE;
+  }
+  int16_t setBandwidth(float value) {
+    bandwidth = value;
+    return RADIOLIB_ERR_NONE;
+  }
+  int16_t setSpreadingFactor(uint8_t value) {
+    if (value < 5 || value > 12) return RADIOLIB_ERR_INVALID_SPREADING_FACTOR;
+    spreadingFactor = value;
+    return RADIOLIB_ERR_NONE;
+  }
+  int16_t setCodingRate(uint8_t value) {
+    codingRate = value;
+    return RADIOLIB_ERR_NONE;
+  }
+  int16_t setSyncWord(uint8_t value) {
+    syncWord = value;
+    return RADIOLIB_ERR_NONE;
+  }
+  int16_t setOutputPower(int8_t value) {
+    outputPower = value;
+    return RADIOLIB_ERR_NONE;
+  }
+
+  RadioLibTime_t getTimeOnAir(size_t length) {
+    if (!loraTiming) return timeOnAirBase + length * timeOnAirPerByte;
+    // explicit header, 8 symbol preamble, low data rate optimization above
+    // 16 ms per symbol
+    float symbol = (float)(1UL << spreadingFactor) / bandwidth;  // ms
+    int lowDataRate = symbol > 16.0 ? 1 : 0;
+    int bits = 8 * (int)length - 4 * spreadingFactor + 28 + (crc ? 16 : 0);
+    int divisor = 4 * (spreadingFactor - 2 * lowDataRate);
+    int symbols = 8;
+    if (bits > 0) symbols += ((bits + divisor - 1) / divisor) * codingRate;
+    return (RadioLibTime_t)((8 + 4.25 + symbols) * symbol * 1000);
+  }
+
+  int16_t standby() {
+    fake_timer_stop(&irq);
+    mode = FAKE_STANDBY;
+    return RADIOLIB_ERR_NONE;
+  }
+
+  int16_t startReceive() {
+    fake_timer_stop(&irq);
+    mode = FAKE_RX;
+    receives++;
+    return RADIOLIB_ERR_NONE;
+  }
+
+  /**
+   * Puts the frame on the channel and raises the TX done interrupt after
+   * its time-on-air.
+   */
+  __attribute__((noinline)) int16_t startTransmit(const uint8_t* data,
+                                                 size_t length) {
+    transmits++;
+    lastData = data;
+    lastStack = (uintptr_t)__builtin_frame_address(0);
+    if (transmitState != RADIOLIB_ERR_NONE) {
+      mode = FAKE_STANDBY;
+      return transmitState;
+    }
+    mode = FAKE_TX;
+    uint64_t end = fake_now + getTimeOnAir(length);
+    fake_air.push_back({this, fake_now, end,
+                        std::vector<uint8_t>(data, data + length)});
+    fake_timer_start(&irq, end);
+    return RADIOLIB_ERR_NONE;
+  }
+
+  /**
+   * Channel activity detection: busy while another radio is on air, or for
+   * the next busyScans calls. Blocks for cadTime like the real one. A frame
+   * that goes on air at the very start of the scan is missed, the CAD needs
+   * its preamble symbols.
+   */
+  int16_t scanChannel() {
+    scans++;
+    mode = FAKE_CAD;
+    bool busy = busyScans > 0;
+    if (busyScans > 0) busyScans--;
+    for (const FakeAirFrame& frame : fake_air) {
+      if (frame.radio != this && frame.start < fake_now &&
+          fake_now < frame.end) {
+        busy = true;
+      }
+    }
+    fake_now += cadTime;
+    mode = FAKE_STANDBY;
+    return busy ? busyState() : RADIOLIB_CHANNEL_FREE;
+  }
+
+  uint32_t getIrqFlags() { return 0; }
+
+  size_t getPacketLength() { return mod->length; }
+
+  int16_t readData(uint8_t* data, size_t length) {
+    mod->read(0, data, length);
+    return RADIOLIB_ERR_NONE;
+  }
+
+  float getRSSI() { return rssi; }
+  float getSNR() { return snr; }
+
+  /**
+   * Delivers a frame to the radio: raises the RX done interrupt if it is in
+   * receive mode. Returns false if the radio was deaf to it.
+   */
+  bool receive(const uint8_t* data, size_t length) {
+    if (mode != FAKE_RX) return false;
+    memcpy(mod->buffer, data, length);
+    mod->length = length;
+    if (action != nullptr) action();
+    return true;
+  }
+
+  // frames this radio put on the channel
+  std::vector<const FakeAirFrame*> sent() const {
+    std::vector<const FakeAirFrame*> frames;
+    for (const FakeAirFrame& frame : fake_air) {
+      if (frame.radio == this) frames.push_back(&frame);
+    }
+    return frames;
+  }
+
+ protected:
+  Module* mod;
+  void (*action)(void) = nullptr;
+  esp_timer irq;
+
+  virtual int16_t busyState() const = 0;
+
+  // TX done: the chip drops to standby and raises its interrupt pin
+  static void onIrq(void* arg) {
+    FakeRadio* radio = static_cast<FakeRadio*>(arg);
+    radio->mode = FAKE_STANDBY;
+    if (radio->action != nullptr) radio->action();
+  }
+};
+
+class SX1262 : public FakeRadio {
+ public:
+  explicit SX1262(Module* mod) : FakeRadio(mod) {}
+
+  int16_t setCRC(uint8_t length) {
+    crc = length != 0;
+    return RADIOLIB_ERR_NONE;
+  }
+  void setDio1Action(void (*func)(void)) { action = func; }
+
+ protected:
+  int16_t busyState() const override { return RADIOLIB_LORA_DETECTED; }
+};
+
+class SX1276 : public FakeRadio {
+ public:
+  explicit SX1276(Module* mod) : FakeRadio(mod) {}
+
+  int16_t setCRC(bool enable) {
+    crc = enable;
+    return RADIOLIB_ERR_NONE;
+  }
+  void setDio0Action(void (*func)(void), uint32_t dir) { action = func; }
+
+ protected:
+  int16_t busyState() const override { return RADIOLIB_PREAMBLE_DETECTED; }
+};
@@ -0,0 +1,46 @@
+/**
+ * @file esp_timer.h
+ * @brief Host fake of the ESP-IDF high resolution timer, on the simulated
+ * clock of fake_clock.h. Callbacks run inline when the clock passes their
+ * due time.
+ */
+#pragma once
+
+#include <stdint.h>
+
+#include "fake_clock.h"
+
+typedef esp_timer* esp_timer_handle_t;
+typedef void (*esp_timer_cb_t)(void* arg);
+typedef int esp_err_t;
+
+#define ESP_OK 0
+
+typedef enum { ESP_TIMER_TASK } esp_timer_dispatch_t;
+
+typedef struct {
+  esp_timer_cb_t callback;
+  void* arg;
+  esp_timer_dispatch_t dispatch_method;
+  const char* name;
+  bool skip_unhandled_events;
+} esp_timer_create_args_t;
+
+inline esp_err_t esp_timer_create(const esp_timer_create_args_t* args,
+                                  esp_timer_handle_t* handle) {
+  *handle = new esp_timer{args->callback, args->arg, 0, false};
+  return ESP_OK;
+}
+
+inline esp_err_t esp_timer_start_once(esp_timer_handle_t timer,
+                                      uint64_t timeout) {
+  fake_timer_start(timer, fake_now + timeout);
+  return ESP_OK;
+}
+
+inline esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+  fake_timer_stop(timer);
+  return ESP_OK;
+}
+
+inline int64_t esp_timer_get_time() { return fake_now; }
@@ -0,0 +1,92 @@
+/**
+ * @file fake_clock.h
+ * @brief Simulated time of the native tests.
+ *
+ * millis(), micros(), esp_timer and the task notifications all run on one
+ * clock that only moves when a test (or delay(), ulTaskNotifyTake()) moves
+ * it. Timers, including the interrupts the fake radio schedules, fire in
+ * order of their due time while the clock passes them, so a test drives a
+ * whole exchange deterministically:
+ *
+ *   link.sendPacket("Hello", 0x31);
+ *   fake_advance(100000);  // 100 ms, the TX done interrupt fires on the way
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// us since boot
+inline uint64_t fake_now = 0;
+
+/**
+ * A scheduled callback, the fake esp_timer and the interrupts of the fake
+ * radio. Armed timers are kept in a fixed table, tests only need a few.
+ */
+struct esp_timer {
+  void (*callback)(void*);
+  void* arg;
+  uint64_t due;  // us
+  bool armed;
+};
+
+#define FAKE_TIMER_SLOTS 32
+inline esp_timer* fake_timers[FAKE_TIMER_SLOTS] = {};
+
+inline void fake_timer_start(esp_timer* timer, uint64_t due) {
+  timer->due = due;
+  timer->armed = true;
+  for (size_t i = 0; i < FAKE_TIMER_SLOTS; i++) {
+    if (fake_timers[i] == timer) return;
+  }
+  for (size_t i = 0; i < FAKE_TIMER_SLOTS; i++) {
+    if (fake_timers[i] == nullptr) {
+      fake_timers[i] = timer;
+      return;
+    }
+  }
+}
+
+inline void fake_timer_stop(esp_timer* timer) {
+  timer->armed = false;
+  for (size_t i = 0; i < FAKE_TIMER_SLOTS; i++) {
+    if (fake_timers[i] == timer) fake_timers[i] = nullptr;
+  }
+}
+
+/**
+ * Fires the earliest timer due until end, with the clock set to its due
+ * time, and returns true. Without one, the clock moves on to end.
+ */
+inline bool fake_step(uint64_t end) {
+  esp_timer* next = nullptr;
+  for (size_t i = 0; i < FAKE_TIMER_SLOTS; i++) {
+    esp_timer* timer = fake_timers[i];
+    if (timer != nullptr && timer->armed && timer->due <= end &&
+        (next == nullptr || timer->due < next->due)) {
+      next = timer;
+    }
+  }
+  if (next == nullptr) {
+    if (end > fake_now) fake_now = end;
+    return false;
+  }
+  if (next->due > fake_now) fake_now = next->due;
+  fake_timer_stop(next);
+  next->callback(next->arg);
+  return true;
+}
+
+// moves the clock by us, firing every timer due on the way
+inline void fake_advance(uint64_t us) {
+  uint64_t end = fake_now + us;
+  while (fake_step(end)) {
+  }
+}
+
+// drops all timers and starts the clock over, for setUp(); the timers
+// themselves may already be gone with the objects of the last test
+inline void fake_reset(uint64_t now = 0) {
+  for (size_t i = 0; i < FAKE_TIMER_SLOTS; i++) fake_timers[i] = nullptr;
+  fake_now = now;
+}
@@ -0,0 +1,42 @@
+/**
+ * @file FreeRTOS.h
+ * @brief Host fake of the FreeRTOS types and the task notifications.
+ *
+ * The tests run single threaded: there is one task, the one running loop(),
+ * and a notification given to any task ends its ulTaskNotifyTake(). A wait
+ * moves the simulated clock (see fake_clock.h) until a timer or interrupt
+ * gives a notification or the timeout passes. Created tasks are not run,
+ * the tests call their work functions directly.
+ */
+#pragma once
+
+#include <stdint.h>
+
+#include "../fake_clock.h"
+
+typedef void* TaskHandle_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define portMAX_DELAY 0xffffffff
+// 1 ms ticks, as configured by the Arduino core
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define portTICK_PERIOD_MS 1
+#define portYIELD_FROM_ISR(...) ((void)0)
+#define configMAX_PRIORITIES 25
+
+// notifications given and not yet taken
+inline uint32_t fake_notifications = 0;
+inline int fake_loop_task = 0;
+
+inline TaskHandle_t xTaskGetCurrentTaskHandle() { return &fake_loop_task; }
+
+inline BaseType_t xPortGetCoreID() { return 1; }
+
+inline TickType_t xTaskGetTickCount() { return fake_now / 1000; }
+
+inline void vTaskDelay(TickType_t ticks) { fake_advance(ticks * 1000ULL); }
@@ -0,0 +1,43 @@
+/**
+ * @file task.h
+ * @brief Host fake of the FreeRTOS task API, see FreeRTOS.h.
+ */
+#pragma once
+
+#include "FreeRTOS.h"
+
+inline BaseType_t xTaskCreatePinnedToCore(void (*task)(void*),
+                                          const char* name, uint32_t stack,
+                                          void* arg, UBaseType_t priority,
+                                          TaskHandle_t* handle,
+                                          BaseType_t core) {
+  if (handle != nullptr) *handle = &fake_loop_task;
+  return pdPASS;
+}
+
+inline void vTaskDelayUntil(TickType_t* previous, TickType_t ticks) {
+  *previous += ticks;
+  uint64_t due = *previous * 1000ULL;
+  if (due > fake_now) fake_advance(due - fake_now);
+}
+
+inline void xTaskNotifyGive(TaskHandle_t task) { fake_notifications++; }
+
+inline void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t* woken) {
+  fake_notifications++;
+  if (woken != nullptr) *woken = pdTRUE;
+}
+
+/**
+ * Waits for a notification, moving the clock on to the timer or interrupt
+ * that gives it, at most ticks ms.
+ */
+inline uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks) {
+  uint64_t end =
+      ticks == portMAX_DELAY ? UINT64_MAX : fake_now + ticks * 1000ULL;
+  while (fake_notifications == 0 && fake_step(end)) {
+  }
+  uint32_t count = fake_notifications;
+  if (count > 0) fake_notifications = clear ? 0 : count - 1;
+  return count;
+}
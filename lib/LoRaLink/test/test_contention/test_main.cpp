@@ -0,0 +1,191 @@
+/**
+ * Several senders on one channel, with and without listen before talk:
+ * collision rate and goodput of a simulated two minutes per run.
+ *
+ * Each node queues a 20 byte broadcast at random times (Poisson arrivals)
+ * and runs 1 ms loop() passes. All radios share fake_air, so a CAD sees the
+ * frames of the other nodes, and a frame that overlaps another one on air is
+ * a collision. Goodput counts the frames that were alone on the channel,
+ * i.e. the ones a receiver in range of all nodes could decode. The nodes of
+ * one pass run one after another: a node that starts its CAD in the same
+ * instant as another node's frame misses it, like two CADs running side by
+ * side, but one that comes a pass later sees it.
+ */
+#include <Arduino.h>
+#include <LoRaLink.h>
+#include <math.h>
+#include <unity.h>
+
+// 869.525 MHz: 10 % duty cycle, the budget does not limit these runs
+static const LoRaConfig config = {869.525, 125.0, 7, 5, 0x12, 14, true, 0};
+
+#define SIM_NODES 4
+#define SIM_TIME 120000000ULL  // us
+
+static const byte payload[20] = {};
+
+/**
+ * A node of the simulation. Each one needs its own LoRaLink type, as the
+ * interrupt handler finds the link through a static instance per type.
+ */
+struct SimNode {
+  uint64_t next = 0;  // us, next frame to queue
+  uint32_t meanInterval = 0;  // ms
+  uint32_t offered = 0;
+  uint32_t refused = 0;  // queue full
+
+  virtual ~SimNode() {}
+  virtual void begin(bool lbt, uint32_t interval) = 0;
+  virtual void pass() = 0;
+  virtual LoRaLbtStats lbtStats() const = 0;
+
+  void schedule() {
+    // exponential gap, at least 1 ms
+    double uniform = (random(1, 1000001)) / 1000001.0;
+    next = fake_now + (uint64_t)(-log(uniform) * meanInterval * 1000) + 1000;
+  }
+};
+
+template <uint32_t N>
+struct Node : SimNode {
+  LoRaLink<SX1262, LoRaPins<8, 14, 12, N>> link;
+
+  Node() : link(0xC0 + N) {}
+
+  void begin(bool lbt, uint32_t interval) override {
+    link.begin(config);
+    link.setListenBeforeTalk(lbt);
+    meanInterval = interval;
+    schedule();
+  }
+
+  void pass() override {
+    link.poll();
+    if (fake_now >= next) {
+      offered++;
+      if (!link.sendPacket(payload, sizeof(payload), LORA_BROADCAST_ADDRESS)) {
+        refused++;
+      }
+      schedule();
+    }
+  }
+
+  LoRaLbtStats lbtStats() const override { return link.lbtStats(); }
+};
+
+struct SimResult {
+  uint32_t offered;
+  uint32_t refused;
+  uint32_t sent;  // frames on air
+  uint32_t collided;
+  uint32_t busy;    // CAD found the channel busy
+  uint32_t forced;  // sent after LORA_LBT_MAX_TRIES busy checks
+  uint64_t cleanAirtime;  // us
+
+  // share of the frames on air that overlapped another one, in %
+  float collisionRate() const { return sent > 0 ? 100.0 * collided / sent : 0; }
+  // frames per minute that got through
+  float goodput() const {
+    return (sent - collided) * 60000000.0 / SIM_TIME;
+  }
+};
+
+static SimResult simulate(bool lbt, uint32_t meanInterval) {
+  fake_reset(1000000);
+  fake_air.clear();
+  randomSeed(17);
+
+  SimNode* nodes[SIM_NODES] = {new Node<1>(), new Node<2>(), new Node<3>(),
+                               new Node<4>()};
+  for (SimNode* node : nodes) node->begin(lbt, meanInterval);
+
+  uint64_t start = fake_now;
+  uint64_t end = start + SIM_TIME;
+  for (uint32_t pass = 0; fake_now < end; pass++) {
+    // a different node goes first in every pass
+    for (uint8_t i = 0; i < SIM_NODES; i++) {
+      nodes[(pass + i) % SIM_NODES]->pass();
+    }
+    Serial.output.clear();
+    delay(1);
+  }
+
+  SimResult result = {};
+  for (SimNode* node : nodes) {
+    result.offered += node->offered;
+    result.refused += node->refused;
+    result.busy += node->lbtStats().busy;
+    result.forced += node->lbtStats().forced;
+  }
+  for (const FakeAirFrame& frame : fake_air) {
+    if (frame.end > end) continue;
+    result.sent++;
+    bool collided = false;
+    for (const FakeAirFrame& other : fake_air) {
+      if (&other != &frame && other.start < frame.end &&
+          frame.start < other.end) {
+        collided = true;
+        break;
+      }
+    }
+    if (collided) {
+      result.collided++;
+    } else {
+      result.cleanAirtime += frame.end - frame.start;
+    }
+  }
+
+  for (SimNode* node : nodes) delete node;
+  return result;
+}
+
+static void report(const char* name, uint32_t meanInterval,
+                   const SimResult& result) {
+  char line[200];
+  snprintf(line, sizeof(line),
+           "%s, 1 frame per %u ms per node: %u offered, %u refused, %u sent, "
+           "%u collided (%.1f %%), goodput %.0f frames/min, channel %.1f %% "
+           "clean, %u busy CAD, %u forced",
+           name, (unsigned)meanInterval, (unsigned)result.offered,
+           (unsigned)result.refused, (unsigned)result.sent,
+           (unsigned)result.collided, result.collisionRate(), result.goodput(),
+           100.0 * result.cleanAirtime / SIM_TIME, (unsigned)result.busy,
+           (unsigned)result.forced);
+  TEST_MESSAGE(line);
+}
+
+void setUp() { Serial.output.clear(); }
+
+void tearDown() {}
+
+void test_light_load() {
+  // 4 nodes with a 31 ms frame every 2 s: 6 % of the channel offered
+  SimResult aloha = simulate(false, 2000);
+  SimResult lbt = simulate(true, 2000);
+  report("no LBT", 2000, aloha);
+  report("LBT", 2000, lbt);
+
+  TEST_ASSERT_LESS_THAN(aloha.collided, lbt.collided);
+  TEST_ASSERT_GREATER_OR_EQUAL(aloha.goodput(), lbt.goodput());
+}
+
+void test_heavy_load() {
+  // a frame every 250 ms: 50 % of the channel offered
+  SimResult aloha = simulate(false, 250);
+  SimResult lbt = simulate(true, 250);
+  report("no LBT", 250, aloha);
+  report("LBT", 250, lbt);
+
+  // without LBT about every second frame overlaps another one
+  TEST_ASSERT_GREATER_THAN(30.0, aloha.collisionRate());
+  TEST_ASSERT_LESS_THAN(aloha.collisionRate() / 2, lbt.collisionRate());
+  TEST_ASSERT_GREATER_THAN(aloha.goodput(), lbt.goodput());
+  TEST_ASSERT_GREATER_THAN(0, lbt.busy);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_light_load);
+  RUN_TEST(test_heavy_load);
+  return UNITY_END();
+}
@@ -0,0 +1,208 @@
+/**
+ * RX-to-handler latency of the event driven loop() against the old polling
+ * loop with delay(10), and a soak run of one simulated hour.
+ *
+ * Frames arrive at random times from a fake sender on the simulated clock.
+ * loop() takes them with receive() and measures the time since their RX
+ * done interrupt. With waitEvent() the interrupt ends the wait at once, with
+ * delay() the frame waits for the rest of the pass. The simulated clock
+ * only moves while loop() waits, so the latency is the waiting part; on the
+ * board the ISR and the handler add their few ten microseconds.
+ */
+#include <Arduino.h>
+#include <LoRaLink.h>
+#include <unity.h>
+
+typedef LoRaLink<SX1262, LoRaPins<8, 14, 12, 13>> HeltecLink;
+
+static const LoRaConfig config = {869.525, 125.0, 7, 5, 0x12, 14, true, 0};
+
+static HeltecLink* link;
+
+/**
+ * Delivers a frame to the link at random intervals of 50..500 ms, from the
+ * timer table of the fake clock, like the DIO interrupt of a real frame.
+ */
+struct FakeSender {
+  esp_timer timer;
+  uint32_t delivered;
+  uint32_t missed;  // radio out of receive mode
+
+  void start() {
+    timer = {onTimer, this, 0, false};
+    delivered = 0;
+    missed = 0;
+    schedule();
+  }
+
+  void schedule() {
+    fake_timer_start(&timer, fake_now + random(50, 500) * 1000);
+  }
+
+  static void onTimer(void* arg) {
+    FakeSender* sender = static_cast<FakeSender*>(arg);
+    const byte frame[] = {0xC1, 0x31, 'p', 'i', 'n', 'g', '\0'};
+    if (link->radio.receive(frame, sizeof(frame))) {
+      sender->delivered++;
+    } else {
+      sender->missed++;
+    }
+    sender->schedule();
+  }
+};
+
+static FakeSender sender;
+
+struct LatencyStats {
+  uint32_t frames;
+  uint32_t passes;  // loop() passes
+  uint64_t total;   // us
+  uint32_t max;     // us
+};
+
+// one loop() pass: take and release every received frame
+static void takeFrames(LatencyStats& stats) {
+  stats.passes++;
+  const LoRaRxFrame* frame;
+  while ((frame = link->receive()) != nullptr) {
+    uint32_t latency = micros() - frame->micros;
+    stats.frames++;
+    stats.total += latency;
+    if (latency > stats.max) stats.max = latency;
+    link->release();
+  }
+}
+
+static void report(const char* name, const LatencyStats& stats) {
+  char line[128];
+  snprintf(line, sizeof(line),
+           "%s: %u frames, latency mean %u us, max %u us, %u loop passes",
+           name, (unsigned)stats.frames,
+           (unsigned)(stats.frames ? stats.total / stats.frames : 0),
+           (unsigned)stats.max, (unsigned)stats.passes);
+  TEST_MESSAGE(line);
+}
+
+void setUp() {
+  fake_reset(1000000);
+  fake_air.clear();
+  fake_notifications = 0;
+  Serial.output.clear();
+  randomSeed(42);
+  link = new HeltecLink(0xC1);
+  link->begin(config);
+  sender.start();
+}
+
+void tearDown() {
+  fake_timer_stop(&sender.timer);
+  delete link;
+}
+
+void test_latency_polling_loop() {
+  // before: loop() polls and sleeps delay(10) every pass
+  LatencyStats stats = {};
+  uint64_t end = fake_now + 60000000ULL;
+  while (fake_now < end) {
+    takeFrames(stats);
+    delay(10);
+  }
+  report("delay(10)", stats);
+
+  TEST_ASSERT_GREATER_THAN(100, stats.frames);
+  // a frame waits for the rest of the pass, 5 ms on average
+  TEST_ASSERT_GREATER_THAN(3000, stats.total / stats.frames);
+}
+
+void test_latency_event_loop() {
+  // after: loop() sleeps in waitEvent(), the interrupt wakes it
+  LatencyStats stats = {};
+  uint64_t end = fake_now + 60000000ULL;
+  while (fake_now < end) {
+    takeFrames(stats);
+    link->waitEvent(10);
+  }
+  report("waitEvent(10)", stats);
+
+  TEST_ASSERT_GREATER_THAN(100, stats.frames);
+  TEST_ASSERT_LESS_THAN(1000, stats.max);
+  TEST_ASSERT_LESS_THAN(1000, link->eventStats().latency.max);
+}
+
+void test_idle_without_events() {
+  // a long timeout: loop() only runs when there is something to do
+  LatencyStats stats = {};
+  uint64_t end = fake_now + 60000000ULL;
+  while (fake_now < end) {
+    takeFrames(stats);
+    link->waitEvent(1000);
+  }
+  report("waitEvent(1000)", stats);
+
+  TEST_ASSERT_LESS_THAN(1000, stats.max);
+  // one pass per frame plus the timeouts of the quiet seconds
+  TEST_ASSERT_LESS_OR_EQUAL(sender.delivered + 60 + 1, stats.passes);
+}
+
+void test_wake_from_timer_and_isr() {
+  fake_timer_stop(&sender.timer);
+
+  // another task or a timer ends the wait, e.g. a display refresh
+  esp_timer refresh = {[](void*) { link->wake(); }, nullptr, 0, false};
+  fake_timer_start(&refresh, fake_now + 200000);
+  uint64_t start = fake_now;
+  link->waitEvent(1000);
+  TEST_ASSERT_EQUAL(200000, fake_now - start);
+
+  // a button interrupt
+  esp_timer button = {[](void*) { link->wakeFromISR(); }, nullptr, 0, false};
+  fake_timer_start(&button, fake_now + 300000);
+  start = fake_now;
+  link->waitEvent(1000);
+  TEST_ASSERT_EQUAL(300000, fake_now - start);
+
+  // nothing to wait for: the timeout
+  start = fake_now;
+  link->waitEvent(1000);
+  TEST_ASSERT_EQUAL(1000000, fake_now - start);
+}
+
+void test_soak_one_hour() {
+  // an hour of receptions, with an answer to every 10th frame
+  LatencyStats stats = {};
+  uint32_t answers = 0;
+  uint64_t end = fake_now + 3600000000ULL;
+  while (fake_now < end) {
+    uint32_t before = stats.frames;
+    takeFrames(stats);
+    if (stats.frames / 10 > before / 10 && link->transmitAvailable()) {
+      link->sendPacket(String("pong"), 0x31);
+      answers++;
+    }
+    link->poll();
+    link->waitEvent(10);
+  }
+  report("soak, 1 h", stats);
+
+  LoRaEventStats events = link->eventStats();
+  LoRaRxStats rx = link->rxStats();
+  TEST_ASSERT_GREATER_THAN(10000, stats.frames);
+  TEST_ASSERT_GREATER_THAN(0, answers);
+  TEST_ASSERT_EQUAL(sender.delivered, stats.frames);
+  TEST_ASSERT_EQUAL(sender.delivered, rx.received);
+  TEST_ASSERT_EQUAL(0, events.dropped);
+  TEST_ASSERT_EQUAL(0, rx.overruns);
+  TEST_ASSERT_LESS_THAN(1000, stats.max);
+  // frames sent while the radio transmitted an answer are lost
+  TEST_ASSERT_LESS_OR_EQUAL(answers, sender.missed);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_latency_polling_loop);
+  RUN_TEST(test_latency_event_loop);
+  RUN_TEST(test_idle_without_events);
+  RUN_TEST(test_wake_from_timer_and_isr);
+  RUN_TEST(test_soak_one_hour);
+  return UNITY_END();
+}
@@ -0,0 +1,138 @@
+/**
+ * Frame formats of LoRaFrame.h: parsing of v1 and v2 frames, the v1
+ * payloads that read as v2 header, and the sequence window.
+ */
+#include <Arduino.h>
+#include <LoRaLink.h>
+#include <unity.h>
+
+typedef LoRaLink<SX1262, LoRaPins<8, 14, 12, 13>> HeltecLink;
+
+static const LoRaConfig config = {869.525, 125.0, 7, 5, 0x12, 14, true, 0};
+
+static LoRaSeqWindow* window;
+
+void setUp() {
+  fake_reset(1000000);
+  fake_air.clear();
+  window = new LoRaSeqWindow();
+}
+
+void tearDown() { delete window; }
+
+void test_parse_v1() {
+  const byte data[] = {0x31, 0xC1, 'H', 'i', '\0'};
+  LoRaFrame frame;
+  TEST_ASSERT_TRUE(lora_parse_frame(data, sizeof(data), frame));
+  TEST_ASSERT_EQUAL(1, frame.version);
+  TEST_ASSERT_EQUAL_HEX8(0x31, frame.recipient);
+  TEST_ASSERT_EQUAL_HEX8(0xC1, frame.sender);
+  TEST_ASSERT_EQUAL(2, frame.length);
+  TEST_ASSERT_TRUE(lora_frame_text_equals(frame, "Hi"));
+}
+
+void test_parse_v2() {
+  const byte data[] = {0x31, 0xC1, LORA_V2_MARKER, 0x21, 7, 2, 'H', 'i'};
+  LoRaFrame frame;
+  TEST_ASSERT_TRUE(lora_parse_frame(data, sizeof(data), frame));
+  TEST_ASSERT_EQUAL(2, frame.version);
+  TEST_ASSERT_EQUAL(LORA_MSG_ANSWER, frame.type);
+  TEST_ASSERT_EQUAL(1, frame.flags);
+  TEST_ASSERT_EQUAL(7, frame.seq);
+  TEST_ASSERT_TRUE(lora_frame_text_equals(frame, "Hi"));
+}
+
+void test_parse_too_short() {
+  const byte data[] = {0x31};
+  LoRaFrame frame;
+  TEST_ASSERT_FALSE(lora_parse_frame(data, sizeof(data), frame));
+}
+
+void test_v1_ambiguous() {
+  // 0xE2 lead byte, 4th byte == bytes behind it: reads as v2 header
+  const byte ambiguous[] = {0xE2, 0x80, 0x93, 2, 'a', 'b'};
+  TEST_ASSERT_TRUE(lora_v1_ambiguous(ambiguous, sizeof(ambiguous)));
+  const byte plain[] = {0xE2, 0x80, 0x93, 'a', 'b', '\0'};
+  TEST_ASSERT_FALSE(lora_v1_ambiguous(plain, sizeof(plain)));
+  const byte text[] = {'a', 'b', 'c', 2, 'a', 'b'};
+  TEST_ASSERT_FALSE(lora_v1_ambiguous(text, sizeof(text)));
+  TEST_ASSERT_FALSE(lora_v1_ambiguous(ambiguous, 3));
+}
+
+void test_v1_ambiguous_not_sent() {
+  HeltecLink* link = new HeltecLink(0xC1);
+  link->begin(config);
+
+  const byte ambiguous[] = {0xE2, 0x80, 0x93, 2, 'a', 'b'};
+  TEST_ASSERT_FALSE(link->sendPacket(ambiguous, sizeof(ambiguous), 0x31));
+  TEST_ASSERT_EQUAL(0, link->radio.transmits);
+
+  // fine as v2 frame, the length byte tells the payload apart
+  link->setFrameVersion(2);
+  TEST_ASSERT_TRUE(link->sendPacket(ambiguous, sizeof(ambiguous), 0x31));
+  LoRaFrame frame;
+  const FakeAirFrame* sent = link->radio.sent()[0];
+  TEST_ASSERT_TRUE(lora_parse_frame(sent->data.data(), sent->data.size(),
+                                    frame));
+  TEST_ASSERT_EQUAL(sizeof(ambiguous), frame.length);
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(ambiguous, frame.payload, sizeof(ambiguous));
+  delete link;
+}
+
+void test_seq_duplicates() {
+  TEST_ASSERT_TRUE(window->accept(0x31, 10));
+  TEST_ASSERT_FALSE(window->accept(0x31, 10));
+  TEST_ASSERT_TRUE(window->accept(0x31, 11));
+  TEST_ASSERT_TRUE(window->accept(0x31, 13));
+  // late frame within the window, once
+  TEST_ASSERT_TRUE(window->accept(0x31, 12));
+  TEST_ASSERT_FALSE(window->accept(0x31, 12));
+  TEST_ASSERT_FALSE(window->accept(0x31, 11));
+  // other senders have their own window
+  TEST_ASSERT_TRUE(window->accept(0x32, 11));
+}
+
+void test_seq_wraps() {
+  TEST_ASSERT_TRUE(window->accept(0x31, 254));
+  TEST_ASSERT_TRUE(window->accept(0x31, 255));
+  TEST_ASSERT_TRUE(window->accept(0x31, 0));
+  TEST_ASSERT_TRUE(window->accept(0x31, 1));
+  TEST_ASSERT_FALSE(window->accept(0x31, 255));
+}
+
+void test_seq_restart_behind_window() {
+  for (uint8_t seq = 100; seq < 110; seq++) {
+    TEST_ASSERT_TRUE(window->accept(0x31, seq));
+  }
+  // the sender reboots and starts again at a number it used just before
+  delay(3000);
+  TEST_ASSERT_TRUE(window->accept(0x31, 105));
+  TEST_ASSERT_TRUE(window->accept(0x31, 106));
+  TEST_ASSERT_FALSE(window->accept(0x31, 106));
+  // its new sequence passes the old one without drops
+  for (uint8_t seq = 107; seq < 115; seq++) {
+    TEST_ASSERT_TRUE(window->accept(0x31, seq));
+  }
+}
+
+void test_seq_restart_far_behind() {
+  TEST_ASSERT_TRUE(window->accept(0x31, 200));
+  // beyond the window even without a pause
+  TEST_ASSERT_TRUE(window->accept(0x31, 100));
+  TEST_ASSERT_TRUE(window->accept(0x31, 101));
+  TEST_ASSERT_FALSE(window->accept(0x31, 100));
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_parse_v1);
+  RUN_TEST(test_parse_v2);
+  RUN_TEST(test_parse_too_short);
+  RUN_TEST(test_v1_ambiguous);
+  RUN_TEST(test_v1_ambiguous_not_sent);
+  RUN_TEST(test_seq_duplicates);
+  RUN_TEST(test_seq_wraps);
+  RUN_TEST(test_seq_restart_behind_window);
+  RUN_TEST(test_seq_restart_far_behind);
+  return UNITY_END();
+}
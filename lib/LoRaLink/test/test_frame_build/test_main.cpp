@@ -0,0 +1,238 @@
+/**
+ * Benchmark of the in-place frame build against the two lora_send_packet()
+ * overloads the firmwares had before LoRaLink: bytes copied and stack used
+ * per frame, from the call to the radio's startTransmit().
+ *
+ * The old overloads are kept here as they were, with a counter of the bytes
+ * they copied. The stack use is the distance from the caller's frame to the
+ * frame of startTransmit() in the fake radio, so it includes the stack
+ * arrays of the old path and the call chain of the new one. The absolute
+ * numbers are those of the host compiler, what carries over to the ESP32 is
+ * that the old path grows with the payload and the new one does not.
+ */
+#include <Arduino.h>
+#include <LoRaLink.h>
+#include <unity.h>
+
+typedef LoRaLink<SX1262, LoRaPins<8, 14, 12, 13>> HeltecLink;
+
+static const LoRaConfig config = {869.525, 125.0, 7, 5, 0x12, 14, true, 0};
+
+// frames of every size up to the largest v1 String payload
+#define BENCH_MAX_TEXT (LORA_MAX_PAYLOAD_SIZE - 1)
+
+static HeltecLink* link;
+static SX1262* legacy_radio;
+static uint32_t legacy_copied;
+
+/**
+ * The send path before LoRaLink: String -> bytePayload -> message, two
+ * variable length arrays on the stack.
+ */
+__attribute__((noinline)) static bool legacy_send_packet(byte payload[],
+                                                         size_t size,
+                                                         byte recipient) {
+  if (size >= 254) {
+    return false;
+  }
+  byte header[] = {recipient, 0xC1};
+  byte message[sizeof(header) + size];
+  memcpy(message, header, sizeof(header));
+  memcpy(message + sizeof(header), payload, size);
+  legacy_copied += sizeof(header) + size;
+  legacy_radio->startTransmit(message, sizeof(message));
+  return true;
+}
+
+__attribute__((noinline)) static bool legacy_send_packet(String payload,
+                                                         byte recipient) {
+  int payloadSize = payload.length() + 1;
+  byte bytePayload[payloadSize];
+  payload.getBytes(bytePayload, sizeof(bytePayload));
+  legacy_copied += payloadSize;
+  return legacy_send_packet(bytePayload, sizeof(bytePayload), recipient);
+}
+
+static String text(size_t size) {
+  String value;
+  for (size_t i = 0; i < size; i++) value += String((char)('a' + i % 26));
+  return value;
+}
+
+// stack used by send() down to the startTransmit() of the radio
+template <typename Send>
+__attribute__((noinline)) static uint32_t stackUsed(const SX1262& radio,
+                                                    Send send) {
+  uintptr_t top = (uintptr_t)__builtin_frame_address(0);
+  send();
+  return top - radio.lastStack;
+}
+
+// sends with the link idle again, the duty cycle does not matter here
+static void finish() {
+  fake_advance(200000);
+  link->txDone();
+  fake_reset(fake_now + 3600000000ULL);
+}
+
+void setUp() {
+  fake_reset(1000000);
+  fake_air.clear();
+  Serial.output.clear();
+  legacy_copied = 0;
+  legacy_radio = new SX1262(new Module(0, 0, 0, 0));
+  link = new HeltecLink(0xC1);
+  link->begin(config);
+}
+
+void tearDown() {
+  delete link;
+  delete legacy_radio;
+}
+
+void test_in_place_frame_is_not_moved() {
+  byte* payload = link->framePayload();
+  memcpy(payload, "in place", 8);
+  TEST_ASSERT_TRUE(link->sendFrame(8, 0x31));
+
+  // the radio sends the very memory the payload was written to
+  TEST_ASSERT_TRUE(link->radio.lastData == payload - LORA_HEADER_SIZE);
+  const byte expected[] = {0x31, 0xC1, 'i', 'n', ' ', 'p', 'l', 'a', 'c', 'e'};
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, link->radio.lastData,
+                               sizeof(expected));
+}
+
+void test_byte_payload_copied_once() {
+  const byte payload[] = {1, 2, 3, 4};
+  TEST_ASSERT_TRUE(link->sendPacket(payload, sizeof(payload), 0x31));
+
+  // copied into the queue slot behind the header, sent from there
+  TEST_ASSERT_TRUE(link->radio.lastData != payload);
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(payload, link->radio.lastData + 2,
+                               sizeof(payload));
+}
+
+void test_frame_matches_legacy() {
+  String message = text(40);
+  legacy_send_packet(message, 0x31);
+  finish();
+  link->sendPacket(message, 0x31);
+
+  std::vector<const FakeAirFrame*> before = legacy_radio->sent();
+  std::vector<const FakeAirFrame*> after = link->radio.sent();
+  TEST_ASSERT_EQUAL(1, before.size());
+  TEST_ASSERT_EQUAL(1, after.size());
+  TEST_ASSERT_EQUAL(before[0]->data.size(), after[0]->data.size());
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(before[0]->data.data(), after[0]->data.data(),
+                               before[0]->data.size());
+}
+
+void test_cached_frame_stats() {
+  LoRaFrameCache<1, 80> cache;
+  const byte message[] = "cached";
+  ESP.freeHeap = 200000;
+  ESP.minFreeHeap = 190000;
+  LoRaCachedFrame* entry = cache.slotFor(0xFF, 0, 0);
+  TEST_ASSERT_TRUE(link->encodeFrame(*entry, message, sizeof(message), 0xFF));
+  cache.record(false, 100);
+  for (int i = 0; i < 3; i++) {
+    TEST_ASSERT_TRUE(link->sendCached(*entry));
+    cache.record(true, 10);
+    finish();
+  }
+  ESP.freeHeap = 199000;
+
+  // the radio sends the cache entry itself
+  TEST_ASSERT_TRUE(link->radio.lastData == entry->frame);
+  LoRaFrameCacheStats stats = cache.cacheStats();
+  TEST_ASSERT_EQUAL(3, stats.hits);
+  TEST_ASSERT_EQUAL(1, stats.misses);
+  TEST_ASSERT_EQUAL(200000, stats.heapBefore);
+  TEST_ASSERT_EQUAL(190000, stats.minFreeBefore);
+  TEST_ASSERT_EQUAL(199000, stats.heapAfter);
+  stats.print(Serial);
+  TEST_ASSERT_TRUE(Serial.output.find("3 hits, avg 10us/frame") !=
+                   std::string::npos);
+  TEST_ASSERT_TRUE(Serial.output.find("199000 bytes free (200000 at first "
+                                      "frame), min free 190000 (190000)") !=
+                   std::string::npos);
+}
+
+void test_benchmark_copies_and_stack() {
+  char line[160];
+  uint32_t legacyStringStack = 0, legacyBytesStack = 0;
+  uint32_t stringStack = 0, bytesStack = 0, inPlaceStack = 0;
+  uint32_t smallest[5] = {};
+  const size_t sizes[] = {10, 50, 100, BENCH_MAX_TEXT};
+
+  TEST_MESSAGE("payload | bytes copied old String/byte -> new String/byte/"
+               "in place | stack old String/byte -> new String/byte/in place");
+  for (size_t size : sizes) {
+    String message = text(size);
+    byte payload[LORA_MAX_PAYLOAD_SIZE];
+    message.getBytes(payload, sizeof(payload));
+
+    legacy_copied = 0;
+    legacyStringStack = stackUsed(
+        *legacy_radio, [&] { legacy_send_packet(message, 0x31); });
+    uint32_t legacyString = legacy_copied;
+
+    legacy_copied = 0;
+    legacyBytesStack = stackUsed(
+        *legacy_radio, [&] { legacy_send_packet(payload, size + 1, 0x31); });
+    uint32_t legacyBytes = legacy_copied;
+
+    stringStack =
+        stackUsed(link->radio, [&] { link->sendPacket(message, 0x31); });
+    finish();
+    bytesStack = stackUsed(
+        link->radio, [&] { link->sendPacket(payload, size + 1, 0x31); });
+    finish();
+    inPlaceStack = stackUsed(link->radio, [&] {
+      message.getBytes(link->framePayload(), size + 1);
+      link->sendFrame(size + 1, 0x31);
+    });
+    finish();
+
+    // the new paths copy the payload once (String, byte array) or never
+    // (in place), the header bytes are written in front of it
+    snprintf(line, sizeof(line),
+             "%3u B | %u/%u -> %u/%u/0 | %u/%u -> %u/%u/%u", (unsigned)size,
+             (unsigned)legacyString, (unsigned)legacyBytes,
+             (unsigned)(size + 1), (unsigned)(size + 1),
+             (unsigned)legacyStringStack, (unsigned)legacyBytesStack,
+             (unsigned)stringStack, (unsigned)bytesStack,
+             (unsigned)inPlaceStack);
+    TEST_MESSAGE(line);
+
+    TEST_ASSERT_EQUAL(2 * (size + 1) + LORA_HEADER_SIZE, legacyString);
+    TEST_ASSERT_EQUAL(size + 1 + LORA_HEADER_SIZE, legacyBytes);
+    if (size == sizes[0]) {
+      smallest[0] = legacyStringStack;
+      smallest[1] = legacyBytesStack;
+      smallest[2] = stringStack;
+      smallest[3] = bytesStack;
+      smallest[4] = inPlaceStack;
+    }
+  }
+
+  // the two stack arrays of the old path grow with the payload (give or
+  // take their alignment), the frame of the new path is the queue slot, its
+  // stack use stays the same
+  size_t growth = BENCH_MAX_TEXT - sizes[0] - 16;
+  TEST_ASSERT_GREATER_OR_EQUAL(smallest[0] + 2 * growth, legacyStringStack);
+  TEST_ASSERT_GREATER_OR_EQUAL(smallest[1] + growth, legacyBytesStack);
+  TEST_ASSERT_EQUAL(smallest[2], stringStack);
+  TEST_ASSERT_EQUAL(smallest[3], bytesStack);
+  TEST_ASSERT_EQUAL(smallest[4], inPlaceStack);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_in_place_frame_is_not_moved);
+  RUN_TEST(test_byte_payload_copied_once);
+  RUN_TEST(test_frame_matches_legacy);
+  RUN_TEST(test_cached_frame_stats);
+  RUN_TEST(test_benchmark_copies_and_stack);
+  return UNITY_END();
+}
@@ -0,0 +1,298 @@
+/**
+ * Bring-up, framed send and duty cycle gate of LoRaLink against the fake
+ * radio of test/fake, for both chips.
+ */
+#include <Arduino.h>
+#include <LoRaLink.h>
+#include <unity.h>
+
+typedef LoRaLink<SX1262, LoRaPins<8, 14, 12, 13>> HeltecLink;
+typedef LoRaLink<SX1276, LoRaPins<18, 26, 23, 32>> TBeamLink;
+
+// 868.1 MHz: 1 % duty cycle, 36 s of airtime per hour
+static const LoRaConfig config = {868.1, 125.0, 7, 5, 0x12, 14, true, 0};
+
+static HeltecLink* heltec;
+static TBeamLink* tbeam;
+
+void setUp() {
+  fake_reset(1000000);
+  fake_air.clear();
+  Serial.output.clear();
+  heltec = new HeltecLink(0xC1);
+  tbeam = new TBeamLink(0x31);
+}
+
+void tearDown() {
+  delete heltec;
+  delete tbeam;
+}
+
+// runs 1 ms loop() passes until the last queued frame is done
+template <class Link>
+static bool waitTxDone(Link& link, uint32_t timeout = 1000) {
+  for (uint32_t ms = 0; ms < timeout; ms++) {
+    if (link.txDone()) return true;
+    link.poll();
+    delay(1);
+  }
+  return false;
+}
+
+void test_begin_applies_config() {
+  heltec->begin(config);
+
+  TEST_ASSERT_FLOAT_WITHIN(0.001, 868.1, heltec->radio.frequency);
+  TEST_ASSERT_FLOAT_WITHIN(0.001, 125.0, heltec->radio.bandwidth);
+  TEST_ASSERT_EQUAL(7, heltec->radio.spreadingFactor);
+  TEST_ASSERT_EQUAL(5, heltec->radio.codingRate);
+  TEST_ASSERT_EQUAL_HEX8(0x12, heltec->radio.syncWord);
+  TEST_ASSERT_EQUAL(14, heltec->radio.outputPower);
+  TEST_ASSERT_TRUE(heltec->radio.crc);
+  // listening right away
+  TEST_ASSERT_EQUAL(FAKE_RX, heltec->radio.mode);
+  TEST_ASSERT_EQUAL(LORA_STATE_RECEIVE, heltec->state());
+  TEST_ASSERT_TRUE(heltec->transmitAvailable());
+}
+
+void test_begin_transmit_only() {
+  tbeam->begin(config, false);
+
+  TEST_ASSERT_FLOAT_WITHIN(0.001, 868.1, tbeam->radio.frequency);
+  TEST_ASSERT_EQUAL(0, tbeam->radio.receives);
+  TEST_ASSERT_EQUAL(FAKE_STANDBY, tbeam->radio.mode);
+  TEST_ASSERT_TRUE(tbeam->transmitAvailable());
+}
+
+void test_send_packet_v1() {
+  heltec->begin(config);
+
+  TEST_ASSERT_TRUE(heltec->sendPacket(String("Hello"), 0x31));
+  TEST_ASSERT_EQUAL(LORA_STATE_TX, heltec->state());
+  TEST_ASSERT_EQUAL(FAKE_TX, heltec->radio.mode);
+
+  const byte expected[] = {0x31, 0xC1, 'H', 'e', 'l', 'l', 'o', '\0'};
+  TEST_ASSERT_EQUAL(1, heltec->radio.sent().size());
+  const FakeAirFrame* frame = heltec->radio.sent()[0];
+  TEST_ASSERT_EQUAL(sizeof(expected), frame->data.size());
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, frame->data.data(), sizeof(expected));
+
+  // TX done after the time-on-air, back in receive mode
+  TEST_ASSERT_TRUE(waitTxDone(*heltec));
+  TEST_ASSERT_EQUAL(LORA_STATE_RECEIVE, heltec->state());
+  TEST_ASSERT_EQUAL(FAKE_RX, heltec->radio.mode);
+  TEST_ASSERT_EQUAL(1, heltec->txStats().sent);
+}
+
+void test_send_packet_v2() {
+  tbeam->begin(config, false);
+  tbeam->setFrameVersion(2);
+
+  const byte payload[] = {1, 2, 3};
+  TEST_ASSERT_TRUE(
+      tbeam->sendPacket(payload, sizeof(payload), 0xC1, LORA_MSG_REQUEST, 5));
+  TEST_ASSERT_TRUE(waitTxDone(*tbeam));
+  TEST_ASSERT_EQUAL(LORA_STATE_TX_DONE, tbeam->state());
+  TEST_ASSERT_TRUE(
+      tbeam->sendPacket(payload, sizeof(payload), 0xC1, LORA_MSG_REQUEST, 5));
+  TEST_ASSERT_TRUE(waitTxDone(*tbeam));
+
+  std::vector<const FakeAirFrame*> sent = tbeam->radio.sent();
+  TEST_ASSERT_EQUAL(2, sent.size());
+  LoRaFrame first, second;
+  TEST_ASSERT_TRUE(
+      lora_parse_frame(sent[0]->data.data(), sent[0]->data.size(), first));
+  TEST_ASSERT_TRUE(
+      lora_parse_frame(sent[1]->data.data(), sent[1]->data.size(), second));
+  TEST_ASSERT_EQUAL(2, first.version);
+  TEST_ASSERT_EQUAL_HEX8(0xC1, first.recipient);
+  TEST_ASSERT_EQUAL_HEX8(0x31, first.sender);
+  TEST_ASSERT_EQUAL(LORA_MSG_REQUEST, first.type);
+  TEST_ASSERT_EQUAL(5, first.flags);
+  TEST_ASSERT_EQUAL(sizeof(payload), first.length);
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(payload, first.payload, sizeof(payload));
+  TEST_ASSERT_EQUAL_UINT8((uint8_t)(first.seq + 1), second.seq);
+}
+
+void test_payload_too_large() {
+  heltec->begin(config);
+
+  byte payload[LORA_MAX_PAYLOAD_SIZE + 1] = {};
+  TEST_ASSERT_FALSE(heltec->sendPacket(payload, sizeof(payload), 0x31));
+  TEST_ASSERT_EQUAL(0, heltec->radio.transmits);
+}
+
+void test_tx_interval() {
+  LoRaConfig paced = config;
+  paced.txInterval = 1000;
+  heltec->begin(paced);
+
+  heltec->sendPacket(String("Hello"), 0x31);
+  TEST_ASSERT_TRUE(waitTxDone(*heltec));
+  TEST_ASSERT_FALSE(heltec->transmitAvailable());
+  RadioLibTime_t wait = heltec->dutyCycleWait();
+  TEST_ASSERT_GREATER_THAN(900, wait);
+  TEST_ASSERT_LESS_OR_EQUAL(1000, wait);
+
+  delay(wait + 1);
+  TEST_ASSERT_TRUE(heltec->transmitAvailable());
+}
+
+void test_queued_frame_waits_for_interval() {
+  LoRaConfig paced = config;
+  paced.txInterval = 500;
+  heltec->begin(paced);
+
+  // the second frame waits in the queue, the TX timer sends it
+  TEST_ASSERT_TRUE(heltec->sendPacket(String("one"), 0x31));
+  TEST_ASSERT_TRUE(heltec->sendPacket(String("two"), 0x31));
+  TEST_ASSERT_EQUAL(1, heltec->queueDepth());
+  TEST_ASSERT_TRUE(waitTxDone(*heltec, 2000));
+
+  std::vector<const FakeAirFrame*> sent = heltec->radio.sent();
+  TEST_ASSERT_EQUAL(2, sent.size());
+  uint64_t gap = sent[1]->start - sent[0]->end;
+  TEST_ASSERT_GREATER_OR_EQUAL(500000, gap);
+  TEST_ASSERT_LESS_THAN(502000, gap);
+  TEST_ASSERT_EQUAL(2, heltec->txStats().sent);
+}
+
+void test_tx_timer_leaves_radio_to_loop() {
+  LoRaConfig paced = config;
+  paced.txInterval = 500;
+  heltec->begin(paced);
+
+  heltec->sendPacket(String("one"), 0x31);
+  heltec->sendPacket(String("two"), 0x31);
+  fake_advance(100000);
+  // TX done handled, the next frame waits for the TX timer
+  TEST_ASSERT_EQUAL(LORA_STATE_RECEIVE, heltec->state());
+  TEST_ASSERT_EQUAL(1, heltec->queueDepth());
+
+  // the TX timer expires without loop() running: nothing is sent
+  fake_advance(1000000);
+  TEST_ASSERT_EQUAL(1, heltec->radio.transmits);
+  // the next loop() pass sends the frame
+  heltec->poll();
+  TEST_ASSERT_EQUAL(2, heltec->radio.transmits);
+}
+
+void test_listens_between_queued_frames() {
+  LoRaConfig paced = config;
+  paced.txInterval = 500;
+  heltec->begin(paced);
+
+  heltec->sendPacket(String("one"), 0x31);
+  heltec->sendPacket(String("two"), 0x31);
+  for (int ms = 0; ms < 100; ms++) {
+    heltec->poll();
+    delay(1);
+  }
+  // back in receive mode while the second frame waits for the interval
+  TEST_ASSERT_EQUAL(LORA_STATE_RECEIVE, heltec->state());
+  TEST_ASSERT_EQUAL(FAKE_RX, heltec->radio.mode);
+  TEST_ASSERT_FALSE(heltec->transmitAvailable());
+
+  // a frame arriving in the gap is received
+  const byte frame[] = {0xC1, 0x31, 'h', 'i', '\0'};
+  TEST_ASSERT_TRUE(heltec->radio.receive(frame, sizeof(frame)));
+  const LoRaRxFrame* received = heltec->receive();
+  TEST_ASSERT_NOT_NULL(received);
+  TEST_ASSERT_EQUAL(sizeof(frame), received->length);
+  heltec->release();
+
+  // poll() leaves the waiting frame to the TX timer
+  heltec->poll();
+  TEST_ASSERT_EQUAL(1, heltec->radio.transmits);
+  TEST_ASSERT_TRUE(waitTxDone(*heltec, 1000));
+  TEST_ASSERT_EQUAL(2, heltec->radio.transmits);
+  TEST_ASSERT_EQUAL(FAKE_RX, heltec->radio.mode);
+
+  // blind only while on air: two frames of 6 bytes, 23 ms each, give or
+  // take the 1 ms loop() passes until TX done is handled
+  std::vector<const FakeAirFrame*> sent = heltec->radio.sent();
+  uint32_t onAir = (sent[0]->end - sent[0]->start) / 1000 +
+                   (sent[1]->end - sent[1]->start) / 1000;
+  LoRaBlindStats blind = heltec->blindStats();
+  TEST_ASSERT_EQUAL(2, blind.txGaps);
+  TEST_ASSERT_GREATER_OR_EQUAL(onAir, blind.txTime);
+  TEST_ASSERT_LESS_OR_EQUAL(onAir + 2, blind.txTime);
+}
+
+void test_listens_during_lbt_backoff() {
+  heltec->begin(config);
+  heltec->setListenBeforeTalk(true);
+  heltec->radio.busyScans = 1;
+
+  heltec->sendPacket(String("one"), 0x31);
+  // channel busy: no frame on air, the radio listens during the backoff
+  TEST_ASSERT_EQUAL(0, heltec->radio.transmits);
+  TEST_ASSERT_EQUAL(LORA_STATE_RECEIVE, heltec->state());
+  TEST_ASSERT_EQUAL(FAKE_RX, heltec->radio.mode);
+  TEST_ASSERT_EQUAL(0, heltec->blindStats().txGaps);
+
+  TEST_ASSERT_TRUE(waitTxDone(*heltec, 2000));
+  TEST_ASSERT_EQUAL(1, heltec->radio.transmits);
+  TEST_ASSERT_EQUAL(2, heltec->lbtStats().checks);
+  TEST_ASSERT_EQUAL(1, heltec->lbtStats().busy);
+}
+
+void test_tx_wait_beyond_32_bit_micros() {
+  // 2 h between frames: 7.2e9 us do not fit into 32 bits
+  LoRaConfig paced = config;
+  paced.txInterval = 7200000;
+  heltec->begin(paced);
+
+  heltec->sendPacket(String("one"), 0x31);
+  heltec->sendPacket(String("two"), 0x31);
+  // loop() passes sleeping in waitEvent(), for 3 hours
+  for (uint32_t pass = 0; pass < 3 * 3600; pass++) {
+    heltec->poll();
+    heltec->waitEvent(1000);
+  }
+
+  std::vector<const FakeAirFrame*> sent = heltec->radio.sent();
+  TEST_ASSERT_EQUAL(2, sent.size());
+  uint64_t gap = sent[1]->start - sent[0]->end;
+  TEST_ASSERT_GREATER_OR_EQUAL(7200000000ULL, gap);
+  TEST_ASSERT_LESS_THAN(7201000000ULL, gap);
+}
+
+void test_airtime_budget() {
+  heltec->begin(config);
+
+  // 22 byte frames: 31 ms of airtime each, 1161 fit into 36 s
+  const byte payload[20] = {};
+  uint32_t frames = 0;
+  while (heltec->transmitAvailable() && frames < 2000) {
+    TEST_ASSERT_TRUE(heltec->sendPacket(payload, sizeof(payload), 0x31));
+    TEST_ASSERT_TRUE(waitTxDone(*heltec));
+    frames++;
+  }
+  TEST_ASSERT_EQUAL(36000 / 31, frames);
+  TEST_ASSERT_LESS_OR_EQUAL(36000, heltec->airtimeBudget().used(millis()));
+
+  // the airtime drops out of the window an hour after it was used
+  RadioLibTime_t wait = heltec->dutyCycleWait();
+  TEST_ASSERT_GREATER_THAN(0, wait);
+  TEST_ASSERT_LESS_OR_EQUAL(3660000, wait);
+  delay(wait);
+  TEST_ASSERT_TRUE(heltec->transmitAvailable());
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_begin_applies_config);
+  RUN_TEST(test_begin_transmit_only);
+  RUN_TEST(test_send_packet_v1);
+  RUN_TEST(test_send_packet_v2);
+  RUN_TEST(test_payload_too_large);
+  RUN_TEST(test_tx_interval);
+  RUN_TEST(test_queued_frame_waits_for_interval);
+  RUN_TEST(test_tx_timer_leaves_radio_to_loop);
+  RUN_TEST(test_listens_between_queued_frames);
+  RUN_TEST(test_listens_during_lbt_backoff);
+  RUN_TEST(test_tx_wait_beyond_32_bit_micros);
+  RUN_TEST(test_airtime_budget);
+  return UNITY_END();
+}
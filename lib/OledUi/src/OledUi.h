@@ -0,0 +1,444 @@
+/**
+ * @file OledUi.h
+ * @brief Retained-mode text widgets on top of the SSD1306 driver.
+ *
+ * The firmwares used to clear and redraw the whole screen and push it over
+ * I2C in every loop() pass. With OledUi, labels are created once and loop()
+ * only sets their text: a label is redrawn when its text changed, together
+ * with the labels it overlaps, and at most OLED_UI_MAX_FPS frames per second
+ * are flushed. The double buffer of the driver then sends only the 8-pixel
+ * pages and columns that changed.
+ *
+ * After begin(), drawing and flushing run in a task on the other core and
+ * render() only hands a snapshot of the texts over, so loop() and the radio
+ * never wait for the I2C bus. The snapshot is passed through a lock-free
+ * triple buffer: loop() always has a slot to write and the task always
+ * reads the latest complete one.
+ *
+ *   OledUi ui(display);
+ *   uint8_t ui_status = ui.label(0, 50, ArialMT_Plain_10, TEXT_ALIGN_LEFT);
+ *   ...
+ *   display.init();
+ *   ui.begin();
+ *   ...
+ *   ui.set(ui_status, "LORA TX");
+ *   ui.render();
+ */
+#pragma once
+
+#include <Arduino.h>
+#include <OLEDDisplay.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <algorithm>
+#include <atomic>
+
+#ifndef OLED_UI_MAX_WIDGETS
+#define OLED_UI_MAX_WIDGETS 16
+#endif
+
+// longest text of a label, including the '\0'
+#ifndef OLED_UI_TEXT_SIZE
+#define OLED_UI_TEXT_SIZE 40
+#endif
+
+#ifndef OLED_UI_MAX_FPS
+#define OLED_UI_MAX_FPS 10
+#endif
+
+// ms between the frame statistics on Serial, 0 == off
+#ifndef OLED_UI_STATS_INTERVAL
+#define OLED_UI_STATS_INTERVAL 60000
+#endif
+
+// single core chips draw in loop()
+#if CONFIG_FREERTOS_UNICORE && !defined(OLED_UI_INLINE)
+#define OLED_UI_INLINE
+#endif
+
+// below the esp_timer task of the radio on the same core
+#define OLED_UI_TASK_PRIORITY 1
+#define OLED_UI_TASK_STACK 4096
+
+// I2C bytes of a full frame as SSD1306Wire sends it: 6 addressing commands
+// of address, control and command byte, then 1024 data bytes in chunks of
+// 16, each with its address and control byte
+#define OLED_UI_FULL_FRAME_BYTES (6 * 3 + 1024 + 1024 / 16 * 2)
+
+/**
+ * Frame counters since start. A pass is a call of render(), i.e. a loop()
+ * pass that used to redraw and flush the full frame.
+ */
+struct OledUiStats {
+  uint32_t passes;         // render() calls
+  uint32_t frames;         // flushes to the display
+  uint32_t frameTime;      // us, redraw and flush, total
+  uint32_t maxFrameTime;   // us, since the last printStats()
+  uint32_t i2cBytes;       // sent by display(), see flushBytes()
+  uint32_t loopTime;       // us, spent in render() by loop(), total
+  uint32_t maxLoopTime;    // us, since the last printStats()
+  uint32_t flushTime;      // us, in display.display(), total
+  uint32_t fullFlushTime;  // us, one display.display() of the full frame
+};
+
+class OledUi {
+ public:
+  explicit OledUi(OLEDDisplay& display) : display(display) {}
+
+  /**
+   * Adds a text label at x, y (top edge) in the given font, aligned to x.
+   * Returns its id for set(). Halts if there are more than
+   * OLED_UI_MAX_WIDGETS labels.
+   */
+  uint8_t label(int16_t x, int16_t y, const uint8_t* font,
+                OLEDDISPLAY_TEXT_ALIGNMENT align) {
+    if (count >= OLED_UI_MAX_WIDGETS) {
+      Serial.println(F("Too many display widgets!"));
+      while (true);
+    }
+    Widget& widget = widgets[count];
+    widget.x = x;
+    widget.y = y;
+    widget.font = font;
+    widget.align = align;
+    return count++;
+  }
+
+  /**
+   * Starts the UI task on the core loop() does not run on. Call after
+   * display.init(), from then on only the task touches the display. Build
+   * with OLED_UI_INLINE to draw in render() again and compare the
+   * ISR-to-handler latency of LoRaLink::eventStats().
+   */
+  void begin() {
+#ifndef OLED_UI_INLINE
+    xTaskCreatePinnedToCore(uiTask, "oled_ui", OLED_UI_TASK_STACK, this,
+                            OLED_UI_TASK_PRIORITY, &ui_task,
+                            1 - xPortGetCoreID());
+#endif
+  }
+
+  /**
+   * Sets the text of a label, an empty text hides it. Setting the same text
+   * in every loop() pass costs a string compare.
+   */
+  void set(uint8_t id, const char* text) {
+    char* current = texts.text[id];
+    if (strncmp(current, text, OLED_UI_TEXT_SIZE - 1) == 0) {
+      return;
+    }
+    strncpy(current, text, OLED_UI_TEXT_SIZE - 1);
+    current[OLED_UI_TEXT_SIZE - 1] = '\0';
+    changed = true;
+  }
+
+  void set(uint8_t id, const String& text) { set(id, text.c_str()); }
+
+  /**
+   * Hands the changed texts to the UI task. Without the task, redraws and
+   * flushes them unless the last frame is less than 1/OLED_UI_MAX_FPS s
+   * ago. Call once per loop() pass, instead of display.display().
+   */
+  void render() {
+    uint32_t start = micros();
+    uint32_t now = millis();
+    passes++;
+
+    if (changed && ui_task != nullptr) {
+      publish();
+    } else if (changed && now - last_frame >= 1000 / OLED_UI_MAX_FPS) {
+      last_frame = now;
+      changed = false;
+      draw(texts);
+    }
+
+    uint32_t time = micros() - start;
+    loop_time += time;
+    if (time > max_loop_time) max_loop_time = time;
+
+#if OLED_UI_STATS_INTERVAL > 0
+    if (now - stats_start >= OLED_UI_STATS_INTERVAL) {
+      printStats(Serial);
+    }
+#endif
+  }
+
+  OledUiStats frameStats() const {
+    return {passes,    frames,        frame_time, max_frame_time,
+            i2c_bytes, loop_time,     max_loop_time, flush_time,
+            full_flush_time};
+  }
+
+  /**
+   * Prints frames per second, frame time, the time loop() spent in render()
+   * and the I2C bytes per second since the last call, next to the bytes a
+   * full redraw and flush in every pass would have cost. The flush line
+   * compares the average partial flush with the full frame flush measured on
+   * the first frame. The heap line follows: with the labels formatted in
+   * place, the largest free block should stay the same over the day.
+   */
+  void printStats(Print& out) {
+    uint32_t now = millis();
+    uint32_t seconds = (now - stats_start) / 1000;
+    if (seconds == 0) seconds = 1;
+    OledUiStats total = frameStats();
+    uint32_t frameCount = total.frames - printed.frames;
+    uint32_t passCount = total.passes - printed.passes;
+
+    out.print("Display: ");
+    out.print(frameCount / seconds);
+    out.print(" fps, frame avg ");
+    out.print(frameCount > 0
+                  ? (total.frameTime - printed.frameTime) / frameCount
+                  : 0);
+    out.print("us max ");
+    out.print(total.maxFrameTime);
+    out.print("us, loop avg ");
+    out.print(passCount > 0 ? (total.loopTime - printed.loopTime) / passCount
+                            : 0);
+    out.print("us max ");
+    out.print(total.maxLoopTime);
+    out.print(ui_task != nullptr ? "us (UI task), ~" : "us (inline), ~");
+    out.print((total.i2cBytes - printed.i2cBytes) / seconds);
+    out.print(" I2C bytes/s (full redraw every pass: ~");
+    out.print(passCount / seconds * OLED_UI_FULL_FRAME_BYTES);
+    out.println(" bytes/s)");
+    out.print("Flush: avg ");
+    out.print(frameCount > 0
+                  ? (total.flushTime - printed.flushTime) / frameCount
+                  : 0);
+    out.print("us, ");
+    out.print(frameCount > 0 ? (total.i2cBytes - printed.i2cBytes) / frameCount
+                             : 0);
+    out.print(" bytes (full frame ");
+    out.print(total.fullFlushTime);
+    out.print("us, ");
+    out.print(OLED_UI_FULL_FRAME_BYTES);
+    out.println(" bytes)");
+    out.print("Heap: ");
+    out.print(ESP.getFreeHeap());
+    out.print(" bytes free, largest block ");
+    out.print(ESP.getMaxAllocHeap());
+    out.print(", min free ");
+    out.println(ESP.getMinFreeHeap());
+
+    printed = total;
+    max_frame_time = 0;
+    max_loop_time = 0;
+    stats_start = now;
+  }
+
+ private:
+  struct Rect {
+    int16_t x, y, w, h;
+
+    bool intersects(const Rect& other) const {
+      return w > 0 && other.w > 0 && x < other.x + other.w &&
+             other.x < x + w && y < other.y + other.h && other.y < y + h;
+    }
+
+    Rect unite(const Rect& other) const {
+      if (w <= 0) return other;
+      if (other.w <= 0) return *this;
+      int16_t x0 = std::min(x, other.x);
+      int16_t y0 = std::min(y, other.y);
+      int16_t x1 = std::max(x + w, other.x + other.w);
+      int16_t y1 = std::max(y + h, other.y + other.h);
+      return {x0, y0, (int16_t)(x1 - x0), (int16_t)(y1 - y0)};
+    }
+  };
+
+  // owned by the drawing side, the UI task after begin()
+  struct Widget {
+    int16_t x, y;
+    const uint8_t* font;
+    OLEDDISPLAY_TEXT_ALIGNMENT align;
+    char text[OLED_UI_TEXT_SIZE];  // text on the display
+    Rect drawn;  // area of the text on the display, w == 0 if none
+    Rect next;   // area of the text of the next frame
+  };
+
+  struct Snapshot {
+    char text[OLED_UI_MAX_WIDGETS][OLED_UI_TEXT_SIZE];
+  };
+
+  // marks the middle slot as written and not yet taken by the task
+  static constexpr uint8_t SLOT_FRESH = 0x80;
+
+  OLEDDisplay& display;
+  Widget widgets[OLED_UI_MAX_WIDGETS] = {};
+  uint8_t count = 0;
+  TaskHandle_t ui_task = nullptr;
+
+  // loop() side
+  Snapshot texts = {};
+  bool changed = false;  // texts differ from the last snapshot or frame
+  uint32_t last_frame = 0;
+
+  // triple buffer: loop() writes one slot, the task reads another and the
+  // third holds the latest snapshot in between
+  Snapshot slots[3] = {};
+  uint8_t write_slot = 0;
+  std::atomic<uint8_t> middle_slot{1};
+  uint8_t read_slot = 2;
+
+  // counters of the drawing side, read by loop()
+  std::atomic<uint32_t> frames{0};
+  std::atomic<uint32_t> frame_time{0};
+  std::atomic<uint32_t> max_frame_time{0};
+  std::atomic<uint32_t> i2c_bytes{0};
+  std::atomic<uint32_t> flush_time{0};
+  std::atomic<uint32_t> full_flush_time{0};
+  // counters of loop()
+  uint32_t passes = 0;
+  uint32_t loop_time = 0;
+  uint32_t max_loop_time = 0;
+  OledUiStats printed = {};
+  uint32_t stats_start = 0;
+
+  // swaps the texts into the middle slot and wakes the task
+  void publish() {
+    memcpy(&slots[write_slot], &texts, sizeof(Snapshot));
+    write_slot = middle_slot.exchange(write_slot | SLOT_FRESH) & ~SLOT_FRESH;
+    changed = false;
+    xTaskNotifyGive(ui_task);
+  }
+
+  static void uiTask(void* param) {
+    OledUi* ui = (OledUi*)param;
+    while (true) {
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+      if (!(ui->middle_slot.load() & SLOT_FRESH)) continue;
+      ui->read_slot = ui->middle_slot.exchange(ui->read_slot) & ~SLOT_FRESH;
+      ui->draw(ui->slots[ui->read_slot]);
+      // frame cap, a snapshot published meanwhile is taken right after
+      vTaskDelay(pdMS_TO_TICKS(1000 / OLED_UI_MAX_FPS));
+    }
+  }
+
+  // redraws the labels whose text differs from the display and flushes
+  void draw(const Snapshot& snapshot) {
+    uint32_t start = micros();
+
+    // area of the changed labels, old and new text
+    Rect area[OLED_UI_MAX_WIDGETS];
+    uint32_t dirty = 0;
+    for (uint8_t i = 0; i < count; i++) {
+      Widget& widget = widgets[i];
+      if (strcmp(widget.text, snapshot.text[i]) == 0) continue;
+      strcpy(widget.text, snapshot.text[i]);
+      dirty |= 1UL << i;
+      widget.next = measure(widget);
+      area[i] = widget.drawn.unite(widget.next);
+    }
+    if (dirty == 0) {
+      return;
+    }
+    // labels overlapping a changed one are cleared with it and redrawn
+    uint32_t redraw = dirty;
+    for (uint8_t j = 0; j < count; j++) {
+      if (redraw & (1UL << j)) continue;
+      for (uint8_t i = 0; i < count; i++) {
+        if ((dirty & (1UL << i)) && area[i].intersects(widgets[j].drawn)) {
+          redraw |= 1UL << j;
+          widgets[j].next = widgets[j].drawn;
+          area[j] = widgets[j].drawn;
+          break;
+        }
+      }
+    }
+
+    display.setColor(BLACK);
+    for (uint8_t i = 0; i < count; i++) {
+      if (!(redraw & (1UL << i))) continue;
+      const Rect& old = widgets[i].drawn;
+      if (old.w > 0) display.fillRect(old.x, old.y, old.w, old.h);
+    }
+    display.setColor(WHITE);
+    for (uint8_t i = 0; i < count; i++) {
+      if (!(redraw & (1UL << i))) continue;
+      Widget& widget = widgets[i];
+      if (widget.text[0] != '\0') {
+        display.setFont(widget.font);
+        display.setTextAlignment(widget.align);
+        display.drawString(widget.x, widget.y, widget.text);
+      }
+      widget.drawn = widget.text[0] != '\0' ? widget.next : Rect{};
+    }
+
+    uint32_t bytes = flushBytes();
+    uint32_t flushStart = micros();
+    display.display();
+    uint32_t flush = micros() - flushStart;
+
+    uint32_t time = micros() - start;
+    frames++;
+    frame_time += time;
+    flush_time += flush;
+    if (time > max_frame_time) max_frame_time = time;
+    i2c_bytes += bytes;
+
+    if (full_flush_time == 0) {
+      full_flush_time = measureFullFlush();
+    }
+  }
+
+  /**
+   * Time of a display.display() that sends the full frame, for comparison
+   * with the partial ones. Marks every byte of the driver's back buffer as
+   * changed, the screen shows the same frame again.
+   */
+  uint32_t measureFullFlush() {
+#ifdef OLEDDISPLAY_DOUBLE_BUFFER
+    uint16_t size = display.width() * display.height() / 8;
+    for (uint16_t i = 0; i < size; i++) {
+      display.buffer_back[i] = ~display.buffer[i];
+    }
+#endif
+    uint32_t start = micros();
+    display.display();
+    uint32_t time = micros() - start;
+    return time > 0 ? time : 1;
+  }
+
+  // area of the label's text, as drawn by OLEDDisplay::drawString()
+  Rect measure(const Widget& widget) {
+    if (widget.text[0] == '\0') return {};
+    display.setFont(widget.font);
+    int16_t w = display.getStringWidth(widget.text, strlen(widget.text), true);
+    int16_t h = pgm_read_byte(widget.font + 1);
+    int16_t x = widget.x;
+    if (widget.align == TEXT_ALIGN_CENTER) x -= w / 2;
+    if (widget.align == TEXT_ALIGN_RIGHT) x -= w;
+    return {x, widget.y, w, h};
+  }
+
+  /**
+   * Bytes the next display() puts on the bus, see OLED_UI_FULL_FRAME_BYTES.
+   * The driver sends the box of pages and columns that differ from its back
+   * buffer, found here the same way.
+   */
+  uint32_t flushBytes() {
+#ifdef OLEDDISPLAY_DOUBLE_BUFFER
+    int16_t width = display.width();
+    int16_t pages = display.height() / 8;
+    int16_t minX = width, maxX = -1, minPage = pages, maxPage = -1;
+    for (int16_t page = 0; page < pages; page++) {
+      for (int16_t x = 0; x < width; x++) {
+        uint16_t pos = x + page * width;
+        if (display.buffer[pos] == display.buffer_back[pos]) continue;
+        minX = std::min(minX, x);
+        maxX = std::max(maxX, x);
+        minPage = std::min(minPage, page);
+        maxPage = std::max(maxPage, page);
+      }
+    }
+    if (maxX < 0) return 0;
+    uint32_t data = (uint32_t)(maxX - minX + 1) * (maxPage - minPage + 1);
+    return 6 * 3 + data + (data + 15) / 16 * 2;
+#else
+    return OLED_UI_FULL_FRAME_BYTES;
+#endif
+  }
+};
@@ -0,0 +1,147 @@
+/**
+ * @file OLEDDisplay.h
+ * @brief Host fake of the SSD1306 driver used by OledUi.
+ *
+ * A 128x64 frame buffer with the double buffer flush of SSD1306Wire:
+ * display() sends the box of pages and columns that differ from the back
+ * buffer, as 6 addressing commands and chunks of 16 data bytes. The fake
+ * counts the bytes it would put on the bus and advances the simulated clock
+ * by their time at the I2C clock of SSD1306Wire (700 kHz, 9 bits a byte),
+ * plus a start and stop per transaction.
+ *
+ * Fonts keep only their header. Glyphs are 6 pixels wide and drawn as a
+ * pattern of their char code, so different texts give different pixels.
+ */
+#pragma once
+
+#include <Arduino.h>
+
+#include <string.h>
+
+#define OLEDDISPLAY_DOUBLE_BUFFER
+
+#define pgm_read_byte(addr) (*(const uint8_t*)(addr))
+
+enum OLEDDISPLAY_COLOR { BLACK = 0, WHITE = 1, INVERSE = 2 };
+
+enum OLEDDISPLAY_TEXT_ALIGNMENT {
+  TEXT_ALIGN_LEFT = 0,
+  TEXT_ALIGN_RIGHT = 1,
+  TEXT_ALIGN_CENTER = 2,
+  TEXT_ALIGN_CENTER_BOTH = 3
+};
+
+// width, height, first char, char count
+inline const uint8_t ArialMT_Plain_10[] = {10, 13, 32, 224};
+inline const uint8_t ArialMT_Plain_16[] = {16, 19, 32, 224};
+inline const uint8_t ArialMT_Plain_24[] = {24, 28, 32, 224};
+
+#define FAKE_GLYPH_WIDTH 6
+
+class OLEDDisplay {
+ public:
+  uint8_t* buffer = frame;
+  uint8_t* buffer_back = back;
+
+  uint32_t flushes = 0;          // calls of display() that sent anything
+  uint32_t busBytes = 0;         // bytes on the I2C bus, addresses included
+  uint32_t i2cClock = 700000;    // Hz
+  uint32_t transactionTime = 3;  // us, start and stop
+
+  bool init() {
+    memset(frame, 0, sizeof(frame));
+    memset(back, 0, sizeof(back));
+    return true;
+  }
+
+  uint16_t width() const { return 128; }
+  uint16_t height() const { return 64; }
+
+  void setColor(OLEDDISPLAY_COLOR value) { color = value; }
+  void setFont(const uint8_t* value) { font = value; }
+  void setTextAlignment(OLEDDISPLAY_TEXT_ALIGNMENT value) { align = value; }
+
+  void clear() { memset(frame, 0, sizeof(frame)); }
+
+  void fillRect(int16_t x, int16_t y, int16_t w, int16_t h) {
+    for (int16_t i = x; i < x + w; i++) {
+      for (int16_t j = y; j < y + h; j++) setPixel(i, j, color == WHITE);
+    }
+  }
+
+  uint16_t getStringWidth(const char* text, uint16_t length,
+                          bool utf8 = false) const {
+    return length * FAKE_GLYPH_WIDTH;
+  }
+
+  void drawString(int16_t x, int16_t y, const char* text) {
+    int16_t w = getStringWidth(text, strlen(text));
+    if (align == TEXT_ALIGN_CENTER) x -= w / 2;
+    if (align == TEXT_ALIGN_RIGHT) x -= w;
+    int16_t h = pgm_read_byte(font + 1);
+    for (size_t c = 0; text[c] != '\0'; c++) {
+      // the last column of a glyph is the gap to the next one
+      for (int16_t col = 0; col < FAKE_GLYPH_WIDTH - 1; col++) {
+        for (int16_t row = 0; row < h; row++) {
+          if ((text[c] * 7 + col * 3 + row) % 5 < 2) {
+            setPixel(x + c * FAKE_GLYPH_WIDTH + col, y + row, color == WHITE);
+          }
+        }
+      }
+    }
+  }
+
+  /**
+   * Sends the box of changed bytes like SSD1306Wire::display() with its
+   * double buffer.
+   */
+  void display() {
+    int16_t minX = 128, maxX = -1, minPage = 8, maxPage = -1;
+    for (int16_t page = 0; page < 8; page++) {
+      for (int16_t x = 0; x < 128; x++) {
+        uint16_t pos = x + page * 128;
+        if (frame[pos] != back[pos]) {
+          if (x < minX) minX = x;
+          if (x > maxX) maxX = x;
+          if (page < minPage) minPage = page;
+          if (page > maxPage) maxPage = page;
+        }
+        back[pos] = frame[pos];
+      }
+    }
+    if (maxX < 0) return;
+
+    flushes++;
+    // COLUMNADDR, PAGEADDR and their bounds, one transaction each
+    uint32_t bytes = 6 * 3;
+    uint32_t transactions = 6;
+    uint32_t data = (maxX - minX + 1) * (maxPage - minPage + 1);
+    uint32_t chunks = (data + 15) / 16;
+    bytes += data + chunks * 2;
+    transactions += chunks;
+    busBytes += bytes;
+    fake_advance((uint64_t)bytes * 9 * 1000000 / i2cClock +
+                 transactions * transactionTime);
+  }
+
+  bool pixel(int16_t x, int16_t y) const {
+    return frame[x + (y / 8) * 128] & (1 << (y & 7));
+  }
+
+ private:
+  uint8_t frame[1024] = {};
+  uint8_t back[1024] = {};
+  OLEDDISPLAY_COLOR color = WHITE;
+  const uint8_t* font = ArialMT_Plain_10;
+  OLEDDISPLAY_TEXT_ALIGNMENT align = TEXT_ALIGN_LEFT;
+
+  void setPixel(int16_t x, int16_t y, bool on) {
+    if (x < 0 || x >= 128 || y < 0 || y >= 64) return;
+    uint8_t bit = 1 << (y & 7);
+    if (on) {
+      frame[x + (y / 8) * 128] |= bit;
+    } else {
+      frame[x + (y / 8) * 128] &= ~bit;
+    }
+  }
+};
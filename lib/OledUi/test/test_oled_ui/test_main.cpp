@@ -0,0 +1,190 @@
+/**
+ * Partial redraws and flushes of OledUi against the fake SSD1306 driver of
+ * test/fake: the frame matches a full redraw of all labels, unchanged texts
+ * cost no flush, and a benchmark of a minute with a changing status label
+ * compares the partial flushes with a full display.display().
+ *
+ * Flush times are those of the fake bus, bytes times the I2C clock of
+ * SSD1306Wire, not of the board.
+ */
+#include <Arduino.h>
+#include <OledUi.h>
+#include <unity.h>
+
+static OLEDDisplay* display;
+static OledUi* ui;
+
+// the layout of the Heltec level devices
+struct Layout {
+  uint8_t title, status, info, hint;
+
+  void create(OledUi& target) {
+    title = target.label(64, 0, ArialMT_Plain_16, TEXT_ALIGN_CENTER);
+    info = target.label(0, 22, ArialMT_Plain_10, TEXT_ALIGN_LEFT);
+    // overlaps info when both are long
+    hint = target.label(127, 28, ArialMT_Plain_10, TEXT_ALIGN_RIGHT);
+    status = target.label(0, 50, ArialMT_Plain_10, TEXT_ALIGN_LEFT);
+  }
+};
+
+static Layout layout;
+
+// frame of a fresh display with all labels drawn at once
+static void fullRedraw(const char* const texts[4], OLEDDisplay& reference) {
+  OledUi fresh(reference);
+  Layout labels;
+  labels.create(fresh);
+  reference.init();
+  fresh.set(labels.title, texts[0]);
+  fresh.set(labels.info, texts[1]);
+  fresh.set(labels.hint, texts[2]);
+  fresh.set(labels.status, texts[3]);
+  fresh.render();
+}
+
+void setUp() {
+  fake_reset(1000000);
+  Serial.output.clear();
+  display = new OLEDDisplay();
+  ui = new OledUi(*display);
+  layout.create(*ui);
+  display->init();
+}
+
+void tearDown() {
+  delete ui;
+  delete display;
+}
+
+void test_unchanged_text_not_flushed() {
+  ui->set(layout.title, "CHALLENGE 1");
+  ui->render();
+  TEST_ASSERT_EQUAL(1, ui->frameStats().frames);
+
+  for (int pass = 0; pass < 1000; pass++) {
+    ui->set(layout.title, "CHALLENGE 1");
+    ui->render();
+    delay(1);
+  }
+  OledUiStats stats = ui->frameStats();
+  TEST_ASSERT_EQUAL(1001, stats.passes);
+  TEST_ASSERT_EQUAL(1, stats.frames);
+}
+
+void test_frames_capped() {
+  char text[16];
+  for (int pass = 0; pass < 1000; pass++) {
+    snprintf(text, sizeof(text), "%d", pass);
+    ui->set(layout.status, text);
+    ui->render();
+    delay(1);
+  }
+  // a frame every 100 ms at OLED_UI_MAX_FPS 10, give or take the flush time
+  uint32_t frames = ui->frameStats().frames;
+  TEST_ASSERT_LESS_OR_EQUAL(1000 / (1000 / OLED_UI_MAX_FPS) + 1, frames);
+  TEST_ASSERT_GREATER_OR_EQUAL(8, frames);
+}
+
+void test_partial_redraw_matches_full_redraw() {
+  const char* steps[][4] = {
+      {"CHALLENGE 3", "", "", "LORA RX"},
+      {"CHALLENGE 3", "Group 0x22", "", "LORA RX"},
+      {"CHALLENGE 3", "Group 0x22 asked", "Key accepted", "LORA TX"},
+      {"CHALLENGE 3", "Group 0x22 asked", "", "LORA DC 12s"},
+      {"CHALLENGE 3", "", "Key not accepted", "LORA DC 2s"},
+      {"DONE", "Group 0x33", "Key not accepted", ""},
+  };
+  OLEDDisplay reference;
+  for (const auto& texts : steps) {
+    ui->set(layout.title, texts[0]);
+    ui->set(layout.info, texts[1]);
+    ui->set(layout.hint, texts[2]);
+    ui->set(layout.status, texts[3]);
+    ui->render();
+    delay(1000 / OLED_UI_MAX_FPS);
+
+    fullRedraw(texts, reference);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(reference.buffer, display->buffer, 1024);
+  }
+}
+
+void test_counts_bus_bytes() {
+  ui->set(layout.title, "CHALLENGE 1");
+  ui->render();
+  delay(1000);
+  uint32_t before = display->busBytes;
+  uint32_t counted = ui->frameStats().i2cBytes;
+
+  ui->set(layout.status, "LORA DC 9s");
+  ui->render();
+  uint32_t sent = display->busBytes - before;
+  TEST_ASSERT_GREATER_THAN(0, sent);
+  TEST_ASSERT_EQUAL(sent, ui->frameStats().i2cBytes - counted);
+
+  // one char changed: only its columns go over the bus
+  delay(1000);
+  before = display->busBytes;
+  ui->set(layout.status, "LORA DC 8s");
+  ui->render();
+  // 5 columns of the glyph on pages 6 and 7, one chunk
+  TEST_ASSERT_EQUAL(6 * 3 + (FAKE_GLYPH_WIDTH - 1) * 2 + 2,
+                    display->busBytes - before);
+}
+
+void test_benchmark_partial_and_full_flush() {
+  // a minute of 10 ms loop() passes, the duty cycle countdown changes the
+  // status label every second
+  ui->set(layout.title, "CHALLENGE 1");
+  ui->render();
+  OledUiStats first = ui->frameStats();
+  uint32_t firstBytes = display->busBytes;
+  char text[OLED_UI_TEXT_SIZE];
+  for (int pass = 0; pass < 6000; pass++) {
+    snprintf(text, sizeof(text), "LORA DC %ds", 60 - pass / 100);
+    ui->set(layout.status, text);
+    ui->render();
+    delay(10);
+  }
+
+  OledUiStats stats = ui->frameStats();
+  uint32_t frames = stats.frames - first.frames;
+  uint32_t flushAvg = (stats.flushTime - first.flushTime) / frames;
+  uint32_t bytesAvg = (stats.i2cBytes - first.i2cBytes) / frames;
+  char line[200];
+  snprintf(line, sizeof(line),
+           "%u passes, %u frames: partial flush avg %u us, %u bytes | full "
+           "flush %u us, %u bytes",
+           (unsigned)(stats.passes - first.passes), (unsigned)frames,
+           (unsigned)flushAvg, (unsigned)bytesAvg,
+           (unsigned)stats.fullFlushTime, OLED_UI_FULL_FRAME_BYTES);
+  TEST_MESSAGE(line);
+
+  TEST_ASSERT_EQUAL(60, frames);
+  TEST_ASSERT_GREATER_THAN(0, stats.fullFlushTime);
+  TEST_ASSERT_LESS_THAN(stats.fullFlushTime / 4, flushAvg);
+  TEST_ASSERT_EQUAL(display->busBytes - firstBytes,
+                    stats.i2cBytes - first.i2cBytes);
+
+  ui->printStats(Serial);
+  TEST_ASSERT_TRUE(Serial.output.find("Flush: avg ") != std::string::npos);
+}
+
+void test_full_flush_sends_full_frame() {
+  ui->set(layout.title, "CHALLENGE 1");
+  ui->render();
+  // the first frame measures a flush of the whole frame after its own
+  TEST_ASSERT_EQUAL(2, display->flushes);
+  TEST_ASSERT_EQUAL(ui->frameStats().i2cBytes + OLED_UI_FULL_FRAME_BYTES,
+                    display->busBytes);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_unchanged_text_not_flushed);
+  RUN_TEST(test_frames_capped);
+  RUN_TEST(test_partial_redraw_matches_full_redraw);
+  RUN_TEST(test_counts_bus_bytes);
+  RUN_TEST(test_benchmark_partial_and_full_flush);
+  RUN_TEST(test_full_flush_sends_full_frame);
+  return UNITY_END();
+}
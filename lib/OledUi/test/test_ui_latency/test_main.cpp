@@ -0,0 +1,179 @@
+/**
+ * RX-to-handler latency and loop() pass time of a receiving firmware with
+ * the display drawn inline in render() against the UI task of begin().
+ *
+ * Frames arrive at random times as in test_event_loop of LoRaLink, and each
+ * one changes the labels of the layout of the receiving devices. An uptime
+ * label changes every 100 ms, so the display flushes at OLED_UI_MAX_FPS.
+ * The fake SSD1306 moves the simulated clock by the I2C time of every
+ * flush, so a frame whose interrupt fires during an inline flush waits for
+ * the rest of it. With the task, the flush runs on the other core: the
+ * fake FreeRTOS does not run the task, and render() only hands the
+ * snapshot over, which is all loop() pays for on the board.
+ *
+ * The native test project builds with OLED_UI_INLINE, this test drops it
+ * to have both modes: without begin() render() draws inline.
+ */
+#undef OLED_UI_INLINE
+
+#include <Arduino.h>
+#include <HudText.h>
+#include <LoRaLink.h>
+#include <OledUi.h>
+#include <unity.h>
+
+typedef LoRaLink<SX1262, LoRaPins<8, 14, 12, 13>> HeltecLink;
+
+static const LoRaConfig config = {869.525, 125.0, 7, 5, 0x12, 14, true, 0};
+
+#define SIM_TIME 600000000ULL  // us
+
+static HeltecLink* link;
+static OLEDDisplay* display;
+static OledUi* ui;
+
+/**
+ * Delivers a frame to the link at random intervals of 50..500 ms, from the
+ * timer table of the fake clock, like the DIO interrupt of a real frame.
+ */
+struct FakeSender {
+  esp_timer timer;
+  uint32_t delivered;
+
+  void start() {
+    timer = {onTimer, this, 0, false};
+    delivered = 0;
+    schedule();
+  }
+
+  void schedule() {
+    fake_timer_start(&timer, fake_now + random(50, 500) * 1000);
+  }
+
+  static void onTimer(void* arg) {
+    FakeSender* sender = static_cast<FakeSender*>(arg);
+    const byte frame[] = {0xC1, 0x31, 'p', 'i', 'n', 'g', '\0'};
+    if (link->radio.receive(frame, sizeof(frame))) sender->delivered++;
+    sender->schedule();
+  }
+};
+
+static FakeSender sender;
+
+// the labels of the receiving devices
+struct Layout {
+  uint8_t title, sender, rssi, count, uptime;
+
+  void create(OledUi& target) {
+    title = target.label(64, 0, ArialMT_Plain_16, TEXT_ALIGN_CENTER);
+    sender = target.label(0, 22, ArialMT_Plain_10, TEXT_ALIGN_LEFT);
+    rssi = target.label(0, 36, ArialMT_Plain_10, TEXT_ALIGN_LEFT);
+    count = target.label(0, 50, ArialMT_Plain_10, TEXT_ALIGN_LEFT);
+    uptime = target.label(127, 50, ArialMT_Plain_10, TEXT_ALIGN_RIGHT);
+  }
+};
+
+static Layout layout;
+static HudText<OLED_UI_TEXT_SIZE> label_text;
+
+struct LatencyStats {
+  uint32_t frames;
+  uint64_t total;  // us
+  uint32_t max;    // us
+};
+
+/**
+ * A simulated run of loop(): take the received frames, set the labels,
+ * render() and wait for the next event.
+ */
+static LatencyStats run() {
+  LatencyStats stats = {};
+  ui->set(layout.title, "Receiver");
+  uint64_t end = fake_now + SIM_TIME;
+  while (fake_now < end) {
+    const LoRaRxFrame* frame;
+    while ((frame = link->receive()) != nullptr) {
+      uint32_t latency = micros() - frame->micros;
+      stats.frames++;
+      stats.total += latency;
+      if (latency > stats.max) stats.max = latency;
+      ui->set(layout.sender, label_text.format("Sender: ", hud_hex(0x31)));
+      ui->set(layout.rssi,
+              label_text.format("RSSI ", link->radio.getRSSI(), " dBm"));
+      link->release();
+    }
+    ui->set(layout.count, label_text.format("Frames: ", stats.frames));
+    ui->set(layout.uptime, label_text.format(hud_fixed(millis() / 1000.0, 1),
+                                             "s"));
+    ui->render();
+    link->waitEvent(10);
+  }
+  return stats;
+}
+
+static void report(const char* name, const LatencyStats& stats) {
+  OledUiStats frame = ui->frameStats();
+  char line[200];
+  snprintf(line, sizeof(line),
+           "%s: %u frames, latency mean %u us, max %u us; render() in "
+           "loop() avg %u us, max %u us; %u display flushes by loop()",
+           name, (unsigned)stats.frames,
+           (unsigned)(stats.frames ? stats.total / stats.frames : 0),
+           (unsigned)stats.max,
+           (unsigned)(frame.passes ? frame.loopTime / frame.passes : 0),
+           (unsigned)frame.maxLoopTime, (unsigned)frame.frames);
+  TEST_MESSAGE(line);
+}
+
+void setUp() {
+  fake_reset(1000000);
+  fake_air.clear();
+  fake_notifications = 0;
+  Serial.output.clear();
+  randomSeed(42);
+  link = new HeltecLink(0xC1);
+  link->begin(config);
+  display = new OLEDDisplay();
+  display->init();
+  ui = new OledUi(*display);
+  layout.create(*ui);
+  sender.start();
+}
+
+void tearDown() {
+  fake_timer_stop(&sender.timer);
+  delete ui;
+  delete display;
+  delete link;
+}
+
+void test_latency_inline() {
+  LatencyStats stats = run();
+  report("OLED_UI_INLINE", stats);
+
+  TEST_ASSERT_EQUAL(sender.delivered, stats.frames);
+  TEST_ASSERT_GREATER_THAN(0, ui->frameStats().frames);
+  // frames that arrive during a flush wait for its end
+  TEST_ASSERT_GREATER_THAN(0, stats.total);
+  TEST_ASSERT_GREATER_THAN(100, stats.max);
+}
+
+void test_latency_ui_task() {
+  ui->begin();
+  LatencyStats stats = run();
+  report("UI task", stats);
+
+  TEST_ASSERT_EQUAL(sender.delivered, stats.frames);
+  // loop() never flushes, an interrupt is handled as soon as it fires
+  TEST_ASSERT_EQUAL(0, ui->frameStats().frames);
+  TEST_ASSERT_EQUAL(0, stats.max);
+  TEST_ASSERT_EQUAL(0, ui->frameStats().maxLoopTime);
+  TEST_ASSERT_LESS_THAN(1000, link->eventStats().latency.max);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_latency_inline);
+  RUN_TEST(test_latency_ui_task);
+  return UNITY_END();
+}
@@ -0,0 +1,186 @@
+/**
+ * @file PmuSampler.h
+ * @brief Cached battery and charge state of the AXP PMU on the T-Beam.
+ *
+ * Every PMU query is an I2C transaction, and the firmwares asked for the
+ * battery state in each loop() pass although it changes over minutes. The
+ * sampler reads the PMU in a task of its own every PMU_SAMPLE_PERIOD and
+ * right after a PMU interrupt (VBUS or battery plugged, charge started or
+ * done). snapshot() returns the last sample without touching the bus.
+ *
+ *   PmuSampler pmu_sampler;
+ *   ...
+ *   setupBoards();
+ *   pmu_sampler.begin(PMU, PMU_IRQ);
+ *   ...
+ *   PmuSnapshot battery = pmu_sampler.snapshot();
+ */
+#pragma once
+
+#include <Arduino.h>
+#include <XPowersLib.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <atomic>
+
+#ifndef PMU_SAMPLE_PERIOD
+#define PMU_SAMPLE_PERIOD 5000  // ms
+#endif
+
+// ms between the sampler statistics on Serial, 0 == off
+#ifndef PMU_STATS_INTERVAL
+#define PMU_STATS_INTERVAL 60000
+#endif
+
+#define PMU_TASK_PRIORITY 1
+#define PMU_TASK_STACK 3072
+
+// PMU reads of the readers before, per snapshot(): battery connected,
+// charging and the battery percentage
+#define PMU_READS_PER_QUERY 3
+
+struct PmuSnapshot {
+  bool valid;  // false until the first sample
+  bool batteryConnected;
+  bool charging;
+  uint8_t batteryPercent;  // 0 without battery
+};
+
+/**
+ * Counters since begin(). Transactions count the PMU calls of the sampler,
+ * one register access each.
+ */
+struct PmuSamplerStats {
+  uint32_t samples;
+  uint32_t interrupts;    // samples caused by a PMU interrupt
+  uint32_t transactions;  // I2C transactions of the sampler
+  uint32_t snapshots;     // snapshot() calls
+};
+
+class PmuSampler {
+ public:
+  /**
+   * Starts sampling on the core loop() does not run on and takes over the
+   * IRQ pin of the PMU from LoRaBoards. Does nothing without a PMU.
+   */
+  void begin(XPowersLibInterface* pmu, int irqPin,
+             uint32_t period = PMU_SAMPLE_PERIOD) {
+    if (pmu == nullptr) {
+      Serial.println(F("No PMU, battery state not sampled"));
+      return;
+    }
+    this->pmu = pmu;
+    this->period = period;
+    xTaskCreatePinnedToCore(samplerTask, "pmu_sampler", PMU_TASK_STACK, this,
+                            PMU_TASK_PRIORITY, &task, 1 - xPortGetCoreID());
+    pinMode(irqPin, INPUT_PULLUP);
+    attachInterruptArg(irqPin, onInterrupt, this, FALLING);
+  }
+
+  // last sample, no bus access
+  PmuSnapshot snapshot() {
+    snapshot_calls.fetch_add(1, std::memory_order_relaxed);
+    return unpack(sample.load());
+  }
+
+  PmuSamplerStats samplerStats() const {
+    return {samples, interrupts, transactions, snapshot_calls.load()};
+  }
+
+  /**
+   * Prints the PMU transactions per second since the last call, next to the
+   * ones the readers would have caused by querying the PMU directly.
+   */
+  void printStats(Print& out) {
+    uint32_t now = millis();
+    uint32_t seconds = (now - stats_start) / 1000;
+    if (seconds == 0) seconds = 1;
+    PmuSamplerStats total = samplerStats();
+    uint32_t reads = (total.transactions - printed.transactions) / seconds;
+    uint32_t direct = (total.snapshots - printed.snapshots) / seconds *
+                      PMU_READS_PER_QUERY;
+
+    out.print("PMU: ");
+    out.print(total.samples - printed.samples);
+    out.print(" samples (");
+    out.print(total.interrupts - printed.interrupts);
+    out.print(" IRQ), ");
+    out.print(reads);
+    out.print(" I2C transactions/s, saved ~");
+    out.print(direct > reads ? direct - reads : 0);
+    out.println("/s");
+
+    printed = total;
+    stats_start = now;
+  }
+
+ private:
+  static constexpr uint32_t SAMPLE_VALID = 1UL << 8;
+  static constexpr uint32_t SAMPLE_BATTERY = 1UL << 9;
+  static constexpr uint32_t SAMPLE_CHARGING = 1UL << 10;
+
+  XPowersLibInterface* pmu = nullptr;
+  uint32_t period = PMU_SAMPLE_PERIOD;
+  TaskHandle_t task = nullptr;
+
+  // the snapshot packed in one word, so readers never see a torn sample
+  std::atomic<uint32_t> sample{0};
+
+  // written by the sampler task
+  uint32_t samples = 0;
+  uint32_t interrupts = 0;
+  uint32_t transactions = 0;
+  // written by the readers
+  std::atomic<uint32_t> snapshot_calls{0};
+  PmuSamplerStats printed = {};
+  uint32_t stats_start = 0;
+
+  static PmuSnapshot unpack(uint32_t packed) {
+    return {(packed & SAMPLE_VALID) != 0, (packed & SAMPLE_BATTERY) != 0,
+            (packed & SAMPLE_CHARGING) != 0, (uint8_t)(packed & 0xff)};
+  }
+
+  static void IRAM_ATTR onInterrupt(void* param) {
+    PmuSampler* sampler = (PmuSampler*)param;
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(sampler->task, &woken);
+    portYIELD_FROM_ISR(woken);
+  }
+
+  static void samplerTask(void* param) {
+    PmuSampler* sampler = (PmuSampler*)param;
+    // interrupts raised before begin() keep the IRQ line low
+    sampler->pmu->clearIrqStatus();
+    sampler->transactions++;
+    while (true) {
+      sampler->read();
+#if PMU_STATS_INTERVAL > 0
+      if (millis() - sampler->stats_start >= PMU_STATS_INTERVAL) {
+        sampler->printStats(Serial);
+      }
+#endif
+      if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(sampler->period)) > 0) {
+        // read and acknowledge the event, the line goes high again
+        sampler->pmu->getIrqStatus();
+        sampler->pmu->clearIrqStatus();
+        sampler->transactions += 2;
+        sampler->interrupts++;
+      }
+    }
+  }
+
+  void read() {
+    uint32_t packed = SAMPLE_VALID;
+    transactions += 2;
+    if (pmu->isBatteryConnect()) {
+      packed |= SAMPLE_BATTERY;
+      int percent = pmu->getBatteryPercent();
+      packed |= percent < 0 ? 0 : percent & 0xff;
+      transactions++;
+    }
+    if (pmu->isCharging()) packed |= SAMPLE_CHARGING;
+    sample = packed;
+    samples++;
+  }
+};
@@ -0,0 +1,132 @@
+/**
+ * @file codebook.h
+ * @brief Device IDs, keys and passphrases of the workshop groups.
+ *
+ * Generated by generate-codephrases.py, do not edit.
+ */
+#pragma once
+
+#include <stdint.h>
+
+#define CODEBOOK_GROUP_COUNT 14
+
+struct CodebookEntry {
+  uint8_t deviceId;
+  const char* key;
+  const char* plaintext;
+  const uint8_t* code;  // plaintext XOR repeated key
+  uint8_t codeLength;
+};
+
+static constexpr uint8_t CODEBOOK_CODE_0[] = {
+    0x23, 0x0d, 0x12, 0x18, 0x15, 0x36, 0x1b, 0x11, 0x14, 0x1a, 0x5d, 0x34,
+    0x1b, 0x11, 0x02, 0x50, 0x15, 0x0e, 0x15, 0x16, 0x47, 0x3a, 0x5a, 0x32,
+    0x1b, 0x16, 0x08,
+};
+static constexpr uint8_t CODEBOOK_CODE_1[] = {
+    0x18, 0x58, 0x33, 0x05, 0x58, 0x44, 0x20, 0x44, 0x35, 0x07, 0x10, 0x46,
+    0x20, 0x44, 0x23, 0x4d, 0x58, 0x79, 0x28, 0x59, 0x2f, 0x18, 0x16, 0x47,
+};
+static constexpr uint8_t CODEBOOK_CODE_2[] = {
+    0x1e, 0x06, 0x2f, 0x47, 0x18, 0x18, 0x26, 0x1a, 0x29, 0x45, 0x50, 0x1a,
+    0x26, 0x1a, 0x3f, 0x0f, 0x18, 0x2e, 0x26, 0x0a, 0x2e, 0x5a, 0x4a, 0x01,
+    0x28,
+};
+static constexpr uint8_t CODEBOOK_CODE_3[] = {
+    0x08, 0x1e, 0x1e, 0x4a, 0x75, 0x01, 0x30, 0x02, 0x18, 0x48, 0x3d, 0x03,
+    0x30, 0x02, 0x0e, 0x02, 0x75, 0x3c, 0x30, 0x12, 0x0a, 0x4a, 0x3a, 0x1f,
+    0x38,
+};
+static constexpr uint8_t CODEBOOK_CODE_4[] = {
+    0x2b, 0x17, 0x4c, 0x00, 0x67, 0x3e, 0x13, 0x0b, 0x4a, 0x02, 0x2f, 0x3c,
+    0x13, 0x0b, 0x5c, 0x48, 0x67, 0x1d, 0x07, 0x0b, 0x51, 0x1b,
+};
+static constexpr uint8_t CODEBOOK_CODE_5[] = {
+    0x15, 0x00, 0x10, 0x45, 0x48, 0x3a, 0x2d, 0x1c, 0x16, 0x47, 0x00, 0x38,
+    0x2d, 0x1c, 0x00, 0x0d, 0x48, 0x19, 0x21, 0x00, 0x0e, 0x5e, 0x06, 0x2d,
+    0x6c, 0x06, 0x16, 0x17, 0x2a, 0x0b, 0x08,
+};
+static constexpr uint8_t CODEBOOK_CODE_6[] = {
+    0x60, 0x39, 0x21, 0x44, 0x51, 0x07, 0x58, 0x25, 0x27, 0x46, 0x19, 0x05,
+    0x58, 0x25, 0x31, 0x0c, 0x51, 0x27, 0x58, 0x3f, 0x3a, 0x42, 0x42, 0x33,
+};
+static constexpr uint8_t CODEBOOK_CODE_7[] = {
+    0x2d, 0x1c, 0x14, 0x47, 0x70, 0x32, 0x15, 0x00, 0x12, 0x45, 0x38, 0x30,
+    0x15, 0x00, 0x04, 0x0f, 0x70, 0x01, 0x1b, 0x1f, 0x05, 0x15, 0x16, 0x27,
+    0x11, 0x07,
+};
+static constexpr uint8_t CODEBOOK_CODE_8[] = {
+    0x1d, 0x05, 0x4d, 0x05, 0x77, 0x21, 0x25, 0x19, 0x4b, 0x07, 0x3f, 0x23,
+    0x25, 0x19, 0x5d, 0x4d, 0x77, 0x12, 0x2b, 0x1f, 0x5b, 0x1f, 0x77, 0x01,
+    0x2b, 0x1e, 0x59, 0x03, 0x38,
+};
+static constexpr uint8_t CODEBOOK_CODE_9[] = {
+    0x6c, 0x2e, 0x11, 0x44, 0x44, 0x45, 0x54, 0x32, 0x17, 0x46, 0x0c, 0x47,
+    0x54, 0x32, 0x01, 0x0c, 0x44, 0x66, 0x45, 0x28, 0x08, 0x5a, 0x44, 0x41,
+    0x5d, 0x24, 0x44, 0x74, 0x01, 0x54, 0x5b, 0x32,
+};
+static constexpr uint8_t CODEBOOK_CODE_10[] = {
+    0x36, 0x57, 0x17, 0x28, 0x70, 0x35, 0x0e, 0x4b, 0x11, 0x2a, 0x38, 0x37,
+    0x0e, 0x4b, 0x07, 0x60, 0x70, 0x00, 0x3c, 0x68, 0x51, 0x68, 0x7d, 0x33,
+    0x5a,
+};
+static constexpr uint8_t CODEBOOK_CODE_11[] = {
+    0x0a, 0x3b, 0x47, 0x03, 0x50, 0x03, 0x32, 0x27, 0x41, 0x01, 0x18, 0x01,
+    0x32, 0x27, 0x57, 0x4b, 0x50, 0x23, 0x3a, 0x31, 0x51, 0x14, 0x50, 0x1c,
+    0x35, 0x74, 0x71, 0x10, 0x1b, 0x16,
+};
+static constexpr uint8_t CODEBOOK_CODE_12[] = {
+    0x36, 0x3f, 0x43, 0x27, 0x72, 0x05, 0x0e, 0x23, 0x45, 0x25, 0x3a, 0x07,
+    0x0e, 0x23, 0x53, 0x6f, 0x72, 0x37, 0x1d, 0x35, 0x57, 0x31, 0x72, 0x36,
+    0x1d, 0x25, 0x5b, 0x37, 0x21,
+};
+static constexpr uint8_t CODEBOOK_CODE_13[] = {
+    0x6e, 0x18, 0x3d, 0x2b, 0x56, 0x22, 0x56, 0x04, 0x3b, 0x29, 0x1e, 0x20,
+    0x56, 0x04, 0x2d, 0x63, 0x56, 0x11, 0x58, 0x14, 0x23, 0x2d, 0x17, 0x3b,
+    0x5b, 0x57, 0x0a, 0x38, 0x04,
+};
+
+static constexpr CodebookEntry CODEBOOK[CODEBOOK_GROUP_COUNT] = {
+    {0x11, "zbgj5F", "Your passphrase: Hot Potato", CODEBOOK_CODE_0, 27},
+    {0x22, "A7Fwx4", "Your passphrase: Minions", CODEBOOK_CODE_1, 24},
+    {0x33, "GiZ58h", "Your passphrase: Factorio", CODEBOOK_CODE_2, 25},
+    {0x44, "Qqk8Uq", "Your passphrase: Macaroni", CODEBOOK_CODE_3, 25},
+    {0x55, "rx9rGN", "Your passphrase: Sushi", CODEBOOK_CODE_4, 22},
+    {0x66, "Loe7hJ", "Your passphrase: Smoking is BAD", CODEBOOK_CODE_5, 31},
+    {0x88, "9VT6qw", "Your passphrase: Paint3D", CODEBOOK_CODE_6, 24},
+    {0x99, "tsa5PB", "Your passphrase: Cold Feet", CODEBOOK_CODE_7, 26},
+    {0xaa, "Dj8wWQ", "Your passphrase: Couch Potato", CODEBOOK_CODE_8, 29},
+    {0xbb, "5Ad6d5", "Your passphrase: Spill the Beans", CODEBOOK_CODE_9, 32},
+    {0xcc, "o8bZPE", "Your passphrase: ESP32-v5", CODEBOOK_CODE_10, 25},
+    {0xdd, "ST2qps", "Your passphrase: Piece of Cake", CODEBOOK_CODE_11, 30},
+    {0xee, "oP6URu", "Your passphrase: Bread Crumbs", CODEBOOK_CODE_12, 29},
+    {0xf0, "7wHYvR", "Your passphrase: Cocktail Bar", CODEBOOK_CODE_13, 29},
+};
+
+// index into CODEBOOK by device ID, 0xff == no group
+static constexpr uint8_t CODEBOOK_INDEX[256] = {
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0x00, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0x01, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0x02, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0x03, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0x04, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x05, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x06, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x07, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x08, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x09, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x0a, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x0b, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x0c, 0xff,
+    0x0d, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+};
+
+/**
+ * Returns the group of a device ID, or nullptr.
+ */
+inline const CodebookEntry* codebook_find(uint8_t deviceId) {
+  uint8_t index = CODEBOOK_INDEX[deviceId];
+  return index == 0xff ? nullptr : &CODEBOOK[index];
+}
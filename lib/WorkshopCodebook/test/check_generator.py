@@ -0,0 +1,12 @@
+# Stops the native test build if codebook.h differs from the output of
+# generate-codephrases.py, e.g. after editing one without the other.
+Import("env")
+
+import os
+import subprocess
+import sys
+
+root = os.path.normpath(os.path.join(env.subst("$PROJECT_DIR"), "..", ".."))
+if subprocess.call([sys.executable, "generate-codephrases.py", "--check"],
+                   cwd=root) != 0:
+    env.Exit(1)
@@ -0,0 +1,98 @@
+/**
+ * Every code of codebook.h decodes to its passphrase, directly and the way
+ * the participants do it in level 4: from the three fragments the flipping
+ * sender sends, interleaved again and XORed with the repeated key.
+ */
+#include <codebook.h>
+#include <string.h>
+#include <unity.h>
+
+#include <string>
+
+// the level 4 device sends every MESSAGE_ROTATION_NUM-th byte per message
+#define MESSAGE_ROTATION_NUM 3
+
+// fragment fwd as built by build_session_message() of 4_flipping_sender
+static std::string fragment(const CodebookEntry& group, int fwd) {
+  std::string part;
+  for (int i = 0; i < group.codeLength - fwd; i = i + MESSAGE_ROTATION_NUM) {
+    part += (char)group.code[i + fwd];
+  }
+  return part;
+}
+
+static std::string xorKey(const std::string& code, const char* key) {
+  std::string text;
+  size_t keyLength = strlen(key);
+  for (size_t i = 0; i < code.size(); i++) {
+    text += (char)(code[i] ^ key[i % keyLength]);
+  }
+  return text;
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_group_count() {
+  TEST_ASSERT_EQUAL(14, CODEBOOK_GROUP_COUNT);
+  TEST_ASSERT_EQUAL(CODEBOOK_GROUP_COUNT,
+                    sizeof(CODEBOOK) / sizeof(CODEBOOK[0]));
+}
+
+void test_all_codes_decode() {
+  for (int i = 0; i < CODEBOOK_GROUP_COUNT; i++) {
+    const CodebookEntry& group = CODEBOOK[i];
+    TEST_ASSERT_EQUAL_MESSAGE(strlen(group.plaintext), group.codeLength,
+                              group.key);
+    std::string code((const char*)group.code, group.codeLength);
+    TEST_ASSERT_EQUAL_STRING_MESSAGE(group.plaintext,
+                                     xorKey(code, group.key).c_str(),
+                                     group.key);
+  }
+}
+
+void test_all_codes_decode_from_fragments() {
+  for (int i = 0; i < CODEBOOK_GROUP_COUNT; i++) {
+    const CodebookEntry& group = CODEBOOK[i];
+    std::string parts[MESSAGE_ROTATION_NUM];
+    for (int fwd = 0; fwd < MESSAGE_ROTATION_NUM; fwd++) {
+      parts[fwd] = fragment(group, fwd);
+    }
+
+    // interleaved again like example_solutions/4_solution
+    std::string code;
+    for (size_t j = 0; j < parts[0].size(); j++) {
+      for (const std::string& part : parts) {
+        if (j < part.size()) code += part[j];
+      }
+    }
+    TEST_ASSERT_EQUAL_MESSAGE(group.codeLength, code.size(), group.key);
+    TEST_ASSERT_EQUAL_STRING_MESSAGE(group.plaintext,
+                                     xorKey(code, group.key).c_str(),
+                                     group.key);
+  }
+}
+
+void test_find_by_device_id() {
+  for (int i = 0; i < CODEBOOK_GROUP_COUNT; i++) {
+    TEST_ASSERT_TRUE(codebook_find(CODEBOOK[i].deviceId) == &CODEBOOK[i]);
+  }
+  int groups = 0;
+  for (int id = 0; id < 256; id++) {
+    if (codebook_find(id) != nullptr) groups++;
+  }
+  // one device ID per group, every other ID is no group
+  TEST_ASSERT_EQUAL(CODEBOOK_GROUP_COUNT, groups);
+  TEST_ASSERT_NULL(codebook_find(0x77));
+  TEST_ASSERT_NULL(codebook_find(0xFF));
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_group_count);
+  RUN_TEST(test_all_codes_decode);
+  RUN_TEST(test_all_codes_decode_from_fragments);
+  RUN_TEST(test_find_by_device_id);
+  return UNITY_END();
+}
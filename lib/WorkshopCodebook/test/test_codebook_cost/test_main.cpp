@@ -0,0 +1,161 @@
+/**
+ * Heap, boot and lookup cost of the constexpr codebook against the maps the
+ * firmwares built before: groupkeys, plaintextmap and codetextmap of
+ * 4_flipping_sender, filled from the same data at boot.
+ *
+ * operator new is counted to get the heap the maps take. Times are taken
+ * with the host clock, the maps are built and looked up as the old sender
+ * did: key by device ID, then a copy of the code by key. The host has
+ * 64-bit pointers, so its map nodes are larger than on the ESP32; the
+ * number of allocations is the same.
+ */
+#include <Arduino.h>
+#include <codebook.h>
+#include <unity.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <map>
+#include <new>
+#include <vector>
+
+#define BOOT_ROUNDS 1000
+#define LOOKUP_ROUNDS 100000
+
+static bool counting = false;
+static uint32_t allocations = 0;
+static size_t allocated = 0;  // bytes requested
+
+void* operator new(size_t size) {
+  if (counting) {
+    allocations++;
+    allocated += size;
+  }
+  void* p = malloc(size);
+  if (p == nullptr) throw std::bad_alloc();
+  return p;
+}
+
+// not inlined, GCC would take the free() for a mismatch with new
+__attribute__((noinline)) void operator delete(void* p) noexcept { free(p); }
+
+void operator delete(void* p, size_t) noexcept { operator delete(p); }
+
+// the maps of the old firmware
+struct RuntimeCodebook {
+  std::map<byte, String> groupkeys;
+  std::map<String, String> plaintextmap;
+  std::map<String, std::vector<unsigned char>> codetextmap;
+
+  RuntimeCodebook() {
+    for (const CodebookEntry& group : CODEBOOK) {
+      groupkeys.insert({group.deviceId, group.key});
+      plaintextmap.insert({group.key, group.plaintext});
+      codetextmap.insert(
+          {group.key, std::vector<unsigned char>(
+                          group.code, group.code + group.codeLength)});
+    }
+  }
+};
+
+static double elapsedUs(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::micro>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+// keeps the compiler from dropping the lookups
+static volatile uint32_t sink;
+
+void setUp() {
+  counting = false;
+  allocations = 0;
+  allocated = 0;
+}
+
+void tearDown() {}
+
+void test_heap() {
+  counting = true;
+  const CodebookEntry* group = codebook_find(0x44);
+  counting = false;
+  TEST_ASSERT_NOT_NULL(group);
+  TEST_ASSERT_EQUAL(0, allocations);
+
+  counting = true;
+  RuntimeCodebook* maps = new RuntimeCodebook();
+  counting = false;
+
+  char line[120];
+  snprintf(line, sizeof(line),
+           "maps at boot: %u allocations, %u bytes on the host heap; "
+           "constexpr: 0",
+           (unsigned)allocations, (unsigned)allocated);
+  TEST_MESSAGE(line);
+  // a node per entry of each map, plus the texts and the code vectors
+  TEST_ASSERT_GREATER_OR_EQUAL(3 * CODEBOOK_GROUP_COUNT + 1, allocations);
+  delete maps;
+}
+
+void test_boot_time() {
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < BOOT_ROUNDS; i++) {
+    RuntimeCodebook maps;
+    sink = sink + maps.groupkeys.size();
+  }
+  double us = elapsedUs(start) / BOOT_ROUNDS;
+
+  char line[120];
+  snprintf(line, sizeof(line),
+           "maps at boot: %.2f us on the host; constexpr: nothing to build",
+           us);
+  TEST_MESSAGE(line);
+  TEST_ASSERT_TRUE(us > 0);
+}
+
+void test_lookup_time() {
+  RuntimeCodebook maps;
+
+  // as the old sender: the key of the receiver, then a copy of its code
+  counting = true;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < LOOKUP_ROUNDS; i++) {
+    byte id = CODEBOOK[i % CODEBOOK_GROUP_COUNT].deviceId;
+    String key = maps.groupkeys.at(id);
+    std::vector<unsigned char> code = maps.codetextmap.at(key);
+    sink = sink + code[0];
+  }
+  double mapUs = elapsedUs(start) / LOOKUP_ROUNDS;
+  counting = false;
+  uint32_t mapAllocations = allocations;
+
+  allocations = 0;
+  counting = true;
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < LOOKUP_ROUNDS; i++) {
+    byte id = CODEBOOK[i % CODEBOOK_GROUP_COUNT].deviceId;
+    const CodebookEntry* group = codebook_find(id);
+    sink = sink + group->code[0];
+  }
+  double findUs = elapsedUs(start) / LOOKUP_ROUNDS;
+  counting = false;
+
+  char line[160];
+  snprintf(line, sizeof(line),
+           "lookup: maps %.3f us and %.1f allocations, codebook_find() "
+           "%.4f us and %u allocations, on the host",
+           mapUs, (double)mapAllocations / LOOKUP_ROUNDS, findUs,
+           (unsigned)allocations);
+  TEST_MESSAGE(line);
+  TEST_ASSERT_EQUAL(0, allocations);
+  TEST_ASSERT_GREATER_OR_EQUAL(LOOKUP_ROUNDS, mapAllocations);
+  TEST_ASSERT_TRUE(findUs < mapUs);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_heap);
+  RUN_TEST(test_boot_time);
+  RUN_TEST(test_lookup_time);
+  return UNITY_END();
+}
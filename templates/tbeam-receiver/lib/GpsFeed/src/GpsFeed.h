@@ -0,0 +1,378 @@
+/**
+ * @file GpsFeed.h
+ * @brief GPS parsing in a task of its own, fixes handed over as snapshots.
+ *
+ * TinyGPS++ only knows the NMEA bytes somebody feeds it. The tbeam-receiver
+ * template fed it in a busy wait (smartDelay()) that kept loop() away from
+ * the radio for seconds, the GPS devices did not feed it at all. GpsFeed
+ * drains the GPS UART in a task on the other core, woken by the UART
+ * receive event, feeds the parser as the bytes arrive and publishes every
+ * new fix. fix() returns the latest one without ever waiting for the task.
+ *
+ *   GpsFeed gps_feed;
+ *   ...
+ *   setupBoards();
+ *   gps_feed.begin(SerialGPS);
+ *   ...
+ *   GpsFix fix = gps_feed.fix();
+ *   if (fix.updates != shown_updates) { ... }
+ *
+ * The fixes are passed through a lock-free triple buffer, as the texts of
+ * OledUi: the task always has a slot to write and loop() always reads the
+ * latest complete fix. feed() is all the parsing there is, a recorded NMEA
+ * stream fed to it in chunks of any size and at any rate gives the fixes
+ * the receiver would have.
+ *
+ * Build with GPS_UBX to switch the receiver to binary UBX output instead:
+ * the task turns the NMEA sentences off and NAV-POSLLH, NAV-SOL and
+ * NAV-TIMEUTC on (the NEO-6M predates NAV-PVT), and decodes them with
+ * UbxParser. That is about 125 instead of some 500 bytes per fix, and no
+ * number is parsed from text. The setting is not saved in the receiver,
+ * the task sends it again whenever no UBX frame arrived for
+ * GPS_UBX_RETRY, e.g. after the GPS was powered up late.
+ */
+#pragma once
+
+#include <Arduino.h>
+#include <TinyGPS++.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <atomic>
+
+#include "UbxParser.h"
+
+// ms, the task drains the UART at least this often, in case a receive event
+// is missed
+#ifndef GPS_POLL_PERIOD
+#define GPS_POLL_PERIOD 100
+#endif
+
+// ms between the feed statistics on Serial, 0 == off
+#ifndef GPS_STATS_INTERVAL
+#define GPS_STATS_INTERVAL 60000
+#endif
+
+#define GPS_TASK_PRIORITY 1
+#define GPS_TASK_STACK 3072
+// bytes read from the UART at a time
+#define GPS_CHUNK_SIZE 64
+
+// ms without a UBX frame until the receiver is configured again
+#ifndef GPS_UBX_RETRY
+#define GPS_UBX_RETRY 5000
+#endif
+
+/**
+ * One fix, as published by the task. updates counts the fixes, a changed
+ * value replaces TinyGPS++'s location.isUpdated().
+ */
+struct GpsFix {
+  bool valid;  // false until the receiver has a location
+  uint32_t updates;
+  uint32_t time;    // ms, millis() when the fix was parsed
+  double lat;       // degrees
+  double lng;       // degrees
+  double altitude;  // m
+  uint32_t satellites;
+  uint16_t year;
+  uint8_t month, day;
+  uint8_t hour, minute, second, centisecond;  // UTC
+
+  // ms since the fix was parsed, as TinyGPS++'s location.age()
+  uint32_t age() const { return millis() - time; }
+};
+
+/**
+ * Counters since begin(), written by the task.
+ */
+struct GpsFeedStats {
+  uint32_t bytes;      // bytes fed to the parser
+  uint32_t sentences;  // NMEA sentences or UBX frames, valid checksum
+  uint32_t failed;     // checksum errors
+  uint32_t fixes;      // published fixes
+  uint32_t wakeups;    // task passes, by UART event or GPS_POLL_PERIOD
+  uint32_t drainTime;  // us, reading and parsing, total
+  uint32_t maxDrain;   // us, longest pass, since the last printStats()
+};
+
+class GpsFeed {
+ public:
+  /**
+   * Starts the task on the core loop() does not run on and hooks it to the
+   * receive event of the UART. Call after the UART is started.
+   */
+  void begin(HardwareSerial& serial) {
+    this->serial = &serial;
+    xTaskCreatePinnedToCore(feedTask, "gps_feed", GPS_TASK_STACK, this,
+                            GPS_TASK_PRIORITY, &task, 1 - xPortGetCoreID());
+    // runs in the UART driver's event task, only wakes the feed task
+    serial.onReceive([this]() { xTaskNotifyGive(task); });
+  }
+
+  /**
+   * Latest fix, no parsing and no waiting. Call from loop() only, the reading
+   * side of the triple buffer is not shared.
+   */
+  GpsFix fix() {
+    if (middle_slot.load() & SLOT_FRESH) {
+      read_slot = middle_slot.exchange(read_slot) & ~SLOT_FRESH;
+    }
+    return slots[read_slot];
+  }
+
+  /**
+   * Feeds received bytes to the parser and publishes each new fix. Called by
+   * the task, or directly with a recorded stream instead of begin().
+   */
+  void feed(const uint8_t* data, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+#ifdef GPS_UBX
+      if (ubx.encode(data[i])) {
+        decodeUbx();
+      }
+#else
+      if (gps.encode(data[i]) && gps.location.isUpdated()) {
+        readNmea(slots[write_slot]);
+        publish();
+      }
+#endif
+    }
+    bytes += size;
+  }
+
+  GpsFeedStats feedStats() {
+#ifdef GPS_UBX
+    return {bytes,   ubx.passedChecksum(), ubx.failedChecksum(), fixes,
+            wakeups, drain_time,           max_drain};
+#else
+    return {bytes,   gps.passedChecksum(), gps.failedChecksum(), fixes,
+            wakeups, drain_time,           max_drain};
+#endif
+  }
+
+  /**
+   * Prints the bytes and sentences per second since the last call, the
+   * checksum errors, the bytes and task time per fix and the longest pass
+   * of the task. Bytes and time per fix compare the NMEA and UBX builds.
+   */
+  void printStats(Print& out) {
+    uint32_t now = millis();
+    uint32_t seconds = (now - stats_start) / 1000;
+    if (seconds == 0) seconds = 1;
+    GpsFeedStats total = feedStats();
+
+    out.print("GPS: ");
+    out.print((total.bytes - printed.bytes) / seconds);
+    out.print(" bytes/s, ");
+    out.print(total.sentences - printed.sentences);
+#ifdef GPS_UBX
+    out.print(" UBX frames (");
+#else
+    out.print(" sentences (");
+#endif
+    out.print(total.failed - printed.failed);
+    out.print(" bad), ");
+    uint32_t fixCount = total.fixes - printed.fixes;
+    out.print(fixCount);
+    out.print(" fixes, ");
+    if (fixCount > 0) {
+      out.print((total.bytes - printed.bytes) / fixCount);
+      out.print(" bytes and ");
+      out.print((total.drainTime - printed.drainTime) / fixCount);
+      out.print("us per fix, ");
+    }
+    out.print(total.wakeups - printed.wakeups);
+    out.print(" wakeups, drain max ");
+    out.print(total.maxDrain);
+    out.println("us");
+
+    printed = total;
+    max_drain = 0;
+    stats_start = now;
+  }
+
+ private:
+  // marks the middle slot as written and not yet taken by loop()
+  static constexpr uint8_t SLOT_FRESH = 0x80;
+
+  HardwareSerial* serial = nullptr;
+  TaskHandle_t task = nullptr;
+  // owned by the task
+#ifdef GPS_UBX
+  UbxParser ubx;
+  // navigation epoch being collected, by its GPS time of week
+  GpsFix epoch = {};
+  uint32_t epoch_itow = 0;
+  uint8_t epoch_parts = 0;
+  uint32_t last_ubx = 0;  // ms, last frame or configuration
+#else
+  TinyGPSPlus gps;
+#endif
+
+  // triple buffer: the task writes one slot, loop() reads another and the
+  // third is handed over between them
+  GpsFix slots[3] = {};
+  uint8_t write_slot = 0;
+  std::atomic<uint8_t> middle_slot{1};
+  uint8_t read_slot = 2;
+
+  // written by the task
+  uint32_t bytes = 0;
+  uint32_t fixes = 0;
+  uint32_t wakeups = 0;
+  uint32_t drain_time = 0;
+  uint32_t max_drain = 0;
+  GpsFeedStats printed = {};
+  uint32_t stats_start = 0;
+
+  // hands the fix in the write slot over to loop()
+  void publish() {
+    GpsFix& next = slots[write_slot];
+    next.updates = ++fixes;
+    next.time = millis();
+    write_slot = middle_slot.exchange(write_slot | SLOT_FRESH) & ~SLOT_FRESH;
+  }
+
+#ifdef GPS_UBX
+  // parts of a navigation epoch, published once all arrived
+  static constexpr uint8_t EPOCH_POSLLH = 0x01;
+  static constexpr uint8_t EPOCH_SOL = 0x02;
+  static constexpr uint8_t EPOCH_TIMEUTC = 0x04;
+  static constexpr uint8_t EPOCH_COMPLETE = 0x07;
+
+  /**
+   * Switches the NMEA sentences off and the navigation messages on, once per
+   * navigation solution. Not saved, the receiver starts with NMEA again.
+   */
+  void configureUbx() {
+    // GGA, GLL, GSA, GSV, RMC, VTG
+    for (uint8_t id = 0x00; id <= 0x05; id++) {
+      const uint8_t rate[] = {UBX_CLASS_NMEA, id, 0};
+      UbxParser::write(*serial, UBX_CLASS_CFG, UBX_CFG_MSG, rate, sizeof(rate));
+    }
+    const uint8_t nav[] = {UBX_NAV_POSLLH, UBX_NAV_SOL, UBX_NAV_TIMEUTC};
+    for (uint8_t id : nav) {
+      const uint8_t rate[] = {UBX_CLASS_NAV, id, 1};
+      UbxParser::write(*serial, UBX_CLASS_CFG, UBX_CFG_MSG, rate, sizeof(rate));
+    }
+    last_ubx = millis();
+  }
+
+  /**
+   * Collects the fields of a navigation epoch from its messages, field
+   * offsets as in the u-blox 6 protocol specification. A complete epoch
+   * with a valid position is published.
+   */
+  void decodeUbx() {
+    last_ubx = millis();
+    if (ubx.msgClass() != UBX_CLASS_NAV) return;
+
+    uint8_t part;
+    uint16_t size;
+    switch (ubx.msgId()) {
+      case UBX_NAV_POSLLH:
+        part = EPOCH_POSLLH;
+        size = 28;
+        break;
+      case UBX_NAV_SOL:
+        part = EPOCH_SOL;
+        size = 52;
+        break;
+      case UBX_NAV_TIMEUTC:
+        part = EPOCH_TIMEUTC;
+        size = 20;
+        break;
+      default:
+        return;
+    }
+    if (ubx.length() < size) return;
+
+    // all messages of an epoch carry its time of week
+    uint32_t itow = ubx.u4(0);
+    if (itow != epoch_itow || epoch_parts == 0) {
+      epoch_itow = itow;
+      epoch_parts = 0;
+    }
+    epoch_parts |= part;
+
+    if (part == EPOCH_POSLLH) {
+      epoch.lng = ubx.i4(4) * 1e-7;
+      epoch.lat = ubx.i4(8) * 1e-7;
+      epoch.altitude = ubx.i4(16) / 1000.0;  // above mean sea level
+    } else if (part == EPOCH_SOL) {
+      uint8_t fixType = ubx.u1(10);
+      bool fixOk = ubx.u1(11) & 0x01;
+      // 2D, 3D or GPS + dead reckoning
+      epoch.valid = fixOk && fixType >= 0x02 && fixType <= 0x04;
+      epoch.satellites = ubx.u1(47);
+    } else {
+      int32_t nano = ubx.i4(8);
+      epoch.year = ubx.u2(12);
+      epoch.month = ubx.u1(14);
+      epoch.day = ubx.u1(15);
+      epoch.hour = ubx.u1(16);
+      epoch.minute = ubx.u1(17);
+      epoch.second = ubx.u1(18);
+      epoch.centisecond = nano > 0 ? nano / 10000000 : 0;
+    }
+
+    if (epoch_parts == EPOCH_COMPLETE) {
+      epoch_parts = 0;
+      if (epoch.valid) {
+        slots[write_slot] = epoch;
+        publish();
+      }
+    }
+  }
+#else
+  void readNmea(GpsFix& next) {
+    next.valid = gps.location.isValid();
+    next.lat = gps.location.lat();
+    next.lng = gps.location.lng();
+    next.altitude = gps.altitude.meters();
+    next.satellites = gps.satellites.value();
+    next.year = gps.date.year();
+    next.month = gps.date.month();
+    next.day = gps.date.day();
+    next.hour = gps.time.hour();
+    next.minute = gps.time.minute();
+    next.second = gps.time.second();
+    next.centisecond = gps.time.centisecond();
+  }
+#endif
+
+  static void feedTask(void* param) {
+    GpsFeed* feed = (GpsFeed*)param;
+    uint8_t chunk[GPS_CHUNK_SIZE];
+#ifdef GPS_UBX
+    feed->configureUbx();
+#endif
+    while (true) {
+      ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(GPS_POLL_PERIOD));
+      feed->wakeups++;
+#ifdef GPS_UBX
+      if (millis() - feed->last_ubx >= GPS_UBX_RETRY) {
+        feed->configureUbx();
+      }
+#endif
+
+      uint32_t start = micros();
+      int available;
+      while ((available = feed->serial->available()) > 0) {
+        size_t size = feed->serial->readBytes(
+            chunk, available < GPS_CHUNK_SIZE ? available : GPS_CHUNK_SIZE);
+        feed->feed(chunk, size);
+      }
+      uint32_t time = micros() - start;
+      feed->drain_time += time;
+      if (time > feed->max_drain) feed->max_drain = time;
+
+#if GPS_STATS_INTERVAL > 0
+      if (millis() - feed->stats_start >= GPS_STATS_INTERVAL) {
+        feed->printStats(Serial);
+      }
+#endif
+    }
+  }
+};
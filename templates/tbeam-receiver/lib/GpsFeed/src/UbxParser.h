@@ -0,0 +1,181 @@
+/**
+ * @file UbxParser.h
+ * @brief Frame parser for the binary UBX protocol of u-blox receivers.
+ *
+ *   [0xB5][0x62][class][id][length, 2 bytes LE][payload][CK_A][CK_B]
+ *
+ * encode() takes one byte at a time and returns true once a frame with a
+ * valid Fletcher checksum is complete. The payload is then read in place,
+ * with the little-endian field readers at their offsets from the u-blox
+ * protocol description, no text is formatted or parsed. Frames longer than
+ * UBX_MAX_PAYLOAD are skipped, the navigation messages used by GpsFeed are
+ * all shorter.
+ */
+#pragma once
+
+#include <Arduino.h>
+
+#define UBX_SYNC_1 0xB5
+#define UBX_SYNC_2 0x62
+
+#ifndef UBX_MAX_PAYLOAD
+#define UBX_MAX_PAYLOAD 64
+#endif
+
+// message classes and ids
+#define UBX_CLASS_NAV 0x01
+#define UBX_NAV_POSLLH 0x02
+#define UBX_NAV_SOL 0x06
+#define UBX_NAV_TIMEUTC 0x21
+#define UBX_CLASS_CFG 0x06
+#define UBX_CFG_MSG 0x01
+#define UBX_CLASS_NMEA 0xF0
+
+class UbxParser {
+ public:
+  /**
+   * Feeds one byte. Returns true if it completed a frame with a valid
+   * checksum, which stays readable until the next byte.
+   */
+  bool encode(uint8_t c) {
+    switch (state) {
+      case SYNC_1:
+        if (c == UBX_SYNC_1) state = SYNC_2;
+        return false;
+      case SYNC_2:
+        state = c == UBX_SYNC_2 ? CLASS : (c == UBX_SYNC_1 ? SYNC_2 : SYNC_1);
+        return false;
+      case CLASS:
+        ck_a = ck_b = 0;
+        add(c);
+        msg_class = c;
+        state = ID;
+        return false;
+      case ID:
+        add(c);
+        msg_id = c;
+        state = LENGTH_1;
+        return false;
+      case LENGTH_1:
+        add(c);
+        msg_length = c;
+        state = LENGTH_2;
+        return false;
+      case LENGTH_2:
+        add(c);
+        msg_length |= c << 8;
+        received = 0;
+        if (msg_length > UBX_MAX_PAYLOAD) {
+          skipped++;
+          state = SKIP;
+        } else {
+          state = msg_length > 0 ? PAYLOAD : CK_A;
+        }
+        return false;
+      case PAYLOAD:
+        add(c);
+        buffer[received++] = c;
+        if (received == msg_length) state = CK_A;
+        return false;
+      case CK_A:
+        state = c == ck_a ? CK_B : SYNC_1;
+        if (c != ck_a) failed++;
+        return false;
+      case CK_B:
+        state = SYNC_1;
+        if (c != ck_b) {
+          failed++;
+          return false;
+        }
+        passed++;
+        return true;
+      case SKIP:
+        // payload and checksum of a frame too long for the buffer
+        if (++received >= msg_length + 2) state = SYNC_1;
+        return false;
+    }
+    return false;
+  }
+
+  uint8_t msgClass() const { return msg_class; }
+  uint8_t msgId() const { return msg_id; }
+  uint16_t length() const { return msg_length; }
+  const uint8_t* payload() const { return buffer; }
+
+  bool is(uint8_t cls, uint8_t id) const {
+    return msg_class == cls && msg_id == id;
+  }
+
+  // fields of the last frame, little-endian at the offset into the payload
+  uint8_t u1(uint8_t offset) const { return buffer[offset]; }
+  uint16_t u2(uint8_t offset) const {
+    return buffer[offset] | buffer[offset + 1] << 8;
+  }
+  uint32_t u4(uint8_t offset) const {
+    return (uint32_t)buffer[offset] | (uint32_t)buffer[offset + 1] << 8 |
+           (uint32_t)buffer[offset + 2] << 16 |
+           (uint32_t)buffer[offset + 3] << 24;
+  }
+  int32_t i4(uint8_t offset) const { return (int32_t)u4(offset); }
+
+  uint32_t passedChecksum() const { return passed; }
+  uint32_t failedChecksum() const { return failed; }
+  uint32_t skippedFrames() const { return skipped; }
+
+  /**
+   * Writes a complete frame with the given payload to out, e.g. a
+   * configuration message to the receiver.
+   */
+  static void write(Print& out, uint8_t cls, uint8_t id, const uint8_t* data,
+                    uint16_t size) {
+    uint8_t header[] = {UBX_SYNC_1, UBX_SYNC_2, cls,
+                        id,         (uint8_t)(size & 0xff),
+                        (uint8_t)(size >> 8)};
+    uint8_t a = 0, b = 0;
+    for (uint8_t i = 2; i < sizeof(header); i++) {
+      a += header[i];
+      b += a;
+    }
+    for (uint16_t i = 0; i < size; i++) {
+      a += data[i];
+      b += a;
+    }
+    out.write(header, sizeof(header));
+    out.write(data, size);
+    out.write(a);
+    out.write(b);
+  }
+
+ private:
+  enum State : uint8_t {
+    SYNC_1,
+    SYNC_2,
+    CLASS,
+    ID,
+    LENGTH_1,
+    LENGTH_2,
+    PAYLOAD,
+    CK_A,
+    CK_B,
+    SKIP,
+  };
+
+  State state = SYNC_1;
+  uint8_t msg_class = 0;
+  uint8_t msg_id = 0;
+  uint16_t msg_length = 0;
+  uint16_t received = 0;
+  uint8_t ck_a = 0;
+  uint8_t ck_b = 0;
+  uint8_t buffer[UBX_MAX_PAYLOAD];
+
+  uint32_t passed = 0;
+  uint32_t failed = 0;
+  uint32_t skipped = 0;
+
+  // 8-bit Fletcher checksum over class, id, length and payload
+  void add(uint8_t c) {
+    ck_a += c;
+    ck_b += ck_a;
+  }
+};
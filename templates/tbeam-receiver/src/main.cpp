@@ -1,5 +1,5 @@
+#include <GpsFeed.h>
 #include <LoRa.h>
-#include <TinyGPS++.h>
 
 #include "LoRaBoards.h"
 #include "SSD1306.h"
@@ -24,13 +24,19 @@ String packet;
 byte broadcastAddress = 0xFF;
 byte localAddress = 0xF2;  // address of this device
 
-TinyGPSPlus gps;
+// NMEA parsed in the background, loop() only takes the latest fix
+GpsFeed gps_feed;
+uint32_t shown_fix = 0;
 // HardwareSerial SerialGPS(1);
 
+// the display is redrawn this often, the radio is checked in every pass
+#define DISPLAY_INTERVAL 1000  // ms
+unsigned long last_draw = 0;
+
 // void LoRa_txMode();
 // void LoRa_rxMode();
 
-void displayInfo();
+void displayInfo(const GpsFix& fix);
 
 void LoRa_sendMessage(String message) {
   // LoRa_txMode();                        // set tx mode
@@ -77,15 +83,9 @@ void LoRa_onReceive(int packetSize) {
 
 void LoRa_onTxDone() { Serial.println("TxDone"); }
 
-static void smartDelay(unsigned long ms) {
-  unsigned long start = millis();
-  do {
-    while (SerialGPS.available()) gps.encode(SerialGPS.read());
-  } while (millis() - start < ms);
-}
-
 void setup() {
   setupBoards();
+  gps_feed.begin(SerialGPS);
   delay(1500);
 
   // Initialising the UI will init the display too.
@@ -123,16 +123,26 @@ void setup() {
 }
 
 void loop() {
-  display.clear();
-  display.setTextAlignment(TEXT_ALIGN_LEFT);
-  display.setFont(ArialMT_Plain_10);
-
-  display.drawString(100, 0, "0x" + String(localAddress, HEX));
+  GpsFix fix = gps_feed.fix();
+  if (millis() - last_draw >= DISPLAY_INTERVAL) {
+    last_draw = millis();
+    display.clear();
+    display.setTextAlignment(TEXT_ALIGN_LEFT);
+    display.setFont(ArialMT_Plain_10);
+
+    display.drawString(100, 0, "0x" + String(localAddress, HEX));
+
+    // a new fix since the last redraw
+    if (fix.updates != shown_fix) {
+      shown_fix = fix.updates;
+      display.drawString(0, 0, "GPS [" + String(fix.satellites) + "]");
+    } else {
+      display.drawString(0, 0, "--- [" + String(fix.satellites) + "]");
+    }
+    display.display();
 
-  if (gps.location.isUpdated()) {
-    display.drawString(0, 0, "GPS [" + String(gps.satellites.value()) + "]");
-  } else {
-    display.drawString(0, 0, "--- [" + String(gps.satellites.value()) + "]");
+    if (millis() > 5000 && gps_feed.feedStats().bytes < 10)
+      Serial.println(F("No GPS data received: check wiring"));
   }
 
   // try to parse packet
@@ -169,71 +179,67 @@ void loop() {
   " + );
   }
   */
-  display.display();
 
   // GPS
   /*
   Serial.print("Latitude  : ");
-  Serial.println(gps.location.lat(), 5);
+  Serial.println(fix.lat, 5);
   Serial.print("Longitude : ");
-  Serial.println(gps.location.lng(), 4);
+  Serial.println(fix.lng, 4);
   Serial.print("Satellites: ");
-  Serial.println(gps.satellites.value());
+  Serial.println(fix.satellites);
   Serial.print("Altitude  : ");
-  Serial.print(gps.altitude.feet() / 3.2808);
+  Serial.print(fix.altitude);
   Serial.println("M");
   Serial.print("Time      : ");
-  Serial.print(gps.time.hour());
+  Serial.print(fix.hour);
   Serial.print(":");
-  Serial.print(gps.time.minute());
+  Serial.print(fix.minute);
   Serial.print(":");
-  Serial.println(gps.time.second());
+  Serial.println(fix.second);
   Serial.println("**********************");
   */
-  smartDelay(1000);
-
-  if (millis() > 5000 && gps.charsProcessed() < 10)
-    Serial.println(F("No GPS data received: check wiring"));
 
   // LoRa.receive();
 
-  delay(1000);
+  // the GPS task feeds the parser meanwhile
+  delay(10);
 }
 
-void displayInfo() {
+void displayInfo(const GpsFix& fix) {
   Serial.print(F("Location: "));
-  if (gps.location.isValid()) {
-    Serial.print(gps.location.lat(), 6);
+  if (fix.valid) {
+    Serial.print(fix.lat, 6);
     Serial.print(F(","));
-    Serial.print(gps.location.lng(), 6);
+    Serial.print(fix.lng, 6);
   } else {
     Serial.print(F("INVALID"));
   }
 
   Serial.print(F("  Date/Time: "));
-  if (gps.date.isValid()) {
-    Serial.print(gps.date.month());
+  if (fix.valid) {
+    Serial.print(fix.month);
     Serial.print(F("/"));
-    Serial.print(gps.date.day());
+    Serial.print(fix.day);
     Serial.print(F("/"));
-    Serial.print(gps.date.year());
+    Serial.print(fix.year);
   } else {
     Serial.print(F("INVALID"));
   }
 
   Serial.print(F(" "));
-  if (gps.time.isValid()) {
-    if (gps.time.hour() < 10) Serial.print(F("0"));
-    Serial.print(gps.time.hour());
+  if (fix.valid) {
+    if (fix.hour < 10) Serial.print(F("0"));
+    Serial.print(fix.hour);
     Serial.print(F(":"));
-    if (gps.time.minute() < 10) Serial.print(F("0"));
-    Serial.print(gps.time.minute());
+    if (fix.minute < 10) Serial.print(F("0"));
+    Serial.print(fix.minute);
     Serial.print(F(":"));
-    if (gps.time.second() < 10) Serial.print(F("0"));
-    Serial.print(gps.time.second());
+    if (fix.second < 10) Serial.print(F("0"));
+    Serial.print(fix.second);
     Serial.print(F("."));
-    if (gps.time.centisecond() < 10) Serial.print(F("0"));
-    Serial.print(gps.time.centisecond());
+    if (fix.centisecond < 10) Serial.print(F("0"));
+    Serial.print(fix.centisecond);
   } else {
     Serial.print(F("INVALID"));
   }
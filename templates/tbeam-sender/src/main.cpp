@@ -39,13 +39,27 @@ Button2 prgBtn;
 #define CONFIG_RADIO_SYNC 0x14
 #define CONFIG_LORA_DC 0.1
 
+// listen before talk: check the channel for other senders (CAD) before each
+// frame and wait a random time of up to LORA_LBT_BACKOFF if it is busy
+#define LORA_LBT_ENABLED false
+#define LORA_LBT_BACKOFF 500  // ms
+
+// frame layout: {recipient, sender} header, followed by the payload
+#define LORA_HEADER_SIZE 2
+#define LORA_MAX_PAYLOAD_SIZE 253
+
+// the gpio pin of the SX1276 is DIO1, which signals a detected preamble to
+// scanChannel()
 SX1276 radio =
-    new Module(RADIO_CS_PIN, RADIO_DIO0_PIN, RADIO_RST_PIN, RADIO_BUSY_PIN);
+    new Module(RADIO_CS_PIN, RADIO_DIO0_PIN, RADIO_RST_PIN, RADIO_DIO1_PIN);
 
 // save transmission state between loops
 static int transmissionState = RADIOLIB_ERR_NONE;
 // flag to indicate that a packet was sent
 static volatile bool lora_tx_available = false;
+
+// frame buffer, the header bytes are reserved in front of the payload
+static byte lora_frame[LORA_HEADER_SIZE + LORA_MAX_PAYLOAD_SIZE];
 static uint32_t counter = 0;
 // static String payload;
 
@@ -56,12 +70,16 @@ bool transmit_loop = true;
 RadioLibTime_t lora_transmission_start_time = 0;
 RadioLibTime_t lora_transmission_end_time = 0;
 RadioLibTime_t lora_dc_time = 0;
+RadioLibTime_t lora_backoff_end_time = 0;
 ///
 ///
 bool lora_transmit_available();
 bool lora_dutyCycle_available();
+bool lora_channel_free();
 bool lora_send_packet(String payload, byte recipientAddress);
 bool lora_send_packet(byte payload[], size_t size, byte recipientAddress);
+byte* lora_frame_payload();
+bool lora_send_frame(size_t size, byte recipientAddress);
 
 void click_callback(Button2& b);
 
@@ -327,7 +345,8 @@ void loop() {
 }
 
 bool lora_transmit_available() {
-  if (lora_tx_available && lora_dutyCycle_available())
+  if (lora_tx_available && lora_dutyCycle_available() &&
+      millis() >= lora_backoff_end_time)
     return true;
   else {
     return false;
@@ -348,59 +367,85 @@ bool lora_dutyCycle_available() {
   }
 }
 
-bool lora_send_packet(String payload, byte recipientAddress) {
-  // String to byte array
-  // cf.
-  // https://arduino.stackexchange.com/questions/21846/how-to-convert-string-to-byte-array
-
-  /*
-   * DO NOT USE sizeof(payload), as it will possibly return not the right length
-   * of the String! +1 because of '\0' termination of string
-   */
-  int payloadSize = payload.length() + 1;
-  byte bytePayload[payloadSize];
-  payload.getBytes(bytePayload, sizeof(bytePayload));
-
-  // Comment on size of payload cf. https://stackoverflow.com/a/37539
-  return lora_send_packet(bytePayload, sizeof(bytePayload) / sizeof(byte),
-                          recipientAddress);
+/**
+ * Channel activity detection: returns false if another device is sending right
+ * now.
+ */
+bool lora_channel_free() {
+  // the CAD done interrupt is not for callback_lora_tx_finished()
+  radio.clearPacketSentAction();
+  int state = radio.scanChannel();
+  radio.setPacketSentAction(callback_lora_tx_finished);
+  return state != RADIOLIB_PREAMBLE_DETECTED;
 }
 
-bool lora_send_packet(byte payload[], size_t size, byte recipientAddress) {
+byte* lora_frame_payload() { return lora_frame + LORA_HEADER_SIZE; }
+
+bool lora_send_frame(size_t size, byte recipientAddress) {
   // check if the previous transmission finished
   if (!lora_transmit_available()) {
     Serial.println(F("Last transmission not finished"));
     return false;
   }
 
-  if (size >= 254) {
+  if (size > LORA_MAX_PAYLOAD_SIZE) {
     Serial.println(F("Payload exceeds 254 Bytes"));
     return false;
   }
 
-  /**
-   * cf.
-   * https://stackoverflow.com/questions/71316261/arduino-how-to-concatenate-byte-arrays-to-get-a-final-array
-   */
-  // concatenate header + payload
-  byte header[] = {broadcastAddress, localAddress};
-  byte message[sizeof(header) + size];
+  // fill in the header bytes reserved in front of the payload
+  lora_frame[0] = recipientAddress;
+  lora_frame[1] = localAddress;
+  size_t frameSize = LORA_HEADER_SIZE + size;
 
-  memcpy(message, header, sizeof(header));
-  memcpy(message + sizeof(header), payload, size);
+  if (LORA_LBT_ENABLED && !lora_channel_free()) {
+    // try again after a random backoff, lora_transmit_available() waits for it
+    lora_backoff_end_time = millis() + random(1, LORA_LBT_BACKOFF + 1);
+    Serial.println(F("Channel busy, backing off"));
+    return false;
+  }
 
   // reset flag
   lora_tx_available = false;
 
   Serial.println("Transmit duration estimated: " +
-                 String(radio.getTimeOnAir(sizeof(message))));
+                 String(radio.getTimeOnAir(frameSize)));
 
   // transmit
   lora_transmission_start_time = millis();
-  transmissionState = radio.startTransmit(message, sizeof(message));
+  transmissionState = radio.startTransmit(lora_frame, frameSize);
   return true;
 }
 
+bool lora_send_packet(String payload, byte recipientAddress) {
+  /*
+   * DO NOT USE sizeof(payload), as it will possibly return not the right length
+   * of the String! +1 because of '\0' termination of string
+   */
+  size_t payloadSize = payload.length() + 1;
+  if (payloadSize > LORA_MAX_PAYLOAD_SIZE) {
+    Serial.println(F("Payload exceeds 254 Bytes"));
+    return false;
+  }
+
+  // copy the String straight into the frame, behind the reserved header
+  payload.getBytes(lora_frame_payload(), payloadSize);
+  return lora_send_frame(payloadSize, recipientAddress);
+}
+
+bool lora_send_packet(byte payload[], size_t size, byte recipientAddress) {
+  if (size > LORA_MAX_PAYLOAD_SIZE) {
+    Serial.println(F("Payload exceeds 254 Bytes"));
+    return false;
+  }
+
+  // payloads written in place via lora_frame_payload() need no copy at all
+  if (payload != lora_frame_payload()) {
+    memcpy(lora_frame_payload(), payload, size);
+  }
+  return lora_send_frame(size, recipientAddress);
+}
+
 void click_callback(Button2& b) {
   transmit_loop = !transmit_loop;
   Serial.println("Triggering LoRa transmit loop to " + String(transmit_loop));
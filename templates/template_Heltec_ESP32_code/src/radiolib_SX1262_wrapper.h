@@ -12,11 +12,22 @@
 
 #define LORA_DUTY_CYCLE_INTERVAL    1000 // ms 
 
+// listen before talk: check the channel for other senders (CAD) before each frame
+// and wait a random time of up to LORA_LBT_BACKOFF if it is busy
+#define LORA_LBT_ENABLED            false
+#define LORA_LBT_BACKOFF            500 // ms
+
+// frame layout: {recipient, sender} header, followed by the payload
+#define LORA_HEADER_SIZE            2
+#define LORA_MAX_PAYLOAD_SIZE       253
+
 // save transmission state between loops
 static int lora_tx_state = RADIOLIB_ERR_NONE;
 static int lora_rx_state = RADIOLIB_ERR_NONE;
 // flag to indicate that transmit is available
 static volatile bool lora_tx_available = false;
+// frame buffer, the header bytes are reserved in front of the payload
+static byte lora_frame[LORA_HEADER_SIZE + LORA_MAX_PAYLOAD_SIZE];
 /*
 * 0 -> receive mode
 * 1 -> message available
@@ -25,6 +36,7 @@ static volatile bool lora_tx_available = false;
 */
 static volatile uint8_t lora_state = 0;
 RadioLibTime_t  lora_transmission_end_time = 0;
+RadioLibTime_t  lora_backoff_end_time = 0;
 
 byte localAddress = 0x01; 
 
@@ -147,7 +159,7 @@ bool lora_dutyCycle_available() {
 }
 
 bool lora_transmit_available() {
-  if (lora_tx_available && lora_dutyCycle_available())   
+  if (lora_tx_available && lora_dutyCycle_available() && millis() >= lora_backoff_end_time)   
     return true;  
   else {    
     return false;
@@ -155,55 +167,96 @@ bool lora_transmit_available() {
 }
 
 /**
- * Send a byte payload to a specific recipient (i.e., the recpient address is added to the header).
+ * Channel activity detection: returns false if another device is sending right now.
+ * The radio is in standby afterwards.
  */
-bool lora_send_packet(byte payload[], size_t size, byte recipientAddress) {
+bool lora_channel_free() {
+  // the CAD done interrupt is not for callback_lora_action()
+  radio.clearDio1Action();
+  int state = radio.scanChannel();
+  radio.setDio1Action(callback_lora_action);
+  return state != RADIOLIB_LORA_DETECTED;
+}
+
+/**
+ * Returns the payload area of the frame buffer. Write the payload directly into it 
+ * (at most LORA_MAX_PAYLOAD_SIZE bytes) and pass it on with lora_send_frame(), 
+ * the header is filled in front of it without copying the payload again.
+ */
+byte* lora_frame_payload() {
+  return lora_frame + LORA_HEADER_SIZE;
+}
+
+/**
+ * Send the payload that was written into lora_frame_payload() to a specific recipient.
+ */
+bool lora_send_frame(size_t size, byte recipientAddress) {
     // check if the previous transmission finished
   if (!lora_transmit_available()) {
     Serial.println(F("Last transmission not finished"));
     return false;
   }
    
-  if(size >= 254) {
+  if(size > LORA_MAX_PAYLOAD_SIZE) {
     Serial.println(F("Payload exceeds 254 Bytes"));
     return false;
   } 
 
-  /**
-  * cf. https://stackoverflow.com/questions/71316261/arduino-how-to-concatenate-byte-arrays-to-get-a-final-array
-  */
-  // concatenate header + payload
-  byte header[] = {recipientAddress, localAddress};
-  byte message[sizeof(header)+size];  
+  // fill in the header bytes reserved in front of the payload
+  lora_frame[0] = recipientAddress;
+  lora_frame[1] = localAddress;
+  size_t frameSize = LORA_HEADER_SIZE + size;
 
-  memcpy(message, header, sizeof(header));
-  memcpy(message+sizeof(header), payload, size);
+  if (LORA_LBT_ENABLED && !lora_channel_free()) {
+    // try again after a random backoff, lora_transmit_available() waits for it
+    lora_backoff_end_time = millis() + random(1, LORA_LBT_BACKOFF + 1);
+    Serial.println(F("Channel busy, backing off"));
+    // the CAD ended receive mode
+    radio.startReceive();
+    return false;
+  }
   
   // reset flag
   lora_tx_available = false;
   lora_state = 2;
   
   // transmit 
-  Serial.println("Transmit duration estimated: [" + String(sizeof(message)) + "Byte] " + String(radio.getTimeOnAir(sizeof(message))/1000) + "ms");  
-  lora_tx_state = radio.startTransmit(message, sizeof(message));  
+  Serial.println("Transmit duration estimated: [" + String(frameSize) + "Byte] " + String(radio.getTimeOnAir(frameSize)/1000) + "ms");  
+  lora_tx_state = radio.startTransmit(lora_frame, frameSize);  
   return true;
 }
 
+/**
+ * Send a byte payload to a specific recipient (i.e., the recpient address is added to the header).
+ */
+bool lora_send_packet(byte payload[], size_t size, byte recipientAddress) {
+  if(size > LORA_MAX_PAYLOAD_SIZE) {
+    Serial.println(F("Payload exceeds 254 Bytes"));
+    return false;
+  } 
+
+  // payloads written in place via lora_frame_payload() need no copy at all
+  if (payload != lora_frame_payload()) {
+    memcpy(lora_frame_payload(), payload, size);
+  }
+  return lora_send_frame(size, recipientAddress);
+}
+
 /**
  * Send a String payload to a specific recipient (i.e., the recpient address is added to the header).
  */
 bool lora_send_packet(String payload, byte recipientAddress) {
-  // String to byte array
-  // cf. https://arduino.stackexchange.com/questions/21846/how-to-convert-string-to-byte-array
- 
   /*
   * DO NOT USE sizeof(payload), as it will possibly return not the right length of the String!
   * +1 because of '\0' termination of string
   */
-  int payloadSize = payload.length() + 1 ;   
-  byte bytePayload[payloadSize]; 
-  payload.getBytes(bytePayload, sizeof(bytePayload));
- 
-  // Comment on size of payload cf. https://stackoverflow.com/a/37539
-  return lora_send_packet(bytePayload, sizeof(bytePayload)/sizeof(byte), recipientAddress);
+  size_t payloadSize = payload.length() + 1;
+  if(payloadSize > LORA_MAX_PAYLOAD_SIZE) {
+    Serial.println(F("Payload exceeds 254 Bytes"));
+    return false;
+  } 
+
+  // copy the String straight into the frame, behind the reserved header
+  payload.getBytes(lora_frame_payload(), payloadSize);
+  return lora_send_frame(payloadSize, recipientAddress);
 }